@@ -0,0 +1,486 @@
+#ifndef ASYNC_CPP
+#define ASYNC_CPP
+
+// Coroutine versions of the load, save and search operations, for callers
+// that want to overlap them or keep many in flight on one thread. They need
+// C++20 (build with -std=c++20); other builds leave YADA_HAS_COROUTINES
+// undefined and use the blocking APIs only.
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+#define YADA_HAS_COROUTINES 1
+
+#include "users.cpp"
+#include "scheduler.cpp"
+#include "storage.cpp"
+#include "usda.cpp"
+#include <coroutine>
+#include <optional>
+#include <tuple>
+#include <utility>
+#include <deque>
+#include <mutex>
+#include <exception>
+#include <stdexcept>
+#include <type_traits>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+using namespace std;
+
+struct AsyncPromiseBase
+{
+    coroutine_handle<> continuation; // The coroutine awaiting this one
+    exception_ptr error;
+
+    // Resumes the awaiting coroutine, if any, when the body finishes
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept { return false; }
+
+        template <typename Promise>
+        coroutine_handle<> await_suspend(coroutine_handle<Promise> handle) noexcept
+        {
+            coroutine_handle<> next = handle.promise().continuation;
+            return next ? next : noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { error = current_exception(); }
+};
+
+template <typename T>
+struct AsyncPromise : AsyncPromiseBase
+{
+    optional<T> value;
+
+    void return_value(T result) { value = move(result); }
+
+    T take()
+    {
+        if (error)
+        {
+            rethrow_exception(error);
+        }
+        return move(*value);
+    }
+};
+
+template <>
+struct AsyncPromise<void> : AsyncPromiseBase
+{
+    void return_void() {}
+
+    void take()
+    {
+        if (error)
+        {
+            rethrow_exception(error);
+        }
+    }
+};
+
+// A coroutine returning T. It starts when first awaited, or when handed to
+// AsyncExecutor::start to run alongside the caller; a started task must be
+// awaited before it is destroyed. Exceptions are rethrown to the awaiter.
+template <typename T = void>
+class AsyncTask
+{
+public:
+    struct promise_type : AsyncPromise<T>
+    {
+        AsyncTask get_return_object() { return AsyncTask(coroutine_handle<promise_type>::from_promise(*this)); }
+    };
+
+private:
+    coroutine_handle<promise_type> handle;
+    bool started = false;
+
+    explicit AsyncTask(coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    friend class AsyncExecutor;
+
+public:
+    AsyncTask(AsyncTask &&other) noexcept : handle(exchange(other.handle, nullptr)), started(other.started) {}
+    AsyncTask(const AsyncTask &) = delete;
+    AsyncTask &operator=(const AsyncTask &) = delete;
+
+    ~AsyncTask()
+    {
+        if (handle)
+        {
+            handle.destroy();
+        }
+    }
+
+    bool isDone() const { return handle.done(); }
+
+    auto operator co_await() noexcept
+    {
+        struct Awaiter
+        {
+            AsyncTask &task;
+
+            bool await_ready() { return task.handle.done(); }
+
+            coroutine_handle<> await_suspend(coroutine_handle<> awaiting)
+            {
+                task.handle.promise().continuation = awaiting;
+                if (!task.started)
+                {
+                    task.started = true;
+                    return task.handle;
+                }
+                return noop_coroutine(); // Already running; it resumes us when done
+            }
+
+            T await_resume() { return task.handle.promise().take(); }
+        };
+        return Awaiter{*this};
+    }
+};
+
+// Runs coroutines on the thread that calls run(). Blocking work is handed
+// to the TaskScheduler workers with offload() and the coroutine resumes on
+// this thread when it is done; pipes and sockets are waited for with epoll.
+// epoll cannot wait for regular files, so the data files are read and
+// written through offload() as well.
+class AsyncExecutor
+{
+private:
+    int epollFd = -1;
+    int wakeFd = -1; // Signalled when a coroutine becomes ready from another thread
+    mutex readyMutex;
+    deque<coroutine_handle<>> ready;
+
+    // Queues a coroutine to resume on the executor thread; any thread
+    void post(coroutine_handle<> handle)
+    {
+        {
+            lock_guard<mutex> lock(readyMutex);
+            ready.push_back(handle);
+        }
+        uint64_t one = 1;
+        ssize_t ignored = write(wakeFd, &one, sizeof(one));
+        (void)ignored;
+    }
+
+    // Resumes ready coroutines, or waits for them, until done() holds
+    template <typename Done>
+    void runUntil(Done done)
+    {
+        while (!done())
+        {
+            deque<coroutine_handle<>> batch;
+            {
+                lock_guard<mutex> lock(readyMutex);
+                batch.swap(ready);
+            }
+            if (!batch.empty())
+            {
+                for (auto handle : batch)
+                {
+                    handle.resume();
+                }
+                continue;
+            }
+
+            epoll_event events[64];
+            int count = epoll_wait(epollFd, events, 64, -1);
+            for (int i = 0; i < count; ++i)
+            {
+                if (events[i].data.ptr == nullptr)
+                {
+                    uint64_t value;
+                    ssize_t ignored = read(wakeFd, &value, sizeof(value));
+                    (void)ignored;
+                    continue;
+                }
+                auto *waiter = static_cast<FdAwaiter *>(events[i].data.ptr);
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, waiter->fd, nullptr);
+                waiter->awaiting.resume();
+            }
+        }
+    }
+
+    // Awaits a started task, keeping its result or its exception, so that
+    // whenAll never destroys a task that is still running
+    template <typename T>
+    static AsyncTask<> settle(AsyncTask<T> &task, optional<T> &result, exception_ptr &error)
+    {
+        try
+        {
+            result = co_await task;
+        }
+        catch (...)
+        {
+            if (!error)
+            {
+                error = current_exception();
+            }
+        }
+    }
+
+    template <size_t... I, typename... T>
+    AsyncTask<tuple<T...>> whenAllIndexed(index_sequence<I...>, AsyncTask<T>... tasks)
+    {
+        (start(tasks), ...);
+        tuple<optional<T>...> results;
+        exception_ptr error;
+        (co_await settle(tasks, get<I>(results), error), ...);
+        if (error)
+        {
+            rethrow_exception(error);
+        }
+        co_return tuple<T...>{move(*get<I>(results))...};
+    }
+
+    struct FdAwaiter
+    {
+        AsyncExecutor &executor;
+        int fd;
+        uint32_t events;
+        coroutine_handle<> awaiting;
+
+        FdAwaiter(AsyncExecutor &executor, int fd, uint32_t events) : executor(executor), fd(fd), events(events) {}
+
+        bool await_ready() { return false; }
+
+        bool await_suspend(coroutine_handle<> handle)
+        {
+            awaiting = handle;
+            epoll_event event{};
+            event.events = events | EPOLLONESHOT;
+            event.data.ptr = this;
+            // Regular files (EPERM) never block, and on other errors the
+            // caller's next read or write reports them; resume at once
+            return epoll_ctl(executor.epollFd, EPOLL_CTL_ADD, fd, &event) == 0;
+        }
+
+        void await_resume() {}
+    };
+
+    template <typename Function>
+    struct OffloadAwaiter
+    {
+        using Result = invoke_result_t<Function &>;
+        using Stored = conditional_t<is_void_v<Result>, bool, Result>;
+
+        AsyncExecutor &executor;
+        Function function;
+        optional<Stored> result;
+        exception_ptr error;
+
+        OffloadAwaiter(AsyncExecutor &executor, Function function) : executor(executor), function(move(function)) {}
+
+        void call()
+        {
+            if constexpr (is_void_v<Result>)
+            {
+                function();
+                result = true;
+            }
+            else
+            {
+                result = function();
+            }
+        }
+
+        // Without workers the function runs in await_resume instead
+        bool await_ready() { return TaskScheduler::instance().getWorkerCount() == 0; }
+
+        void await_suspend(coroutine_handle<> awaiting)
+        {
+            TaskScheduler::instance().post([this, awaiting]
+                                           {
+                try
+                {
+                    call();
+                }
+                catch (...)
+                {
+                    error = current_exception();
+                }
+                executor.post(awaiting); });
+        }
+
+        Result await_resume()
+        {
+            if (!result && !error)
+            {
+                call();
+            }
+            if (error)
+            {
+                rethrow_exception(error);
+            }
+            if constexpr (!is_void_v<Result>)
+            {
+                return move(*result);
+            }
+        }
+    };
+
+public:
+    AsyncExecutor()
+    {
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (epollFd < 0 || wakeFd < 0)
+        {
+            throw runtime_error(string("Cannot create the executor: ") + strerror(errno));
+        }
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+    }
+
+    ~AsyncExecutor()
+    {
+        close(epollFd);
+        close(wakeFd);
+    }
+
+    AsyncExecutor(const AsyncExecutor &) = delete;
+    AsyncExecutor &operator=(const AsyncExecutor &) = delete;
+
+    // Starts a task without waiting for it; await it later for its result
+    template <typename T>
+    void start(AsyncTask<T> &task)
+    {
+        if (!task.started)
+        {
+            task.started = true;
+            post(task.handle);
+        }
+    }
+
+    // Runs a task and everything it starts to completion on this thread
+    template <typename T>
+    T run(AsyncTask<T> task)
+    {
+        start(task);
+        runUntil([&]
+                 { return task.handle.done(); });
+        return task.handle.promise().take();
+    }
+
+    // Runs the tasks concurrently and returns their results in order. All
+    // of them finish before the first exception one threw is rethrown.
+    template <typename... T>
+    AsyncTask<tuple<T...>> whenAll(AsyncTask<T>... tasks)
+    {
+        return whenAllIndexed(index_sequence_for<T...>{}, move(tasks)...);
+    }
+
+    // Calls function on a worker thread; the awaiting coroutine resumes on
+    // the executor thread with its result
+    template <typename Function>
+    OffloadAwaiter<Function> offload(Function function)
+    {
+        return {*this, move(function)};
+    }
+
+    // Waits until a pipe or socket can be read or written
+    FdAwaiter readable(int fd) { return {*this, fd, EPOLLIN}; }
+    FdAwaiter writable(int fd) { return {*this, fd, EPOLLOUT}; }
+};
+
+// The operations below leave the manager to the worker while they are in
+// flight, except where noted: the caller must not use it until they return.
+
+inline AsyncTask<bool> loadDatabaseAsync(AsyncExecutor &executor, FoodManager &foodManager)
+{
+    co_return co_await executor.offload([&]
+                                        { return foodManager.loadDatabase(); });
+}
+
+// Catalog reads may overlap anything, so the manager stays usable
+inline AsyncTask<vector<shared_ptr<Food>>> searchFoodsAsync(AsyncExecutor &executor, const FoodManager &foodManager,
+                                                            vector<string> keywords, bool matchAll)
+{
+    co_return co_await executor.offload([&]
+                                        { return foodManager.searchFoods(keywords, matchAll); });
+}
+
+inline AsyncTask<bool> loadLogAsync(AsyncExecutor &executor, LogManager &logManager)
+{
+    co_return co_await executor.offload([&]
+                                        { return logManager.loadLog(); });
+}
+
+inline AsyncTask<bool> loadProfileAsync(AsyncExecutor &executor, ProfileManager &profileManager)
+{
+    co_return co_await executor.offload([&]
+                                        { return profileManager.loadProfile(); });
+}
+
+// Captures the snapshots on the executor thread and writes them on a
+// worker, so the manager may be changed while the write is in flight
+template <typename Manager>
+AsyncTask<bool> saveCapturedAsync(AsyncExecutor &executor, Manager &manager, string what)
+{
+    vector<FileSnapshot> snapshots = manager.captureSave();
+    string error;
+    bool saved = co_await executor.offload([&]
+                                           { return writeSnapshots(snapshots, false, error); });
+    if (!saved)
+    {
+        cerr << "Error saving " << what << ": " << error << endl;
+        manager.markModified();
+    }
+    co_return saved;
+}
+
+inline AsyncTask<bool> saveLogAsync(AsyncExecutor &executor, LogManager &logManager)
+{
+    return saveCapturedAsync(executor, logManager, "log");
+}
+
+inline AsyncTask<bool> saveProfileAsync(AsyncExecutor &executor, ProfileManager &profileManager)
+{
+    return saveCapturedAsync(executor, profileManager, "profile");
+}
+
+// Returns the user's session, loading its log and profile concurrently if
+// it is new. The flags report whether the files existed, as in getSession.
+inline AsyncTask<UserSession *> loadSessionAsync(AsyncExecutor &executor, UserManager &userManager, string name,
+                                                 bool *logLoaded = nullptr, bool *profileLoaded = nullptr)
+{
+    if (userManager.hasSession(name))
+    {
+        co_return &userManager.getSession(name);
+    }
+
+    unique_ptr<UserSession> session = userManager.createSession(name);
+    auto [logFound, profileFound] = co_await executor.whenAll(loadLogAsync(executor, session->logManager),
+                                                              loadProfileAsync(executor, session->profileManager));
+    if (logLoaded)
+    {
+        *logLoaded = logFound;
+    }
+    if (profileLoaded)
+    {
+        *profileLoaded = profileFound;
+    }
+    co_return &userManager.addSession(move(session));
+}
+
+// Looks the queries up in the USDA database on a worker; the client fetches
+// them concurrently on threads of its own
+inline AsyncTask<vector<UsdaClient::Result>> searchUsdaAsync(AsyncExecutor &executor, UsdaClient &client,
+                                                            vector<string> queries)
+{
+    co_return co_await executor.offload([&]
+                                        { return client.searchMany(queries); });
+}
+
+#endif
+
+#endif
@@ -0,0 +1,519 @@
+#ifndef BATCH_CPP
+#define BATCH_CPP
+
+#include "food.cpp"
+#include "log.cpp"
+#include "profile.cpp"
+#include "users.cpp"
+#include <string>
+#include <vector>
+#include <set>
+#include <iostream>
+#include <cstdlib>
+using namespace std;
+
+// Runs scripted commands, one per line, without menus or prompts. Queries
+// print one line each to the output; failed commands are reported on the
+// error stream with their line number and the script continues. Changes
+// are saved once, when the script ends.
+//
+//   user NAME                        act as another user from here on
+//   food add ID KEYWORDS CALORIES PROTEINS CARBS FATS [GRAMS [DESCRIPTION]]
+//   food composite ID KEYWORDS FOOD=QUANTITY...
+//   food show ID
+//   search all|any KEYWORDS
+//   log add DATE FOOD QUANTITY       quantity in servings ("1.5") or grams ("150g")
+//   log remove DATE FOOD
+//   log show DATE
+//   undo | redo
+//   summary FROM TO
+//   profile target [DATE]
+//   save                             save now rather than at the end
+//
+// KEYWORDS are comma-separated, DATE is YYYY-MM-DD or "today", and a
+// "quoted argument" may contain spaces. Blank lines and lines starting
+// with '#' are skipped.
+class BatchRunner
+{
+private:
+    FoodManager &foodManager;
+    UserManager &userManager;
+    UserSession *session;
+    ostream &out;
+    ostream &err;
+
+    // Consecutive food definitions are committed together, so the recipes
+    // are recomputed once per run of them rather than once per food
+    FoodManager::Transaction pendingFoods;
+    set<string> pendingIds;
+
+    size_t lineNumber = 0;
+    size_t commandCount = 0;
+    size_t errorCount = 0;
+
+    string lastDate; // Consecutive commands usually share a date
+    int lastDay = 0;
+
+    static bool tokenize(const string &line, vector<string> &tokens)
+    {
+        tokens.clear();
+        size_t i = 0;
+        while (i < line.size())
+        {
+            if (isspace(static_cast<unsigned char>(line[i])))
+            {
+                i++;
+                continue;
+            }
+            if (line[i] == '"')
+            {
+                size_t end = line.find('"', i + 1);
+                if (end == string::npos)
+                {
+                    return false;
+                }
+                tokens.push_back(line.substr(i + 1, end - i - 1));
+                i = end + 1;
+                continue;
+            }
+            size_t start = i;
+            while (i < line.size() && !isspace(static_cast<unsigned char>(line[i])))
+            {
+                i++;
+            }
+            tokens.push_back(line.substr(start, i - start));
+        }
+        return true;
+    }
+
+    static vector<string> splitKeywords(const string &text)
+    {
+        vector<string> keywords;
+        size_t start = 0;
+        while (start <= text.size())
+        {
+            size_t comma = text.find(',', start);
+            if (comma == string::npos)
+            {
+                comma = text.size();
+            }
+            if (comma > start)
+            {
+                keywords.push_back(text.substr(start, comma - start));
+            }
+            start = comma + 1;
+        }
+        return keywords;
+    }
+
+    static bool parseNumber(const string &text, double &value)
+    {
+        char *end;
+        value = strtod(text.c_str(), &end);
+        return !text.empty() && *end == '\0';
+    }
+
+    bool parseDay(const string &text, int &day, string &error)
+    {
+        if (text == lastDate)
+        {
+            day = lastDay;
+            return true;
+        }
+        if (text == "today")
+        {
+            day = Date::todayDayNumber();
+            return true;
+        }
+        if (!Date::parse(text, day))
+        {
+            error = "Invalid date '" + text + "'";
+            return false;
+        }
+        lastDate = text;
+        lastDay = day;
+        return true;
+    }
+
+    void flushFoods()
+    {
+        if (pendingFoods.size() == 0)
+        {
+            return;
+        }
+        string error;
+        if (!pendingFoods.commit(error)) // Components were checked as they were staged
+        {
+            err << "error: " << error << "\n";
+            errorCount++;
+            pendingFoods.rollback(); // Reported once, not again by the next flush
+        }
+        pendingIds.clear();
+    }
+
+    static void printNutrients(ostream &out, const Nutrients &nutrients)
+    {
+        out << nutrients.calories << " cal P " << nutrients.proteins << "g C " << nutrients.carbs
+            << "g F " << nutrients.fats << "g";
+    }
+
+    bool addFood(const vector<string> &args, string &error)
+    {
+        double values[5] = {0, 0, 0, 0, 0}; // Calories, proteins, carbs, fats, grams
+        if (args.size() < 8 || args.size() > 10)
+        {
+            error = "Usage: food add ID KEYWORDS CALORIES PROTEINS CARBS FATS [GRAMS [DESCRIPTION]]";
+            return false;
+        }
+        for (size_t i = 4; i < min<size_t>(args.size(), 9); ++i)
+        {
+            if (!parseNumber(args[i], values[i - 4]) || values[i - 4] < 0)
+            {
+                error = "Invalid number '" + args[i] + "'";
+                return false;
+            }
+        }
+        if (pendingIds.count(args[2]) || foodManager.getFoodById(args[2]))
+        {
+            error = "Food '" + args[2] + "' already exists";
+            return false;
+        }
+        vector<string> keywords = splitKeywords(args[3]);
+        if (keywords.empty())
+        {
+            error = "At least one keyword is required";
+            return false;
+        }
+
+        string description = args.size() == 10 ? args[9] : args[2];
+        pendingFoods.addBasicFood(args[2], keywords, values[0], description, values[1], values[2], values[3], values[4]);
+        pendingIds.insert(args[2]);
+        return true;
+    }
+
+    bool addComposite(const vector<string> &args, string &error)
+    {
+        if (args.size() < 5)
+        {
+            error = "Usage: food composite ID KEYWORDS FOOD=QUANTITY...";
+            return false;
+        }
+        if (pendingIds.count(args[2]) || foodManager.getFoodById(args[2]))
+        {
+            error = "Food '" + args[2] + "' already exists";
+            return false;
+        }
+        vector<string> keywords = splitKeywords(args[3]);
+        if (keywords.empty())
+        {
+            error = "At least one keyword is required";
+            return false;
+        }
+
+        // Components staged in this run are committed first, so that their
+        // serving weights are known
+        for (size_t i = 4; i < args.size(); ++i)
+        {
+            if (pendingIds.count(args[i].substr(0, args[i].find('='))))
+            {
+                flushFoods();
+                break;
+            }
+        }
+
+        map<string, Servings> components;
+        auto catalog = foodManager.read();
+        for (size_t i = 4; i < args.size(); ++i)
+        {
+            size_t equals = args[i].find('=');
+            string foodId = args[i].substr(0, equals);
+            const Food *component = catalog.find(foodId);
+            if (equals == string::npos || !component)
+            {
+                error = equals == string::npos ? "Expected FOOD=QUANTITY, got '" + args[i] + "'"
+                                               : "Unknown component '" + foodId + "'";
+                return false;
+            }
+            Servings servings;
+            if (!FoodManager::parseQuantity(component, args[i].substr(equals + 1), servings, error))
+            {
+                return false;
+            }
+            components[foodId] = servings;
+        }
+
+        pendingFoods.createCompositeFood(args[2], keywords, components);
+        pendingIds.insert(args[2]);
+        return true;
+    }
+
+    bool showFood(const vector<string> &args, string &error)
+    {
+        auto catalog = foodManager.read();
+        const Food *food = args.size() == 3 ? catalog.find(args[2]) : nullptr;
+        if (!food)
+        {
+            error = args.size() == 3 ? "Food '" + args[2] + "' not found" : "Usage: food show ID";
+            return false;
+        }
+        out << food->getId() << " " << food->getType() << " ";
+        printNutrients(out, food->getNutrientsPerServing());
+        if (food->getServingGrams() > Fixed())
+        {
+            out << " per " << food->getServingGrams() << "g";
+        }
+        out << "\n";
+        return true;
+    }
+
+    bool search(const vector<string> &args, string &error)
+    {
+        if (args.size() != 3 || (args[1] != "all" && args[1] != "any"))
+        {
+            error = "Usage: search all|any KEYWORDS";
+            return false;
+        }
+        auto foods = foodManager.searchFoods(splitKeywords(args[2]), args[1] == "all");
+        out << foods.size();
+        for (const auto &food : foods)
+        {
+            out << " " << food->getId();
+        }
+        out << "\n";
+        return true;
+    }
+
+    bool logCommand(const vector<string> &args, string &error)
+    {
+        int day;
+        if (args.size() < 3 || !parseDay(args[2], day, error))
+        {
+            if (error.empty())
+            {
+                error = "Usage: log add|remove|show DATE ...";
+            }
+            return false;
+        }
+        LogManager &logManager = session->logManager;
+
+        if (args[1] == "add" && args.size() == 5)
+        {
+            Servings servings;
+            if (!foodManager.parseQuantity(args[3], args[4], servings, error))
+            {
+                return false;
+            }
+            auto transaction = logManager.beginTransaction();
+            transaction.addFood(args[3], servings, day);
+            return transaction.commit(error);
+        }
+        if (args[1] == "remove" && args.size() == 4)
+        {
+            auto transaction = logManager.beginTransaction();
+            transaction.removeFood(args[3], day);
+            return transaction.commit(error);
+        }
+        if (args[1] == "show" && args.size() == 3)
+        {
+            Nutrients totals;
+            out << Date::format(day);
+            auto catalog = foodManager.read();
+            logManager.forEachDayInRange(day, day, [&](int, const DailyLog &log)
+                                         {
+                for (const auto &entry : log.getEntries())
+                {
+                    out << " " << entry.getFoodId() << "=" << entry.getServings();
+                    totals += entry.getTotalNutrients(catalog);
+                } });
+            out << " total ";
+            printNutrients(out, totals);
+            out << " target " << session->profileManager.getTargetCaloriesOn(day) << "\n";
+            return true;
+        }
+
+        error = "Usage: log add DATE FOOD QUANTITY | log remove DATE FOOD | log show DATE";
+        return false;
+    }
+
+    bool summary(const vector<string> &args, string &error)
+    {
+        int fromDay, toDay;
+        if (args.size() != 3)
+        {
+            error = "Usage: summary FROM TO";
+            return false;
+        }
+        if (!parseDay(args[1], fromDay, error) || !parseDay(args[2], toDay, error))
+        {
+            return false;
+        }
+        if (fromDay > toDay)
+        {
+            error = "FROM is after TO";
+            return false;
+        }
+
+        RangeTotals range = session->logManager.summarizeRange(fromDay, toDay);
+        out << Date::format(fromDay) << " " << Date::format(toDay) << " logged " << range.loggedDays
+            << "/" << (toDay - fromDay + 1) << " total ";
+        printNutrients(out, range.totals);
+        if (range.loggedDays > 0)
+        {
+            out << " average " << range.totals.calories / Fixed::fromInt(range.loggedDays) << " cal";
+        }
+        out << "\n";
+        return true;
+    }
+
+    bool profileCommand(const vector<string> &args, string &error)
+    {
+        int day = Date::todayDayNumber();
+        if (args.size() < 2 || args.size() > 3 || args[1] != "target")
+        {
+            error = "Usage: profile target [DATE]";
+            return false;
+        }
+        if (args.size() == 3 && !parseDay(args[2], day, error))
+        {
+            return false;
+        }
+        out << session->profileManager.getTargetCaloriesOn(day) << "\n";
+        return true;
+    }
+
+    bool execute(const vector<string> &args, string &error)
+    {
+        const string &command = args[0];
+        bool foodDefinition = command == "food" && args.size() > 1 && (args[1] == "add" || args[1] == "composite");
+        if (!foodDefinition)
+        {
+            flushFoods();
+        }
+
+        if (foodDefinition)
+        {
+            if (foodManager.isShared())
+            {
+                error = "The food database is shared read-only; add foods in the publishing process.";
+                return false;
+            }
+            return args[1] == "add" ? addFood(args, error) : addComposite(args, error);
+        }
+        if (command == "food" && args.size() > 1 && args[1] == "show")
+        {
+            return showFood(args, error);
+        }
+        if (command == "search")
+        {
+            return search(args, error);
+        }
+        if (command == "log")
+        {
+            return logCommand(args, error);
+        }
+        if (command == "undo" || command == "redo")
+        {
+            bool done = command == "undo" ? session->logManager.undo() : session->logManager.redo();
+            if (!done)
+            {
+                error = "Nothing to " + command;
+            }
+            return done;
+        }
+        if (command == "summary")
+        {
+            return summary(args, error);
+        }
+        if (command == "profile")
+        {
+            return profileCommand(args, error);
+        }
+        if (command == "user" && args.size() == 2)
+        {
+            if (!UserManager::isValidName(args[1]))
+            {
+                error = "Invalid user name '" + args[1] + "'";
+                return false;
+            }
+            session = &userManager.getSession(args[1]);
+            return true;
+        }
+        if (command == "save" && args.size() == 1)
+        {
+            if (!save())
+            {
+                error = "Saving failed";
+                return false;
+            }
+            return true;
+        }
+
+        error = "Unknown command '" + command + "'";
+        return false;
+    }
+
+public:
+    BatchRunner(FoodManager &foodManager, UserManager &userManager, const string &user,
+                ostream &out = cout, ostream &err = cerr)
+        : foodManager(foodManager), userManager(userManager), session(&userManager.getSession(user)),
+          out(out), err(err), pendingFoods(foodManager.beginTransaction()) {}
+
+    // Runs every command in the stream, then saves. Returns false if any
+    // command failed.
+    bool run(istream &in)
+    {
+        string line;
+        vector<string> args;
+        while (getline(in, line))
+        {
+            lineNumber++;
+            if (!line.empty() && line.back() == '\r')
+            {
+                line.pop_back();
+            }
+
+            string error;
+            if (!tokenize(line, args))
+            {
+                error = "Unterminated quote";
+            }
+            else if (args.empty() || args[0][0] == '#')
+            {
+                continue;
+            }
+            else
+            {
+                commandCount++;
+                if (execute(args, error))
+                {
+                    continue;
+                }
+            }
+
+            err << "line " << lineNumber << ": " << (error.empty() ? "Command failed" : error) << "\n";
+            errorCount++;
+        }
+
+        flushFoods();
+        if (!save())
+        {
+            err << "error: saving failed\n";
+            errorCount++;
+        }
+        out.flush();
+        return errorCount == 0;
+    }
+
+    // Saves the catalog and every loaded user that has changes
+    bool save()
+    {
+        flushFoods();
+        bool success = !foodManager.isModified() || foodManager.saveDatabase();
+        return userManager.saveModified() && success;
+    }
+
+    size_t getCommandCount() const { return commandCount; }
+    size_t getErrorCount() const { return errorCount; }
+};
+
+#endif
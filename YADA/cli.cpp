@@ -4,8 +4,16 @@
 #include "food.cpp"
 #include "log.cpp"
 #include "profile.cpp"
+#include "users.cpp"
+#include "importer.cpp"
+#include "exporter.cpp"
+#include "saver.cpp"
+#include "async.cpp"
+#include "usda.cpp"
 #include <iostream>
 #include <limits>
+#include <future>
+#include <chrono>
 using namespace std;
 
 // Enhanced Command Line Interface
@@ -13,9 +21,16 @@ class CLI
 {
 private:
     FoodManager &foodManager;
-    LogManager &logManager;
-    ProfileManager &profileManager;
+    UserManager &userManager;
+    string initialUser;
+    UserSession *session = nullptr; // Current user
     bool running = true;
+    future<pair<bool, string>> backgroundExport; // Export running on a log snapshot, if any
+    BackgroundSaver saver;                        // Writes changes off this thread
+    unique_ptr<UsdaClient> usdaClient;            // Created by the first online search
+
+    LogManager &logManager() { return session->logManager; }
+    ProfileManager &profileManager() { return session->profileManager; }
 
     const string RESET = "\033[0m";
     const string BOLD = "\033[1m";
@@ -63,11 +78,13 @@ private:
     void displayMenu()
     {
         printHeader("YADA (Yet Another Diet Assistant)");
+        cout << "Current user: " << session->getName() << "\n";
         printMenuOption("1", "Food Database");
         printMenuOption("2", "Daily Log");
         printMenuOption("3", "User Profile");
         printMenuOption("4", "Save All");
-        printMenuOption("5", "Exit");
+        printMenuOption("5", "Switch user");
+        printMenuOption("6", "Exit");
         printDivider();
         cout << "Enter your choice: ";
     }
@@ -82,7 +99,8 @@ private:
         printMenuOption("5", "Create composite food");
         printMenuOption("6", "Save database");
         printMenuOption("7", "Search Online using API");
-        printMenuOption("8", "Back to main menu");
+        printMenuOption("8", "Report duplicate recipes");
+        printMenuOption("9", "Back to main menu");
         printDivider();
         cout << "Enter your choice: ";
     }
@@ -90,15 +108,20 @@ private:
     void displayDailyLogMenu()
     {
         printHeader("Daily Log Menu");
-        cout << "Current date: " << logManager.getCurrentDate() << "\n";
+        cout << "Current date: " << logManager().getCurrentDate() << "\n";
         printMenuOption("1", "View daily log");
         printMenuOption("2", "Add food to log");
-        printMenuOption("3", "Remove food from log");
-        printMenuOption("4", "Undo last action");
-        printMenuOption("5", "Change current date");
-        printMenuOption("6", "View calorie summary");
-        printMenuOption("7", "Save log");
-        printMenuOption("8", "Back to main menu");
+        printMenuOption("3", "Log a meal (several foods)");
+        printMenuOption("4", "Remove food from log");
+        printMenuOption("5", "Undo last action");
+        printMenuOption("6", "Redo last undone action");
+        printMenuOption("7", "Change current date");
+        printMenuOption("8", "View calorie summary");
+        printMenuOption("9", "View nutrition reports");
+        printMenuOption("10", "Import logs from file");
+        printMenuOption("11", "Export data for analysis");
+        printMenuOption("12", "Save log");
+        printMenuOption("13", "Back to main menu");
         printDivider();
         cout << "Enter your choice: ";
     }
@@ -234,12 +257,28 @@ private:
         }
     }
 
+    // Foods cannot be added to a catalog attached from shared memory
+    bool checkWritableDatabase()
+    {
+        if (foodManager.isShared())
+        {
+            printError("The food database is shared read-only; add foods in the publishing process.");
+            return false;
+        }
+        return true;
+    }
+
     void addBasicFood()
     {
         printHeader("Add Basic Food");
+        if (!checkWritableDatabase())
+        {
+            return;
+        }
 
-        string id, description, keywordsInput;
+        string id, description, keywordsInput, gramsInput;
         double calories, proteins, carbs, fats;
+        Fixed servingGrams;
 
         // Get food ID
         cout << CYAN << "Enter food ID: " << RESET;
@@ -357,6 +396,14 @@ private:
         }
         cin.ignore();
 
+        cout << CYAN << "Enter serving weight" << RESET << " (grams, leave empty if unknown): ";
+        getline(cin, gramsInput);
+        if (!gramsInput.empty() && (!Fixed::parse(gramsInput, servingGrams) || servingGrams < Fixed()))
+        {
+            printError("Invalid serving weight. Must be a positive number.");
+            return;
+        }
+
         // Show summary before adding
         printDivider();
         printInfo("Food Summary:");
@@ -367,17 +414,25 @@ private:
         cout << "• Proteins: " << GREEN << proteins << "g" << RESET << "\n";
         cout << "• Carbs: " << GREEN << carbs << "g" << RESET << "\n";
         cout << "• Fats: " << GREEN << fats << "g" << RESET << "\n";
+        if (servingGrams > Fixed())
+        {
+            cout << "• Serving weight: " << GREEN << servingGrams << "g" << RESET << "\n";
+        }
 
-        foodManager.addBasicFood(id, keywords, calories, description, proteins, carbs, fats);
+        foodManager.addBasicFood(id, keywords, calories, description, proteins, carbs, fats, servingGrams.toDouble());
         printSuccess("Basic food added successfully!");
     }
 
     void createCompositeFood()
     {
         string id, keywordsInput;
-        map<string, int> components;
+        map<string, Servings> components;
 
         printHeader("Create Composite Food");
+        if (!checkWritableDatabase())
+        {
+            return;
+        }
 
         // Get food ID
         cout << CYAN << "Enter composite food ID: " << RESET;
@@ -450,8 +505,8 @@ private:
 
         while (true)
         {
-            string compId;
-            int servings;
+            string compId, quantityInput, error;
+            Servings servings;
 
             cout << "\n"
                  << CYAN << "Enter component food ID" << RESET
@@ -482,19 +537,12 @@ private:
                  << CYAN << "Calories: " << RESET << component->getCaloriesPerServing()
                  << " per serving\n";
 
-            cout << YELLOW << "Enter number of servings: " << RESET;
-            if (!(cin >> servings))
-            {
-                cin.clear();
-                cin.ignore(numeric_limits<streamsize>::max(), '\n');
-                printError("Invalid input. Please enter a number.");
-                continue;
-            }
-            cin.ignore();
+            cout << YELLOW << "Enter servings" << RESET << " (e.g. 1.5) or grams (e.g. 150g): ";
+            getline(cin, quantityInput);
 
-            if (servings <= 0)
+            if (!foodManager.parseQuantity(compId, quantityInput, servings, error))
             {
-                printError("Servings must be positive. Please try again.");
+                printError(error + " Please try again.");
                 continue;
             }
 
@@ -511,7 +559,7 @@ private:
                 {
                     cout << "• " << CYAN << food->getId() << RESET
                          << " - " << GREEN << srv << " serving(s)" << RESET
-                         << " (" << YELLOW << food->getCaloriesPerServing() * srv
+                         << " (" << YELLOW << food->getNutrientsPerServing().calories * srv
                          << " cal" << RESET << ")\n";
                 }
             }
@@ -528,12 +576,36 @@ private:
         printSuccess("Composite food created successfully!");
     }
 
+    void reportDuplicateRecipes()
+    {
+        auto duplicates = foodManager.findDuplicateRecipes();
+
+        printHeader("Duplicate Recipes");
+        if (duplicates.empty())
+        {
+            printInfo("No composite foods share identical components.");
+            return;
+        }
+
+        for (const auto &ids : duplicates)
+        {
+            cout << YELLOW << ids.size() << " composites" << RESET << " with identical components: ";
+            for (const auto &id : ids)
+            {
+                cout << CYAN << id << RESET << " ";
+            }
+            cout << "\n";
+        }
+        printDivider();
+        printInfo("Each group is stored and recomputed as a single recipe.");
+    }
+
     void viewDailyLog()
     {
-        const auto &log = logManager.getCurrentDayLog();
+        const auto &log = logManager().getCurrentDayLog();
         const auto &entries = log.getEntries();
 
-        printHeader("Daily Log for " + logManager.getCurrentDate());
+        printHeader("Daily Log for " + logManager().getCurrentDate());
 
         if (entries.empty())
         {
@@ -542,15 +614,14 @@ private:
         }
 
         int index = 0;
-        double totalCalories = 0.0;
+        double totalCalories = logManager().getTotalCaloriesForDay();
 
         for (const auto &entry : entries)
         {
             auto food = foodManager.getFoodById(entry.getFoodId());
             if (food)
             {
-                double calories = food->getCaloriesPerServing() * entry.getServings();
-                totalCalories += calories;
+                double calories = entry.getTotalCalories(foodManager);
 
                 cout << CYAN << "[" << index << "] " << RESET
                      << BOLD << food->getId() << RESET
@@ -563,7 +634,7 @@ private:
         printDivider();
         cout << BOLD << "Total calories: " << YELLOW << totalCalories << RESET << "\n";
 
-        double targetCalories = profileManager.getTargetCalories();
+        double targetCalories = profileManager().getTargetCaloriesOn(logManager().getCurrentDay());
         if (targetCalories > 0)
         {
             double diff = totalCalories - targetCalories;
@@ -575,8 +646,8 @@ private:
 
     void addFoodToLog()
     {
-        string foodId;
-        int servings;
+        string foodId, quantityInput, error;
+        Servings servings;
 
         printHeader("Add Food to Log");
         cout << "Enter food ID " << CYAN << "(or 'list' to view all foods): " << RESET;
@@ -601,27 +672,101 @@ private:
         cout << CYAN << "Name: " << RESET << food->getId() << "\n";
         cout << CYAN << "Calories: " << RESET << food->getCaloriesPerServing() << " per serving\n";
 
-        cout << "Enter number of servings: ";
-        cin >> servings;
-        cin.ignore();
+        cout << "Enter servings (e.g. 1.5) or grams (e.g. 150g): ";
+        getline(cin, quantityInput);
 
-        if (servings <= 0)
+        if (!foodManager.parseQuantity(foodId, quantityInput, servings, error))
         {
-            printError("Servings must be positive.");
+            printError(error);
             return;
         }
 
-        logManager.addFoodToLog(foodId, servings);
+        logManager().addFoodToLog(foodId, servings);
         printSuccess("Food added to log successfully!");
 
         // Show updated calorie total
-        double totalCalories = logManager.getTotalCaloriesForDay();
+        double totalCalories = logManager().getTotalCaloriesForDay();
+        cout << YELLOW << "Daily total is now: " << totalCalories << " calories" << RESET << "\n";
+    }
+
+    // Collects several foods and logs them together, so the meal is undone
+    // in one step
+    void logMeal()
+    {
+        printHeader("Log a Meal");
+        cout << "Enter one food at a time; leave the food ID empty to finish.\n";
+
+        auto transaction = logManager().beginTransaction();
+        Nutrients mealTotals;
+        while (true)
+        {
+            string foodId, quantityInput, error;
+            Servings servings;
+
+            cout << "Food ID " << CYAN << "(or 'list' to view all foods): " << RESET;
+            getline(cin, foodId);
+            if (foodId.empty())
+            {
+                break;
+            }
+            if (foodId == "list")
+            {
+                viewAllFoods();
+                continue;
+            }
+
+            auto food = foodManager.getFoodById(foodId);
+            if (!food)
+            {
+                printError("Food not found.");
+                continue;
+            }
+
+            cout << "Servings (e.g. 1.5) or grams (e.g. 150g) of " << food->getId() << ": ";
+            getline(cin, quantityInput);
+            if (!foodManager.parseQuantity(foodId, quantityInput, servings, error))
+            {
+                printError(error);
+                continue;
+            }
+
+            transaction.addFood(foodId, servings);
+            mealTotals += food->getNutrientsPerServing().scaled(servings);
+        }
+
+        if (transaction.size() == 0)
+        {
+            printInfo("Nothing to log.");
+            return;
+        }
+
+        cout << YELLOW << "Meal: " << transaction.size() << " item(s), "
+             << mealTotals.calories << " calories" << RESET << "\n";
+        cout << "Log this meal? (y/n): ";
+        string confirm;
+        getline(cin, confirm);
+        if (confirm != "y" && confirm != "Y")
+        {
+            transaction.rollback();
+            printInfo("Meal discarded.");
+            return;
+        }
+
+        string error;
+        if (!transaction.commit(error))
+        {
+            printError(error);
+            return;
+        }
+        printSuccess("Meal added to log successfully!");
+
+        double totalCalories = logManager().getTotalCaloriesForDay();
         cout << YELLOW << "Daily total is now: " << totalCalories << " calories" << RESET << "\n";
     }
 
     void removeFoodFromLog()
     {
-        const auto &log = logManager.getCurrentDayLog();
+        const auto &log = logManager().getCurrentDayLog();
         const auto &entries = log.getEntries();
 
         if (entries.empty())
@@ -640,7 +785,7 @@ private:
                 cout << CYAN << "[" << index << "] " << RESET
                      << BOLD << food->getId() << RESET
                      << " - " << GREEN << entry.getServings() << " serving(s)" << RESET
-                     << " (" << YELLOW << food->getCaloriesPerServing() * entry.getServings()
+                     << " (" << YELLOW << entry.getTotalCalories(foodManager)
                      << " cal" << RESET << ")\n";
             }
             index++;
@@ -668,7 +813,7 @@ private:
             return;
         }
 
-        logManager.removeFoodFromLog(entryIndex);
+        logManager().removeFoodFromLog(entryIndex);
         printSuccess("Entry removed successfully!");
     }
 
@@ -680,30 +825,25 @@ private:
 
         if (date == "today")
         {
-            time_t t = time(nullptr);
-            tm timeinfo = *localtime(&t);
-            char buffer[11];
-            strftime(buffer, sizeof(buffer), "%Y-%m-%d", &timeinfo);
-            date = string(buffer);
+            date = Date::today();
         }
 
-        // Very basic date validation
-        if (date.size() != 10 || date[4] != '-' || date[7] != '-')
+        if (!logManager().setCurrentDate(date))
         {
-            cout << "Invalid date format. Use YYYY-MM-DD.\n";
+            cout << "Invalid date. Use YYYY-MM-DD with a real calendar date.\n";
             return;
         }
 
-        logManager.setCurrentDate(date);
         cout << "Date changed to " << date << ".\n";
     }
 
     void viewCalorieSummary()
     {
-        double totalCalories = logManager.getTotalCaloriesForDay();
-        double targetCalories = profileManager.getTargetCalories();
+        Nutrients totals = logManager().getTotalNutrientsForDay();
+        double totalCalories = totals.calories.toDouble();
+        double targetCalories = profileManager().getTargetCaloriesOn(logManager().getCurrentDay());
 
-        printHeader("Calorie Summary for " + logManager.getCurrentDate());
+        printHeader("Calorie Summary for " + logManager().getCurrentDate());
 
         // Create a visual progress bar
         const int barWidth = 40;
@@ -711,6 +851,9 @@ private:
         int progressWidth = static_cast<int>((percentage / 100) * barWidth);
 
         cout << BOLD << "Total calories consumed: " << YELLOW << totalCalories << RESET << "\n";
+        cout << "Proteins: " << GREEN << totals.proteins << "g" << RESET
+             << "  Carbs: " << GREEN << totals.carbs << "g" << RESET
+             << "  Fats: " << GREEN << totals.fats << "g" << RESET << "\n";
 
         if (targetCalories > 0)
         {
@@ -744,9 +887,209 @@ private:
         }
     }
 
+    void printRangeReport(const string &label, int fromDay, int toDay)
+    {
+        RangeTotals range = logManager().summarizeRange(fromDay, toDay);
+        int calendarDays = toDay - fromDay + 1;
+
+        cout << BOLD << label << RESET << " (" << Date::format(fromDay) << " to " << Date::format(toDay) << ")\n";
+        cout << "  Days logged: " << CYAN << range.loggedDays << "/" << calendarDays << RESET << "\n";
+        cout << "  Total: " << YELLOW << range.totals.calories << " cal" << RESET
+             << "  P " << range.totals.proteins << "g"
+             << "  C " << range.totals.carbs << "g"
+             << "  F " << range.totals.fats << "g\n";
+
+        if (range.loggedDays > 0)
+        {
+            Fixed perLoggedDay = Fixed::fromInt(range.loggedDays);
+            Fixed perCalendarDay = Fixed::fromInt(calendarDays);
+            cout << "  Average per logged day: " << YELLOW << range.totals.calories / perLoggedDay << " cal" << RESET
+                 << "  P " << range.totals.proteins / perLoggedDay << "g"
+                 << "  C " << range.totals.carbs / perLoggedDay << "g"
+                 << "  F " << range.totals.fats / perLoggedDay << "g\n";
+            cout << "  Average per calendar day: " << YELLOW << range.totals.calories / perCalendarDay << " cal" << RESET << "\n";
+
+            // Each day is compared with the target from the profile in effect then
+            double targetTotal = 0;
+            int daysWithTarget = 0, daysOnTarget = 0;
+            logManager().forEachDayInRange(fromDay, toDay, [&](int day, const DailyLog &log)
+                                           {
+                if (log.getEntries().empty())
+                {
+                    return;
+                }
+                double target = profileManager().getTargetCaloriesOn(day);
+                if (target <= 0)
+                {
+                    return;
+                }
+                double calories = log.getTotalCalories(foodManager);
+                targetTotal += target;
+                daysWithTarget++;
+                if (calories >= target * 0.9 && calories <= target * 1.1)
+                {
+                    daysOnTarget++;
+                } });
+            if (daysWithTarget > 0)
+            {
+                cout << "  Target over those days: " << CYAN << targetTotal << " cal" << RESET
+                     << "  Within 10% of target: " << CYAN << daysOnTarget << "/" << daysWithTarget << RESET << " days\n";
+            }
+        }
+    }
+
+    void viewNutritionReports()
+    {
+        int endDay = logManager().getCurrentDay();
+
+        printHeader("Nutrition Reports up to " + logManager().getCurrentDate());
+        printRangeReport("Last 7 days", endDay - 6, endDay);
+        printDivider();
+        printRangeReport("Last 30 days", endDay - 29, endDay);
+        printDivider();
+        printRangeReport("Last 365 days", endDay - 364, endDay);
+        printDivider();
+
+        string input;
+        cout << "Enter a custom range as 'YYYY-MM-DD YYYY-MM-DD' (or leave empty to go back): ";
+        getline(cin, input);
+        if (input.empty())
+        {
+            return;
+        }
+
+        int fromDay, toDay;
+        size_t space = input.find(' ');
+        if (space == string::npos || !Date::parse(input.substr(0, space), fromDay) ||
+            !Date::parse(input.substr(space + 1), toDay) || fromDay > toDay)
+        {
+            printError("Invalid range. Use two dates, earliest first.");
+            return;
+        }
+
+        printRangeReport("Custom range", fromDay, toDay);
+    }
+
+    bool importLogs(const string &path)
+    {
+        printHeader("Import Logs");
+
+        bool opened = false;
+        LogImporter importer(foodManager, logManager());
+        ImportReport report = importer.importFile(path, opened);
+        if (!opened)
+        {
+            printError("Could not open " + path + ".");
+            return false;
+        }
+
+        cout << "Rows read: " << report.rowsRead << "\n";
+        printSuccess("Imported " + to_string(report.imported) + " entries.");
+
+        if (report.malformed > 0)
+        {
+            printError(to_string(report.malformed) + " malformed rows skipped.");
+            cout << "  First malformed lines: ";
+            for (size_t line : report.malformedLines)
+            {
+                cout << line << " ";
+            }
+            cout << "\n";
+        }
+
+        if (!report.unresolved.empty())
+        {
+            printError(to_string(report.unresolved.size()) + " unknown food IDs; their rows were skipped:");
+            for (const auto &[foodId, count] : report.unresolved)
+            {
+                cout << "  " << CYAN << foodId << RESET << " (" << count << " rows)\n";
+            }
+        }
+        return true;
+    }
+
+    // Writes one table and returns whether it worked, with the message to show
+    static pair<bool, string> writeExport(const FoodManager &foodManager, const string &path, const LogStore *logs)
+    {
+        size_t rows = 0;
+        DataExporter exporter(foodManager);
+        if (!exporter.exportToFile(path, logs, rows))
+        {
+            return {false, "Could not write " + path + "."};
+        }
+        return {true, "Exported " + to_string(rows) + " rows to " + path + "."};
+    }
+
+    bool exportTable(const string &path, bool logTable)
+    {
+        LogStore logs = logManager().snapshot();
+        auto [ok, message] = writeExport(foodManager, path, logTable ? &logs : nullptr);
+        ok ? printSuccess(message) : printError(message);
+        return ok;
+    }
+
+    // Shows the outcome of a background export once it is done, or waits for it
+    void reportBackgroundExport(bool wait)
+    {
+        if (!backgroundExport.valid())
+        {
+            return;
+        }
+        if (backgroundExport.wait_for(chrono::seconds(0)) != future_status::ready)
+        {
+            if (!wait)
+            {
+                return;
+            }
+            printInfo("Waiting for the background export to finish...");
+        }
+
+        auto [ok, message] = backgroundExport.get();
+        ok ? printSuccess(message) : printError(message);
+    }
+
+    // Runs on a snapshot of the logs, so the log can be edited meanwhile
+    void startBackgroundExport(const string &path, bool logTable)
+    {
+        reportBackgroundExport(true); // One export at a time
+
+        auto logs = make_shared<LogStore>(logManager().snapshot());
+        const FoodManager &foods = foodManager;
+        backgroundExport = async(launch::async, [&foods, logs, path, logTable]()
+                                 { return writeExport(foods, path, logTable ? logs.get() : nullptr); });
+        printInfo("Exporting to " + path + " in the background.");
+    }
+
+    void exportData()
+    {
+        printHeader("Export Data");
+        printInfo("Log export: date, foodId, servings, calories, proteins, carbs, fats per entry.");
+        printInfo("Food export: foodId, type, servingGrams and per-serving nutrients.");
+        printInfo("Paths ending in .csv are written as CSV, anything else in the columnar format.");
+
+        string table, path;
+        cout << "Export which table? (log/foods): ";
+        getline(cin, table);
+        if (table != "log" && table != "foods")
+        {
+            printError("Invalid table. Enter 'log' or 'foods'.");
+            return;
+        }
+
+        cout << "Enter output path: ";
+        getline(cin, path);
+        if (path.empty())
+        {
+            printError("Output path cannot be empty.");
+            return;
+        }
+
+        startBackgroundExport(path, table == "log");
+    }
+
     void viewProfile()
     {
-        const auto &profile = profileManager.getProfile();
+        const auto &profile = profileManager().getProfile();
 
         printHeader("User Profile");
 
@@ -755,11 +1098,19 @@ private:
         cout << CYAN << "Age: " << RESET << profile.getAge() << " years\n";
         cout << CYAN << "Weight: " << RESET << profile.getWeight() << " kg\n";
         cout << CYAN << "Activity level: " << RESET << profile.getActivityLevel() << "\n";
+        if (profile.getBodyFat() > 0)
+        {
+            cout << CYAN << "Body fat: " << RESET << profile.getBodyFat() << " %\n";
+        }
         cout << CYAN << "Calculation method: " << RESET << profile.getCalculationMethod() << "\n";
+        if (auto *formula = get_if<FormulaStrategy>(&profile.getCalorieCalculationStrategy()))
+        {
+            cout << CYAN << "Formula: " << RESET << formula->source << "\n";
+        }
 
         printDivider();
 
-        double targetCalories = profileManager.getTargetCalories();
+        double targetCalories = profileManager().getTargetCalories();
         if (targetCalories > 0)
         {
             cout << BOLD << "Daily Target: " << GREEN << targetCalories
@@ -769,6 +1120,21 @@ private:
         {
             printError("Target calories not available. Please complete your profile.");
         }
+
+        const auto &history = profileManager().getHistory();
+        if (history.getRevisions().size() > 1)
+        {
+            printDivider();
+            printInfo("Profile history (reports use the revision in effect on each day):");
+            for (const auto &revision : history.getRevisions())
+            {
+                string since = revision.day == INT_MIN ? "start" : Date::format(revision.day);
+                cout << CYAN << "  since " << since << RESET << ": "
+                     << revision.profile.getWeight() << " kg, "
+                     << revision.profile.getActivityLevel() << ", "
+                     << history.targetOn(revision.day) << " calories\n";
+            }
+        }
     }
 
     void updateProfile()
@@ -776,7 +1142,7 @@ private:
         printHeader("Update Profile");
 
         // Show current profile if it exists
-        const auto &currentProfile = profileManager.getProfile();
+        const auto &currentProfile = profileManager().getProfile();
         if (currentProfile.getGender() != "")
         {
             printInfo("Current Profile:");
@@ -853,6 +1219,29 @@ private:
             return;
         }
 
+        // Body fat input, only used by custom formulas
+        string bodyFatInput;
+        double bodyFat = 0;
+        cout << CYAN << "Enter body fat" << RESET << " (%, optional, leave empty if unknown): ";
+        getline(cin, bodyFatInput);
+        if (!bodyFatInput.empty())
+        {
+            try
+            {
+                bodyFat = stod(bodyFatInput);
+            }
+            catch (const exception &e)
+            {
+                printError("Invalid input. Body fat must be a number.");
+                return;
+            }
+            if (bodyFat <= 0 || bodyFat >= 100)
+            {
+                printError("Body fat must be between 0 and 100%.");
+                return;
+            }
+        }
+
         // Activity level input
         printInfo("\nActivity Levels:");
         cout << "• sedentary    (little or no exercise)\n";
@@ -880,12 +1269,16 @@ private:
         cout << CYAN << "Age: " << RESET << age << " years\n";
         cout << CYAN << "Weight: " << RESET << weight << " kg\n";
         cout << CYAN << "Activity Level: " << RESET << activityLevel << "\n";
+        if (bodyFat > 0)
+        {
+            cout << CYAN << "Body Fat: " << RESET << bodyFat << " %\n";
+        }
 
-        profileManager.updateProfile(height, age, weight, activityLevel);
+        profileManager().updateProfile(height, age, weight, activityLevel, bodyFat);
         printSuccess("Profile updated successfully!");
 
         // Show calculated target calories
-        double targetCalories = profileManager.getTargetCalories();
+        double targetCalories = profileManager().getTargetCalories();
         cout << BOLD << "Daily calorie target: " << GREEN << targetCalories
              << " calories" << RESET << "\n";
     }
@@ -896,6 +1289,7 @@ private:
         printInfo("Available Methods:");
         cout << CYAN << "1. Harris-Benedict Equation" << RESET << " (traditional method)\n";
         cout << CYAN << "2. Mifflin-St Jeor Equation" << RESET << " (modern method)\n";
+        cout << CYAN << "3. Custom formula" << RESET << " (your own BMR expression)\n";
         printDivider();
 
         cout << "Enter your choice: ";
@@ -904,14 +1298,38 @@ private:
 
         if (choice == "1")
         {
-            profileManager.setCalculationMethod("harris-benedict");
+            if (!profileManager().setCalculationMethod("harris-benedict"))
+            {
+                printError("Unknown calculation method.");
+                return;
+            }
             printSuccess("Calculation method changed to Harris-Benedict.");
         }
         else if (choice == "2")
         {
-            profileManager.setCalculationMethod("mifflin-st-jeor");
+            if (!profileManager().setCalculationMethod("mifflin-st-jeor"))
+            {
+                printError("Unknown calculation method.");
+                return;
+            }
             printSuccess("Calculation method changed to Mifflin-St Jeor.");
         }
+        else if (choice == "3")
+        {
+            printInfo("Write the BMR as an expression over weight (kg), height (cm), age, male (1 or 0) and bodyFat (%).");
+            printInfo("It is multiplied by the activity factor. Examples:");
+            cout << "  Katch-McArdle: 370 + 21.6 * weight * (1 - bodyFat / 100)\n";
+            cout << "  Cunningham:    500 + 22 * weight * (1 - bodyFat / 100)\n";
+            cout << "Enter formula: ";
+            string formula, error;
+            getline(cin, formula);
+            if (!profileManager().setFormula(formula, error))
+            {
+                printError(error + ".");
+                return;
+            }
+            printSuccess("Calculation method changed to the custom formula.");
+        }
         else
         {
             printError("Invalid choice.");
@@ -921,63 +1339,71 @@ private:
     void searchOnlineAPI()
     {
         printHeader("Search Food Online (USDA Database)");
-        
-        // Ask for food query
-        string foodQuery;
-        cout << CYAN << "Enter food to search: " << RESET;
-        getline(cin, foodQuery);
-        
-        if (foodQuery.empty())
-        {
-            printError("Search query cannot be empty.");
-            return;
-        }
-        
-        // Replace spaces with %20 for URL encoding
-        size_t pos = 0;
-        while ((pos = foodQuery.find(" ", pos)) != string::npos) {
-            foodQuery.replace(pos, 1, "%20");
-            pos += 3; // length of "%20"
-        }
-        
-        printInfo("Searching for \"" + foodQuery + "\" in USDA database...");
-        
-        // API key - should ideally be stored more securely
-        string apiKey = "R9OFzkfROTGUedVA6omCI3g9dzoBQkgkkekOwiTj"; 
-        string command = "curl -s \"https://api.nal.usda.gov/fdc/v1/foods/search?query=" + foodQuery + "&api_key=" + apiKey + "\"";
 
-        array<char, 8192> buffer;
-        string result;
+        // Several foods may be searched at once
+        string line;
+        cout << CYAN << "Enter food to search (separate several with ';'): " << RESET;
+        getline(cin, line);
 
-        // Execute the curl command
-        unique_ptr<FILE, decltype(&pclose)> pipe(popen(command.c_str(), "r"), pclose);
-        if (!pipe)
+        vector<string> queries;
+        stringstream stream(line);
+        string query;
+        while (getline(stream, query, ';'))
+        {
+            if (query.find_first_not_of(" \t") != string::npos)
+            {
+                queries.push_back(query.substr(query.find_first_not_of(" \t")));
+            }
+        }
+        if (queries.empty())
         {
-            printError("Failed to run curl command. Check your internet connection.");
+            printError("Search query cannot be empty.");
             return;
         }
 
-        while (fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr)
+        if (!usdaClient)
         {
-            result += buffer.data();
+            usdaClient = make_unique<UsdaClient>();
+            usdaClient->pruneCache();
         }
+        printInfo("Searching for " + to_string(queries.size()) + (queries.size() == 1 ? " food" : " foods") + " in USDA database...");
+#ifdef YADA_HAS_COROUTINES
+        AsyncExecutor executor;
+        vector<UsdaClient::Result> results = executor.run(searchUsdaAsync(executor, *usdaClient, queries));
+#else
+        vector<UsdaClient::Result> results = usdaClient->searchMany(queries);
+#endif
 
-        try
+        for (const auto &result : results)
         {
-            json response = json::parse(result);
-    
-            if (!response.contains("foods") || response["foods"].empty())
+            if (queries.size() > 1)
             {
-                printError("No food items found for query: " + foodQuery);
-                return;
+                cout << "\n" << BOLD << "Results for \"" << result.query << "\"" << RESET << "\n";
+            }
+            if (!result.ok)
+            {
+                printError(result.error + ". Check your internet connection.");
+                continue;
+            }
+            if (result.stale)
+            {
+                printInfo("The USDA database could not be reached; showing an earlier result.");
+            }
+
+            const json &response = result.response;
+            if (!response.contains("foods") || !response["foods"].is_array() || response["foods"].empty())
+            {
+                printError("No food items found for query: " + result.query);
+                continue;
             }
-    
-            for (const auto &food : response["foods"])
+
+            try
             {
+                const json &food = response["foods"][0];
                 cout << "\n" << CYAN << "🔸 Description: " << RESET << food["description"] << "\n";
                 cout << CYAN << "🔹 FDC ID: " << RESET << food["fdcId"] << "\n";
                 cout << CYAN << "🔸 Nutrients:" << RESET << "\n";
-    
+
                 if (food.contains("foodNutrients"))
                 {
                     for (const auto &nutrient : food["foodNutrients"])
@@ -993,13 +1419,11 @@ private:
                 {
                     printInfo("   (No nutrient data available)");
                 }
-
-                break;
             }
-        }
-        catch (const exception &e)
-        {
-            printError("Error parsing JSON response: " + string(e.what()));
+            catch (const exception &e)
+            {
+                printError("Error reading the response: " + string(e.what()));
+            }
         }
     }
 
@@ -1010,6 +1434,7 @@ private:
 
         while (!backToMainMenu)
         {
+            persistChanges();
             displayFoodDatabaseMenu();
             getline(cin, choice);
 
@@ -1035,20 +1460,17 @@ private:
             }
             else if (choice == "6")
             {
-                if (foodManager.saveDatabase())
-                {
-                    cout << "Food database saved successfully.\n";
-                }
-                else
-                {
-                    cout << "Error saving food database.\n";
-                }
+                saveAll();
             }
             else if (choice == "7")
             {
                 searchOnlineAPI();
             }
             else if (choice == "8")
+            {
+                reportDuplicateRecipes();
+            }
+            else if (choice == "9")
             {
                 backToMainMenu = true;
             }
@@ -1066,6 +1488,8 @@ private:
 
         while (!backToMainMenu)
         {
+            persistChanges();
+            reportBackgroundExport(false);
             displayDailyLogMenu();
             getline(cin, choice);
 
@@ -1079,32 +1503,48 @@ private:
             }
             else if (choice == "3")
             {
-                removeFoodFromLog();
+                logMeal();
             }
             else if (choice == "4")
             {
-                logManager.undo();
+                removeFoodFromLog();
             }
             else if (choice == "5")
             {
-                changeDate();
+                cout << (logManager().undo() ? "Last action undone.\n" : "Nothing to undo.\n");
             }
             else if (choice == "6")
             {
-                viewCalorieSummary();
+                cout << (logManager().redo() ? "Last undone action redone.\n" : "Nothing to redo.\n");
             }
             else if (choice == "7")
             {
-                if (logManager.saveLog())
-                {
-                    cout << "Daily log saved successfully.\n";
-                }
-                else
-                {
-                    cout << "Error saving daily log.\n";
-                }
+                changeDate();
             }
             else if (choice == "8")
+            {
+                viewCalorieSummary();
+            }
+            else if (choice == "9")
+            {
+                viewNutritionReports();
+            }
+            else if (choice == "10")
+            {
+                string path;
+                cout << "Enter path to a CSV (date,foodId,servings) or JSON Lines file: ";
+                getline(cin, path);
+                importLogs(path);
+            }
+            else if (choice == "11")
+            {
+                exportData();
+            }
+            else if (choice == "12")
+            {
+                saveAll();
+            }
+            else if (choice == "13")
             {
                 backToMainMenu = true;
             }
@@ -1122,6 +1562,7 @@ private:
 
         while (!backToMainMenu)
         {
+            persistChanges();
             displayProfileMenu();
             getline(cin, choice);
 
@@ -1139,14 +1580,7 @@ private:
             }
             else if (choice == "4")
             {
-                if (profileManager.saveProfile())
-                {
-                    cout << "Profile saved successfully.\n";
-                }
-                else
-                {
-                    cout << "Error saving profile.\n";
-                }
+                saveAll();
             }
             else if (choice == "5")
             {
@@ -1159,66 +1593,121 @@ private:
         }
     }
 
+    // Hands the changes made since the last call to the background saver,
+    // which writes them shortly after, and reports writes that failed. Also
+    // picks up a newer shared food database, if one is attached.
+    void persistChanges()
+    {
+        foodManager.refreshShared();
+        saver.collect();
+        for (const auto &error : saver.takeErrors())
+        {
+            printError("Could not save " + error);
+        }
+    }
+
+    // Writes all changes now, without waiting for the disk
     void saveAll()
     {
-        bool success = true;
+        saver.collect(true);
+        printInfo("Saving all changes in the background.");
+    }
 
-        foodManager.saveDatabase();
-        logManager.saveLog();
-        profileManager.saveProfile();
-        if (foodManager.isModified())
+    void selectUser(const string &name)
+    {
+        bool logLoaded = true, profileLoaded = true;
+        bool isNew = !userManager.hasSession(name);
+        session = &userManager.getSession(name, &logLoaded, &profileLoaded);
+        if (isNew)
         {
-            if (!foodManager.saveDatabase())
-            {
-                cout << "Error saving food database.\n";
-                success = false;
-            }
+            reportMissingFiles(logLoaded, profileLoaded);
         }
+    }
 
-        if (logManager.isModified())
+    void reportMissingFiles(bool logLoaded, bool profileLoaded)
+    {
+        if (!logLoaded)
         {
-            if (!logManager.saveLog())
-            {
-                cout << "Error saving daily log.\n";
-                success = false;
-            }
+            cout << "Daily log not found or empty. Creating new log.\n";
         }
 
-        if (profileManager.isModified())
+        if (!profileLoaded)
         {
-            if (!profileManager.saveProfile())
-            {
-                cout << "Error saving user profile.\n";
-                success = false;
-            }
+            cout << "User profile not found. Please create a profile.\n";
         }
+    }
 
-        if (success)
+    void switchUser()
+    {
+        printHeader("Switch User");
+        auto loaded = userManager.getLoadedUsers();
+        cout << "Loaded users: ";
+        for (const auto &name : loaded)
         {
-            cout << "All data saved successfully.\n";
+            cout << CYAN << name << RESET << " ";
         }
+        cout << "\n";
+
+        string name;
+        cout << "Enter user name (letters, digits, '-' or '_'): ";
+        getline(cin, name);
+
+        if (!UserManager::isValidName(name))
+        {
+            printError("Invalid user name.");
+            return;
+        }
+
+        selectUser(name);
+        printSuccess("Switched to user " + name + ".");
     }
 
 public:
-    CLI(FoodManager &foodManager, LogManager &logManager, ProfileManager &profileManager)
-        : foodManager(foodManager), logManager(logManager), profileManager(profileManager) {}
+    CLI(FoodManager &foodManager, UserManager &userManager, const string &initialUser = UserManager::DEFAULT_USER)
+        : foodManager(foodManager), userManager(userManager), initialUser(initialUser),
+          saver(foodManager, userManager) {}
 
     void initialize()
     {
-        if (!foodManager.loadDatabase())
+#ifdef YADA_HAS_COROUTINES
+        // The food files, the log and the profile are read at the same time
+        bool logLoaded = true, profileLoaded = true;
+        AsyncExecutor executor;
+        auto [foodsLoaded, initialSession] = executor.run(executor.whenAll(
+            loadDatabaseAsync(executor, foodManager),
+            loadSessionAsync(executor, userManager, initialUser, &logLoaded, &profileLoaded)));
+        if (!foodsLoaded)
         {
             cout << "Food database not found or empty. Creating new database.\n";
         }
-
-        if (!logManager.loadLog())
+        session = initialSession;
+        reportMissingFiles(logLoaded, profileLoaded);
+#else
+        if (!foodManager.loadDatabase())
         {
-            cout << "Daily log not found or empty. Creating new log.\n";
+            cout << "Food database not found or empty. Creating new database.\n";
         }
 
-        if (!profileManager.loadProfile())
+        selectUser(initialUser);
+#endif
+    }
+
+    // Non-interactive import for onboarding: load, import, save, done
+    bool runImport(const string &path)
+    {
+        initialize();
+        if (!importLogs(path))
         {
-            cout << "User profile not found. Please create a profile.\n";
+            return false;
         }
+        return logManager().saveLog();
+    }
+
+    // Non-interactive export of the log ("log") or food ("foods") table
+    bool runExport(const string &path, bool logTable)
+    {
+        initialize();
+        return exportTable(path, logTable);
     }
 
     void run()
@@ -1229,6 +1718,8 @@ public:
 
         while (running)
         {
+            persistChanges();
+            reportBackgroundExport(false);
             displayMenu();
             getline(cin, choice);
 
@@ -1250,19 +1741,21 @@ public:
             }
             else if (choice == "5")
             {
-                // Ask for confirmation if there's unsaved data
-                if (foodManager.isModified() || logManager.isModified() || profileManager.isModified())
-                {
-                    cout << "You have unsaved changes. Save before exiting? (y/n): ";
-                    string confirm;
-                    getline(cin, confirm);
+                switchUser();
+            }
+            else if (choice == "6")
+            {
+                reportBackgroundExport(true);
 
-                    if (confirm == "y" || confirm == "Y")
+                // Everything not written yet is written and synced now
+                saver.collect();
+                if (!saver.flush())
+                {
+                    for (const auto &error : saver.takeErrors())
                     {
-                        saveAll();
+                        printError("Could not save " + error);
                     }
                 }
-
                 cout << "Thank you for using YADA. Goodbye!\n";
                 running = false;
             }
@@ -0,0 +1,113 @@
+#ifndef DATE_CPP
+#define DATE_CPP
+
+#include <string>
+#include <ctime>
+using namespace std;
+
+// Calendar dates as day numbers (days since 1970-01-01), so that date
+// ranges can be indexed and compared as plain integers
+class Date
+{
+public:
+    static bool isLeapYear(int year)
+    {
+        return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    }
+
+    static int daysInMonth(int year, int month)
+    {
+        static const int days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+        return (month == 2 && isLeapYear(year)) ? 29 : days[month - 1];
+    }
+
+    // Howard Hinnant's days_from_civil for the proleptic Gregorian calendar
+    static int toDayNumber(int year, int month, int day)
+    {
+        year -= (month <= 2) ? 1 : 0;
+        int era = (year >= 0 ? year : year - 399) / 400;
+        int yearOfEra = year - era * 400;
+        int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+        int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+        return era * 146097 + dayOfEra - 719468;
+    }
+
+    static void fromDayNumber(int dayNumber, int &year, int &month, int &day)
+    {
+        dayNumber += 719468;
+        int era = (dayNumber >= 0 ? dayNumber : dayNumber - 146096) / 146097;
+        int dayOfEra = dayNumber - era * 146097;
+        int yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+        int dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+        int monthIndex = (5 * dayOfYear + 2) / 153;
+        day = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+        month = monthIndex + (monthIndex < 10 ? 3 : -9);
+        year = yearOfEra + era * 400 + (month <= 2 ? 1 : 0);
+    }
+
+    // Parses a strict "YYYY-MM-DD" string, rejecting impossible dates
+    static bool parse(const string &text, int &dayNumber)
+    {
+        if (text.size() != 10 || text[4] != '-' || text[7] != '-')
+        {
+            return false;
+        }
+
+        int fields[3] = {0, 0, 0};
+        const size_t starts[3] = {0, 5, 8};
+        const size_t lengths[3] = {4, 2, 2};
+        for (int f = 0; f < 3; ++f)
+        {
+            for (size_t i = starts[f]; i < starts[f] + lengths[f]; ++i)
+            {
+                if (text[i] < '0' || text[i] > '9')
+                {
+                    return false;
+                }
+                fields[f] = fields[f] * 10 + (text[i] - '0');
+            }
+        }
+
+        int year = fields[0], month = fields[1], day = fields[2];
+        if (year < 1 || month < 1 || month > 12 || day < 1 || day > daysInMonth(year, month))
+        {
+            return false;
+        }
+
+        dayNumber = toDayNumber(year, month, day);
+        return true;
+    }
+
+    // Whether a day number is one parse can produce (years 1 to 9999)
+    static bool isValidDayNumber(int dayNumber)
+    {
+        return dayNumber >= toDayNumber(1, 1, 1) && dayNumber <= toDayNumber(9999, 12, 31);
+    }
+
+    static string format(int dayNumber)
+    {
+        int year, month, day;
+        fromDayNumber(dayNumber, year, month, day);
+        char buffer[40]; // Room for any int in each field
+        snprintf(buffer, sizeof(buffer), "%04d-%02d-%02d", year, month, day);
+        return string(buffer);
+    }
+
+    static string today()
+    {
+        time_t t = time(nullptr);
+        tm timeinfo = *localtime(&t);
+        char buffer[11];
+        strftime(buffer, sizeof(buffer), "%Y-%m-%d", &timeinfo);
+        return string(buffer);
+    }
+
+    static int todayDayNumber()
+    {
+        time_t t = time(nullptr);
+        tm timeinfo = *localtime(&t);
+        return toDayNumber(timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday);
+    }
+};
+
+#endif
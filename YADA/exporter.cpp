@@ -0,0 +1,335 @@
+#ifndef EXPORTER_CPP
+#define EXPORTER_CPP
+
+#include "food.cpp"
+#include "log.cpp"
+#include "date.cpp"
+#include <cstring>
+using namespace std;
+
+enum class ColumnType : uint8_t
+{
+    Day = 1,   // Day number, days since 1970-01-01 (int32)
+    Text = 2,  // UTF-8 string
+    Fixed = 3, // Fixed-point value in thousandths (int64)
+};
+
+struct Column
+{
+    string name;
+    ColumnType type;
+};
+
+// Receives a table cell by cell in column order, so rows never have to be
+// materialized. Implementations buffer at most one block.
+class TableWriter
+{
+public:
+    virtual ~TableWriter() = default;
+    virtual void begin(const vector<Column> &columns) = 0;
+    virtual void addDay(int day) = 0;
+    virtual void addText(const string &text) = 0;
+    virtual void addFixed(Fixed value) = 0;
+    virtual void endRow() = 0;
+    virtual void finish() = 0;
+};
+
+class CsvTableWriter : public TableWriter
+{
+private:
+    ostream &out;
+    bool firstCell = true;
+
+    void separate()
+    {
+        if (!firstCell)
+        {
+            out << ',';
+        }
+        firstCell = false;
+    }
+
+public:
+    CsvTableWriter(ostream &out) : out(out) {}
+
+    void begin(const vector<Column> &columns) override
+    {
+        for (const auto &column : columns)
+        {
+            addText(column.name);
+        }
+        endRow();
+    }
+
+    void addDay(int day) override
+    {
+        separate();
+        out << Date::format(day);
+    }
+
+    void addText(const string &text) override
+    {
+        separate();
+        if (text.find_first_of(",\"\n") == string::npos)
+        {
+            out << text;
+            return;
+        }
+        out << '"';
+        for (char c : text)
+        {
+            out << c;
+            if (c == '"')
+            {
+                out << '"';
+            }
+        }
+        out << '"';
+    }
+
+    void addFixed(Fixed value) override
+    {
+        separate();
+        out << value.toString();
+    }
+
+    void endRow() override
+    {
+        out << '\n';
+        firstCell = true;
+    }
+
+    void finish() override
+    {
+        out.flush();
+    }
+};
+
+// Simple block-columnar binary format (host byte order, little-endian on
+// all supported platforms):
+//
+//   "YADACOL1"  uint32 columnCount
+//   per column: uint8 type, uint16 nameLength, name bytes
+//   blocks:     uint32 rowCount (0 ends the file)
+//               per column: uint64 byteLength, then the column data:
+//                 Day   -> int32[rowCount]
+//                 Fixed -> int64[rowCount]
+//                 Text  -> uint32 offsets[rowCount + 1], then the bytes
+class ColumnarTableWriter : public TableWriter
+{
+private:
+    struct ColumnBuffer
+    {
+        ColumnType type;
+        vector<int32_t> days;
+        vector<int64_t> numbers;
+        vector<uint32_t> offsets;
+        string bytes;
+    };
+
+    ostream &out;
+    size_t blockRows;
+    vector<ColumnBuffer> buffers;
+    size_t cell = 0;
+    uint32_t rows = 0;
+
+    template <typename T>
+    void writeRaw(const T &value)
+    {
+        out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    void writeArray(const vector<T> &values)
+    {
+        out.write(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(T));
+    }
+
+    void flushBlock()
+    {
+        if (rows == 0)
+        {
+            return;
+        }
+
+        writeRaw(rows);
+        for (auto &buffer : buffers)
+        {
+            switch (buffer.type)
+            {
+            case ColumnType::Day:
+                writeRaw(static_cast<uint64_t>(buffer.days.size() * sizeof(int32_t)));
+                writeArray(buffer.days);
+                buffer.days.clear();
+                break;
+            case ColumnType::Fixed:
+                writeRaw(static_cast<uint64_t>(buffer.numbers.size() * sizeof(int64_t)));
+                writeArray(buffer.numbers);
+                buffer.numbers.clear();
+                break;
+            case ColumnType::Text:
+                writeRaw(static_cast<uint64_t>(buffer.offsets.size() * sizeof(uint32_t) + buffer.bytes.size()));
+                writeArray(buffer.offsets);
+                out.write(buffer.bytes.data(), buffer.bytes.size());
+                buffer.offsets.assign(1, 0);
+                buffer.bytes.clear();
+                break;
+            }
+        }
+        rows = 0;
+    }
+
+public:
+    ColumnarTableWriter(ostream &out, size_t blockRows = 8192) : out(out), blockRows(blockRows) {}
+
+    void begin(const vector<Column> &columns) override
+    {
+        out.write("YADACOL1", 8);
+        writeRaw(static_cast<uint32_t>(columns.size()));
+        buffers.clear();
+        for (const auto &column : columns)
+        {
+            writeRaw(static_cast<uint8_t>(column.type));
+            writeRaw(static_cast<uint16_t>(column.name.size()));
+            out.write(column.name.data(), column.name.size());
+
+            ColumnBuffer buffer;
+            buffer.type = column.type;
+            buffer.offsets.assign(1, 0);
+            buffers.push_back(move(buffer));
+        }
+    }
+
+    void addDay(int day) override
+    {
+        buffers[cell++].days.push_back(day);
+    }
+
+    void addText(const string &text) override
+    {
+        auto &buffer = buffers[cell++];
+        buffer.bytes += text;
+        buffer.offsets.push_back(static_cast<uint32_t>(buffer.bytes.size()));
+    }
+
+    void addFixed(Fixed value) override
+    {
+        buffers[cell++].numbers.push_back(value.getMilli());
+    }
+
+    void endRow() override
+    {
+        cell = 0;
+        if (++rows >= blockRows)
+        {
+            flushBlock();
+        }
+    }
+
+    void finish() override
+    {
+        flushBlock();
+        writeRaw(static_cast<uint32_t>(0));
+        out.flush();
+    }
+};
+
+// Streams logs joined with food nutrients, and the food catalog itself, into
+// a TableWriter. Composite foods are exported with their rolled-up values.
+class DataExporter
+{
+private:
+    const FoodManager &foodManager;
+
+public:
+    DataExporter(const FoodManager &foodManager) : foodManager(foodManager) {}
+
+    static vector<Column> logColumns()
+    {
+        return {{"date", ColumnType::Day}, {"foodId", ColumnType::Text}, {"servings", ColumnType::Fixed},
+                {"calories", ColumnType::Fixed}, {"proteins", ColumnType::Fixed},
+                {"carbs", ColumnType::Fixed}, {"fats", ColumnType::Fixed}};
+    }
+
+    static vector<Column> foodColumns()
+    {
+        return {{"foodId", ColumnType::Text}, {"type", ColumnType::Text}, {"servingGrams", ColumnType::Fixed},
+                {"calories", ColumnType::Fixed}, {"proteins", ColumnType::Fixed},
+                {"carbs", ColumnType::Fixed}, {"fats", ColumnType::Fixed}};
+    }
+
+    // One row per log entry, oldest day first. Returns the number of rows.
+    // Takes a snapshot of the logs so it can run on a background thread.
+    size_t exportLog(const LogStore &logs, TableWriter &writer) const
+    {
+        size_t rows = 0;
+        writer.begin(logColumns());
+        auto writeDay = [&](int day, const DailyLog &log)
+        {
+            for (const auto &entry : log.getEntries())
+            {
+                Nutrients nutrients = entry.getTotalNutrients(foodManager);
+                writer.addDay(day);
+                writer.addText(entry.getFoodId());
+                writer.addFixed(entry.getServings());
+                writer.addFixed(nutrients.calories);
+                writer.addFixed(nutrients.proteins);
+                writer.addFixed(nutrients.carbs);
+                writer.addFixed(nutrients.fats);
+                writer.endRow();
+                rows++;
+            }
+        };
+        logs.forEach(writeDay);
+        writer.finish();
+        return rows;
+    }
+
+    // One row per food, with per-serving values
+    size_t exportFoods(TableWriter &writer) const
+    {
+        size_t rows = 0;
+        writer.begin(foodColumns());
+        for (const auto &food : foodManager.getAllFoods())
+        {
+            Nutrients nutrients = food->getNutrientsPerServing();
+            writer.addText(food->getId());
+            writer.addText(food->getType());
+            writer.addFixed(food->getServingGrams());
+            writer.addFixed(nutrients.calories);
+            writer.addFixed(nutrients.proteins);
+            writer.addFixed(nutrients.carbs);
+            writer.addFixed(nutrients.fats);
+            writer.endRow();
+            rows++;
+        }
+        writer.finish();
+        return rows;
+    }
+
+    // Writes to a file; ".csv" selects CSV, anything else the columnar format
+    bool exportToFile(const string &path, const LogStore *logs, size_t &rows) const
+    {
+        ofstream file(path, ios::binary);
+        if (!file.is_open())
+        {
+            return false;
+        }
+
+        bool csv = path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+        unique_ptr<TableWriter> writer;
+        if (csv)
+        {
+            writer = make_unique<CsvTableWriter>(file);
+        }
+        else
+        {
+            writer = make_unique<ColumnarTableWriter>(file);
+        }
+
+        rows = logs ? exportLog(*logs, *writer) : exportFoods(*writer);
+        return file.good();
+    }
+};
+
+#endif
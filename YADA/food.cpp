@@ -4,14 +4,281 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
+#include <unordered_map>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <algorithm>
 #include <memory>
 #include "json.hpp"
+#include "pmap.cpp"
+#include "rcu.cpp"
+#include "storage.cpp"
+#include "scheduler.cpp"
+#include "shmcatalog.cpp"
 #include <fstream>
 #include <iostream>
+#include <cstdint>
+#include <cmath>
 using namespace std;
 
 using json = nlohmann::json;
 
+// Fixed-point decimal with three fractional digits (1.5 is stored as 1500).
+// Used for servings, grams and nutrient amounts so that sums are exact and
+// independent of evaluation order.
+class Fixed
+{
+private:
+    int64_t milli;
+
+    constexpr explicit Fixed(int64_t milli) : milli(milli) {}
+
+public:
+    static constexpr int64_t SCALE = 1000;
+
+    constexpr Fixed() : milli(0) {}
+
+    static constexpr Fixed fromMilli(int64_t value) { return Fixed(value); }
+    static constexpr Fixed fromInt(int64_t value) { return Fixed(value * SCALE); }
+    static Fixed fromDouble(double value) { return Fixed(llround(value * SCALE)); }
+
+    constexpr int64_t getMilli() const { return milli; }
+    double toDouble() const { return static_cast<double>(milli) / SCALE; }
+    constexpr bool isWhole() const { return milli % SCALE == 0; }
+
+    // Product of two fixed values, rounded half away from zero
+    Fixed operator*(Fixed other) const
+    {
+        int64_t product = milli * other.milli;
+        int64_t half = (product < 0) ? -SCALE / 2 : SCALE / 2;
+        return Fixed((product + half) / SCALE);
+    }
+
+    // Quotient of two fixed values, rounded half away from zero
+    Fixed operator/(Fixed other) const
+    {
+        if (other.milli == 0)
+        {
+            return Fixed();
+        }
+        int64_t numerator = milli * SCALE;
+        int64_t half = ((numerator < 0) != (other.milli < 0)) ? -llabs(other.milli) / 2 : llabs(other.milli) / 2;
+        return Fixed((numerator + half) / other.milli);
+    }
+
+    constexpr Fixed operator+(Fixed other) const { return Fixed(milli + other.milli); }
+    constexpr Fixed operator-(Fixed other) const { return Fixed(milli - other.milli); }
+    constexpr Fixed operator-() const { return Fixed(-milli); }
+    Fixed &operator+=(Fixed other)
+    {
+        milli += other.milli;
+        return *this;
+    }
+    Fixed &operator-=(Fixed other)
+    {
+        milli -= other.milli;
+        return *this;
+    }
+
+    constexpr bool operator==(Fixed other) const { return milli == other.milli; }
+    constexpr bool operator!=(Fixed other) const { return milli != other.milli; }
+    constexpr bool operator<(Fixed other) const { return milli < other.milli; }
+    constexpr bool operator<=(Fixed other) const { return milli <= other.milli; }
+    constexpr bool operator>(Fixed other) const { return milli > other.milli; }
+    constexpr bool operator>=(Fixed other) const { return milli >= other.milli; }
+
+    // Shortest decimal form: 2000 -> "2", 1500 -> "1.5", -250 -> "-0.25"
+    string toString() const
+    {
+        int64_t absolute = llabs(milli);
+        string text = (milli < 0 ? "-" : "") + to_string(absolute / SCALE);
+        int64_t fraction = absolute % SCALE;
+        if (fraction != 0)
+        {
+            string digits = to_string(fraction);
+            digits.insert(0, 3 - digits.size(), '0');
+            digits.erase(digits.find_last_not_of('0') + 1);
+            text += "." + digits;
+        }
+        return text;
+    }
+
+    // Whole values are written as integers so older readers keep working
+    json toJson() const
+    {
+        if (isWhole())
+        {
+            return json(milli / SCALE);
+        }
+        return json(toDouble());
+    }
+
+    static Fixed fromJson(const json &j)
+    {
+        if (j.is_number_integer())
+        {
+            return fromInt(j.get<int64_t>());
+        }
+        return fromDouble(j.get<double>());
+    }
+
+    // Parses a plain decimal such as "2", "0.5" or "-1.25" without going
+    // through floating point. Digits beyond the third decimal are rounded.
+    static bool parse(const string &text, Fixed &out)
+    {
+        size_t pos = 0;
+        bool negative = false;
+        if (pos < text.size() && (text[pos] == '-' || text[pos] == '+'))
+        {
+            negative = (text[pos] == '-');
+            pos++;
+        }
+
+        int64_t whole = 0;
+        size_t digits = 0;
+        while (pos < text.size() && isdigit(static_cast<unsigned char>(text[pos])))
+        {
+            whole = whole * 10 + (text[pos] - '0');
+            if (whole > INT64_MAX / (SCALE * 10))
+            {
+                return false;
+            }
+            pos++;
+            digits++;
+        }
+
+        int64_t fraction = 0;
+        int64_t place = SCALE / 10;
+        bool roundUp = false;
+        if (pos < text.size() && text[pos] == '.')
+        {
+            pos++;
+            bool first = true;
+            while (pos < text.size() && isdigit(static_cast<unsigned char>(text[pos])))
+            {
+                int digit = text[pos] - '0';
+                if (place > 0)
+                {
+                    fraction += digit * place;
+                    place /= 10;
+                }
+                else if (first)
+                {
+                    roundUp = (digit >= 5);
+                    first = false;
+                }
+                pos++;
+                digits++;
+            }
+        }
+
+        if (digits == 0 || pos != text.size())
+        {
+            return false;
+        }
+
+        int64_t value = whole * SCALE + fraction + (roundUp ? 1 : 0);
+        out = Fixed(negative ? -value : value);
+        return true;
+    }
+};
+
+inline ostream &operator<<(ostream &os, Fixed value)
+{
+    return os << value.toString();
+}
+
+using Servings = Fixed;
+
+using FoodHandle = uint32_t;
+
+// Interns food IDs into small integer handles, so log entries can be stored
+// and indexed without carrying their own copy of the ID string
+class FoodIdTable
+{
+private:
+    deque<string> ids; // Deque keeps references stable as it grows
+    unordered_map<string, FoodHandle> handles;
+    mutable shared_mutex mutex; // Background readers may look up IDs while new ones are interned
+
+public:
+    static FoodIdTable &instance()
+    {
+        static FoodIdTable table;
+        return table;
+    }
+
+    FoodHandle intern(const string &id)
+    {
+        {
+            shared_lock<shared_mutex> lock(mutex);
+            auto it = handles.find(id);
+            if (it != handles.end())
+            {
+                return it->second;
+            }
+        }
+
+        unique_lock<shared_mutex> lock(mutex);
+        auto it = handles.find(id);
+        if (it != handles.end())
+        {
+            return it->second;
+        }
+        FoodHandle handle = static_cast<FoodHandle>(ids.size());
+        ids.push_back(id);
+        handles.emplace(id, handle);
+        return handle;
+    }
+
+    const string &idOf(FoodHandle handle) const
+    {
+        shared_lock<shared_mutex> lock(mutex);
+        return ids[handle];
+    }
+};
+
+struct Nutrients
+{
+    Fixed calories;
+    Fixed proteins;
+    Fixed carbs;
+    Fixed fats;
+
+    Nutrients scaled(Servings servings) const
+    {
+        return {calories * servings, proteins * servings, carbs * servings, fats * servings};
+    }
+
+    Nutrients &operator+=(const Nutrients &other)
+    {
+        calories += other.calories;
+        proteins += other.proteins;
+        carbs += other.carbs;
+        fats += other.fats;
+        return *this;
+    }
+
+    Nutrients &operator-=(const Nutrients &other)
+    {
+        calories -= other.calories;
+        proteins -= other.proteins;
+        carbs -= other.carbs;
+        fats -= other.fats;
+        return *this;
+    }
+
+    bool operator==(const Nutrients &other) const
+    {
+        return calories == other.calories && proteins == other.proteins &&
+               carbs == other.carbs && fats == other.fats;
+    }
+
+    bool operator!=(const Nutrients &other) const { return !(*this == other); }
+};
+
 class Food
 {
 public:
@@ -19,6 +286,8 @@ public:
     virtual string getId() const = 0;
     virtual vector<string> getKeywords() const = 0;
     virtual double getCaloriesPerServing() const = 0;
+    virtual Nutrients getNutrientsPerServing() const = 0;
+    virtual Fixed getServingGrams() const = 0; // 0 when the weight is unknown
     virtual string getDescription() const = 0;
     virtual json toJson() const = 0;
     virtual string getType() const = 0;
@@ -30,15 +299,21 @@ class AbstractFood : public Food
 protected:
     string id;
     vector<string> keywords;
-    double caloriesPerServing;
+    Nutrients nutrients;
+    Fixed servingGrams;
 
 public:
     AbstractFood(const string &id, const vector<string> &keywords, double calories)
-        : id(id), keywords(keywords), caloriesPerServing(calories) {}
+        : id(id), keywords(keywords)
+    {
+        nutrients.calories = Fixed::fromDouble(calories);
+    }
 
     string getId() const override { return id; }
     vector<string> getKeywords() const override { return keywords; }
-    double getCaloriesPerServing() const override { return caloriesPerServing; }
+    double getCaloriesPerServing() const override { return nutrients.calories.toDouble(); }
+    Nutrients getNutrientsPerServing() const override { return nutrients; }
+    Fixed getServingGrams() const override { return servingGrams; }
     void addKeyword(const string &keyword) { keywords.push_back(keyword); }
 };
 
@@ -47,38 +322,53 @@ class BasicFood : public AbstractFood
 {
 private:
     string description;
-    double proteins;
-    double carbs;
-    double fats;
 
 public:
     BasicFood(const string &id, const vector<string> &keywords,
               double calories, const string &description,
-              double proteins, double carbs, double fats)
-        : AbstractFood(id, keywords, calories), description(description),
-          proteins(proteins), carbs(carbs), fats(fats) {}
+              double proteins, double carbs, double fats,
+              double servingGrams = 0)
+        : AbstractFood(id, keywords, calories), description(description)
+    {
+        nutrients.proteins = Fixed::fromDouble(proteins);
+        nutrients.carbs = Fixed::fromDouble(carbs);
+        nutrients.fats = Fixed::fromDouble(fats);
+        this->servingGrams = Fixed::fromDouble(servingGrams);
+    }
 
     string getDescription() const override
     {
-        return description + "\nNutritional info per serving:\n" +
-               "- Calories: " + to_string(caloriesPerServing) + "\n" +
-               "- Proteins: " + to_string(proteins) + "g\n" +
-               "- Carbs: " + to_string(carbs) + "g\n" +
-               "- Fats: " + to_string(fats) + "g";
+        string text = description + "\nNutritional info per serving";
+        if (servingGrams > Fixed())
+        {
+            text += " (" + servingGrams.toString() + "g)";
+        }
+        return text + ":\n" +
+               "- Calories: " + nutrients.calories.toString() + "\n" +
+               "- Proteins: " + nutrients.proteins.toString() + "g\n" +
+               "- Carbs: " + nutrients.carbs.toString() + "g\n" +
+               "- Fats: " + nutrients.fats.toString() + "g";
     }
 
     string getType() const override { return "basic"; }
 
+    // The description as entered, without the nutrition summary
+    const string &getPlainDescription() const { return description; }
+
     json toJson() const override
     {
         json j;
         j["id"] = id;
         j["keywords"] = keywords;
-        j["calories"] = caloriesPerServing;
+        j["calories"] = nutrients.calories.toDouble();
         j["description"] = description;
-        j["proteins"] = proteins;
-        j["carbs"] = carbs;
-        j["fats"] = fats;
+        j["proteins"] = nutrients.proteins.toDouble();
+        j["carbs"] = nutrients.carbs.toDouble();
+        j["fats"] = nutrients.fats.toDouble();
+        if (servingGrams > Fixed())
+        {
+            j["servingGrams"] = servingGrams.toJson();
+        }
         j["type"] = "basic";
         return j;
     }
@@ -92,7 +382,83 @@ public:
             j["description"].get<string>(),
             j["proteins"].get<double>(),
             j["carbs"].get<double>(),
-            j["fats"].get<double>());
+            j["fats"].get<double>(),
+            j.value("servingGrams", 0.0));
+    }
+};
+
+// Foods by ID; copies share structure, see PersistentMap
+using FoodMap = PersistentMap<string, shared_ptr<Food>>;
+
+// Canonical recipe body: components sorted by food ID plus the nutrients
+// rolled up from them. Composites with identical components share one body.
+// A body is not changed once a published catalog refers to it; FoodManager
+// replaces it with an updated copy instead.
+class Recipe
+{
+private:
+    vector<pair<string, Servings>> components;
+    size_t hashValue = 0;
+
+public:
+    Nutrients nutrients; // per serving, cached by FoodManager
+    Fixed servingGrams;  // 0 when the weight is unknown
+
+    const vector<pair<string, Servings>> &getComponents() const { return components; }
+    size_t getHash() const { return hashValue; }
+
+    void setComponent(const string &foodId, Servings servings)
+    {
+        auto it = lower_bound(components.begin(), components.end(), foodId,
+                              [](const pair<string, Servings> &component, const string &id)
+                              { return component.first < id; });
+        if (it != components.end() && it->first == foodId)
+        {
+            it->second = servings;
+        }
+        else
+        {
+            components.insert(it, {foodId, servings});
+        }
+
+        hashValue = 0;
+        for (const auto &[id, amount] : components)
+        {
+            size_t h = hash<string>()(id) ^ (hash<int64_t>()(amount.getMilli()) << 1);
+            hashValue ^= h + 0x9e3779b97f4a7c15ULL + (hashValue << 6) + (hashValue >> 2);
+        }
+    }
+
+    bool sameComponents(const Recipe &other) const
+    {
+        return hashValue == other.hashValue && components == other.components;
+    }
+
+    // Recomputes nutrients and serving weight from the components. The weight
+    // is only known when every component has a known weight.
+    void updateNutrients(const FoodMap &foodDatabase)
+    {
+        nutrients = Nutrients();
+        servingGrams = Fixed();
+        bool weightKnown = !components.empty();
+        for (const auto &[foodId, servings] : components)
+        {
+            if (const shared_ptr<Food> *food = foodDatabase.find(foodId))
+            {
+                nutrients += (*food)->getNutrientsPerServing().scaled(servings);
+                Fixed grams = (*food)->getServingGrams();
+                weightKnown = weightKnown && grams > Fixed();
+                servingGrams += grams * servings;
+            }
+            else
+            {
+                weightKnown = false;
+            }
+        }
+        if (!weightKnown)
+        {
+            servingGrams = Fixed();
+        }
     }
 };
 
@@ -100,25 +466,46 @@ public:
 class CompositeFood : public AbstractFood
 {
 private:
-    map<string, int> components; // Food ID to servings
+    shared_ptr<Recipe> recipe; // Possibly shared with other composites
 
 public:
     CompositeFood(const string &id, const vector<string> &keywords)
-        : AbstractFood(id, keywords, 0) {}
+        : AbstractFood(id, keywords, 0), recipe(make_shared<Recipe>()) {}
 
-    void addComponent(const string &foodId, int servings)
+    // Copy-on-write: a shared recipe body is cloned before it is changed
+    void addComponent(const string &foodId, Servings servings)
     {
-        components[foodId] = servings;
+        if (recipe.use_count() > 1)
+        {
+            recipe = make_shared<Recipe>(*recipe);
+        }
+        recipe->setComponent(foodId, servings);
     }
 
-    map<string, int> getComponents() const
+    map<string, Servings> getComponents() const
     {
-        return components;
+        return map<string, Servings>(recipe->getComponents().begin(), recipe->getComponents().end());
     }
 
+    const shared_ptr<Recipe> &getRecipe() const { return recipe; }
+    void setRecipe(const shared_ptr<Recipe> &sharedRecipe) { recipe = sharedRecipe; }
+
+    double getCaloriesPerServing() const override { return recipe->nutrients.calories.toDouble(); }
+    Nutrients getNutrientsPerServing() const override { return recipe->nutrients; }
+    Fixed getServingGrams() const override { return recipe->servingGrams; }
+
     string getDescription() const override
     {
-        return "Composite food made of multiple ingredients.";
+        string text = "Composite food made of multiple ingredients.\nNutritional info per serving";
+        if (recipe->servingGrams > Fixed())
+        {
+            text += " (" + recipe->servingGrams.toString() + "g)";
+        }
+        return text + ":\n" +
+               "- Calories: " + recipe->nutrients.calories.toString() + "\n" +
+               "- Proteins: " + recipe->nutrients.proteins.toString() + "g\n" +
+               "- Carbs: " + recipe->nutrients.carbs.toString() + "g\n" +
+               "- Fats: " + recipe->nutrients.fats.toString() + "g";
     }
 
     string getType() const override { return "composite"; }
@@ -128,8 +515,13 @@ public:
         json j;
         j["id"] = id;
         j["keywords"] = keywords;
-        j["calories"] = caloriesPerServing;
-        j["components"] = components;
+        j["calories"] = recipe->nutrients.calories.toDouble();
+        json componentsJson = json::object();
+        for (const auto &[foodId, servings] : recipe->getComponents())
+        {
+            componentsJson[foodId] = servings.toJson();
+        }
+        j["components"] = componentsJson;
         j["type"] = "composite";
         return j;
     }
@@ -139,21 +531,12 @@ public:
         auto food = make_shared<CompositeFood>(
             j["id"].get<string>(),
             j["keywords"].get<vector<string>>());
-        food->caloriesPerServing = j["calories"].get<double>();
-        food->components = j["components"].get<map<string, int>>();
-        return food;
-    }
-
-    void updateCalories(const map<string, shared_ptr<Food>> &foodDatabase)
-    {
-        caloriesPerServing = 0;
-        for (const auto &[foodId, servings] : components)
+        for (const auto &[foodId, servings] : j["components"].items())
         {
-            if (foodDatabase.find(foodId) != foodDatabase.end())
-            {
-                caloriesPerServing += foodDatabase.at(foodId)->getCaloriesPerServing() * servings;
-            }
+            food->addComponent(foodId, Servings::fromJson(servings));
         }
+        food->recipe->nutrients.calories = Fixed::fromDouble(j["calories"].get<double>());
+        return food;
     }
 };
 
@@ -176,22 +559,396 @@ public:
             data["description"].get<string>(),
             data["proteins"].get<double>(),
             data["carbs"].get<double>(),
-            data["fats"].get<double>());
+            data["fats"].get<double>(),
+            data.value("servingGrams", 0.0));
+    }
+};
+
+// The foods of an attached shared catalog segment. A Food object is made
+// the first time a food is used, so a process holds only the ones it uses;
+// composites with the same recipe share one body, as in a loaded catalog.
+class SharedFoods
+{
+private:
+    shared_ptr<const SharedCatalog> segment;
+    unique_ptr<once_flag[]> foodOnce;
+    unique_ptr<shared_ptr<Food>[]> foods;
+    unique_ptr<once_flag[]> recipeOnce;
+    unique_ptr<shared_ptr<Recipe>[]> recipes;
+
+    Nutrients nutrientsOf(size_t index) const
+    {
+        Nutrients nutrients;
+        nutrients.calories = Fixed::fromMilli(segment->getCalories(index));
+        nutrients.proteins = Fixed::fromMilli(segment->getProteins(index));
+        nutrients.carbs = Fixed::fromMilli(segment->getCarbs(index));
+        nutrients.fats = Fixed::fromMilli(segment->getFats(index));
+        return nutrients;
+    }
+
+    // The body of a recipe, with the values of the composite using it
+    const shared_ptr<Recipe> &recipe(uint32_t number, size_t user) const
+    {
+        call_once(recipeOnce[number], [&]
+                  {
+            auto body = make_shared<Recipe>();
+            for (const auto &[foodId, servings] : segment->getComponents(number))
+            {
+                body->setComponent(foodId, Servings::fromMilli(servings));
+            }
+            body->nutrients = nutrientsOf(user);
+            body->servingGrams = Fixed::fromMilli(segment->getServingGrams(user));
+            recipes[number] = body; });
+        return recipes[number];
+    }
+
+public:
+    explicit SharedFoods(shared_ptr<const SharedCatalog> segment)
+        : segment(segment),
+          foodOnce(new once_flag[segment->size()]),
+          foods(new shared_ptr<Food>[segment->size()]),
+          recipeOnce(new once_flag[segment->getRecipeCount()]),
+          recipes(new shared_ptr<Recipe>[segment->getRecipeCount()]) {}
+
+    const SharedCatalog &getSegment() const { return *segment; }
+    size_t size() const { return segment->size(); }
+
+    const shared_ptr<Food> &food(size_t index) const
+    {
+        call_once(foodOnce[index], [&]
+                  {
+            string id(segment->getId(index));
+            if (segment->isComposite(index))
+            {
+                auto composite = make_shared<CompositeFood>(id, segment->getKeywords(index));
+                composite->setRecipe(recipe(segment->getRecipe(index), index));
+                foods[index] = composite;
+                return;
+            }
+            Nutrients nutrients = nutrientsOf(index);
+            foods[index] = make_shared<BasicFood>(
+                id, segment->getKeywords(index), nutrients.calories.toDouble(), string(segment->getDescription(index)),
+                nutrients.proteins.toDouble(), nutrients.carbs.toDouble(), nutrients.fats.toDouble(),
+                Fixed::fromMilli(segment->getServingGrams(index)).toDouble()); });
+        return foods[index];
+    }
+
+    const shared_ptr<Food> *find(const string &id) const
+    {
+        size_t index = segment->find(id);
+        return index == SharedCatalog::npos ? nullptr : &food(index);
+    }
+};
+
+// One version of the food catalog. A published version is never changed:
+// FoodManager applies each change to a copy, which shares everything the
+// change does not touch, and publishes the copy whole.
+struct FoodCatalog
+{
+    FoodMap foods;
+    PersistentMap<string, uint64_t> nutrientRevisions; // Food ID to epoch of its last change
+    uint64_t nutrientEpoch = 1;                         // Bumped on every nutrient change
+    uint64_t invalidationEpoch = 1;                     // Anything cached before this is stale
+    shared_ptr<const SharedFoods> shared;               // When attached; foods is then empty
+
+    const shared_ptr<Food> *find(const string &id) const
+    {
+        return shared ? shared->find(id) : foods.find(id);
+    }
+
+    // Visits every food in ID order
+    template <typename Visitor>
+    void forEach(Visitor visit) const
+    {
+        if (shared)
+        {
+            for (size_t i = 0; i < shared->size(); ++i)
+            {
+                visit(shared->food(i));
+            }
+            return;
+        }
+        foods.forEach([&](const string &, const shared_ptr<Food> &food)
+                      { visit(food); });
     }
 };
 
 // Food Manager class
+//
+// Lookups never block: each one pins the current catalog version (see
+// RcuPointer), so any number of threads may read while another writes.
+// Writers are serialized and publish one new version per change.
 class FoodManager
 {
 private:
-    map<string, shared_ptr<Food>> foodDatabase;
-    bool modified = false;
+    RcuPointer<FoodCatalog> catalog;
+    atomic<bool> modified{false};
     shared_ptr<BasicFoodFactory> basicFoodFactory;
+    unordered_map<size_t, vector<weak_ptr<Recipe>>> recipeTable; // Recipe hash to interned bodies; writers only
+    string sharedName;                                           // Of the attached shared catalog; writers only
+    unordered_map<string, set<string>> dependents;               // Food ID to composites listing it; writers only
 
-public:
-    FoodManager(shared_ptr<BasicFoodFactory> factory) : basicFoodFactory(factory) {}
+    using RecipeUsers = map<const Recipe *, vector<shared_ptr<CompositeFood>>>;
+
+    // Items per block for the bulk operations run on the TaskScheduler
+    static constexpr size_t LOAD_GRAIN = 128;
+    static constexpr size_t RECIPE_GRAIN = 16;
+    static constexpr size_t SEARCH_GRAIN = 512;
+
+    void useShared(shared_ptr<const SharedCatalog> segment)
+    {
+        catalog.update([&](FoodCatalog &next)
+                       {
+            next.foods = FoodMap();
+            next.shared = make_shared<SharedFoods>(segment);
+            dependents.clear();
+            next.invalidationEpoch = ++next.nutrientEpoch; });
+    }
+
+    static void noteNutrientsChanged(FoodCatalog &next, const string &id)
+    {
+        next.nutrientRevisions.getOrCreate(id) = ++next.nutrientEpoch;
+    }
+
+    // Adds or removes a composite as a dependent of each of its components
+    void indexComponents(const shared_ptr<Food> &food, bool add)
+    {
+        if (food->getType() != "composite")
+        {
+            return;
+        }
+        for (const auto &[foodId, servings] : dynamic_pointer_cast<CompositeFood>(food)->getComponents())
+        {
+            if (add)
+            {
+                dependents[foodId].insert(food->getId());
+                continue;
+            }
+            auto it = dependents.find(foodId);
+            if (it != dependents.end() && it->second.erase(food->getId()) && it->second.empty())
+            {
+                dependents.erase(it);
+            }
+        }
+    }
+
+    void rebuildDependents(const FoodCatalog &next)
+    {
+        dependents.clear();
+        next.foods.forEach([&](const string &, const shared_ptr<Food> &food)
+                           { indexComponents(food, true); });
+    }
+
+    // Records a change to the given foods and to every composite whose values
+    // moved as a result. Only the changed composites and the composites that
+    // use the changed foods, directly or through other composites, have
+    // their recipes recomputed.
+    void refreshAfterChange(FoodCatalog &next, const vector<string> &ids)
+    {
+        set<string> affected(ids.begin(), ids.end());
+        vector<string> pending(ids);
+        while (!pending.empty())
+        {
+            auto it = dependents.find(pending.back());
+            pending.pop_back();
+            if (it == dependents.end())
+            {
+                continue;
+            }
+            for (const auto &user : it->second)
+            {
+                if (affected.insert(user).second)
+                {
+                    pending.push_back(user);
+                }
+            }
+        }
+
+        RecipeUsers users;
+        for (const auto &id : affected)
+        {
+            const shared_ptr<Food> *food = next.foods.find(id);
+            if (food && (*food)->getType() == "composite")
+            {
+                auto composite = dynamic_pointer_cast<CompositeFood>(*food);
+                users[composite->getRecipe().get()].push_back(composite);
+            }
+        }
+
+        for (const auto &id : ids)
+        {
+            noteNutrientsChanged(next, id);
+        }
+        for (const auto &id : updateRecipes(next, users))
+        {
+            noteNutrientsChanged(next, id);
+        }
+    }
+
+    // Returns the interned body with the same components, registering the
+    // given one if there is none yet
+    shared_ptr<Recipe> internRecipe(const shared_ptr<Recipe> &recipe)
+    {
+        auto &bucket = recipeTable[recipe->getHash()];
+        for (auto it = bucket.begin(); it != bucket.end();)
+        {
+            auto existing = it->lock();
+            if (!existing)
+            {
+                it = bucket.erase(it);
+                continue;
+            }
+            if (existing->sameComponents(*recipe))
+            {
+                return existing;
+            }
+            ++it;
+        }
+        bucket.push_back(recipe);
+        return recipe;
+    }
+
+    // Makes an updated body the interned one in place of the body it was
+    // copied from, which older catalog versions may still hold
+    void replaceInterned(const Recipe *old, const shared_ptr<Recipe> &updated)
+    {
+        auto &bucket = recipeTable[updated->getHash()];
+        for (auto &entry : bucket)
+        {
+            if (entry.lock().get() == old)
+            {
+                entry = updated;
+                return;
+            }
+        }
+        bucket.push_back(updated);
+    }
+
+    void canonicalize(const shared_ptr<CompositeFood> &food)
+    {
+        food->setRecipe(internRecipe(food->getRecipe()));
+    }
+
+    // 0 for a recipe body without composite components, otherwise one more
+    // than the highest level among the bodies of its composite components.
+    // A component leading back into a cycle counts as level 0.
+    int recipeLevel(const FoodCatalog &next, const Recipe *recipe, map<const Recipe *, int> &levels)
+    {
+        auto [entry, inserted] = levels.emplace(recipe, 0); // 0 while in progress
+        if (!inserted)
+        {
+            return entry->second;
+        }
 
-    bool loadFromFile(const string &filename)
+        int level = 0;
+        for (const auto &[foodId, servings] : recipe->getComponents())
+        {
+            const shared_ptr<Food> *component = next.foods.find(foodId);
+            if (component && (*component)->getType() == "composite")
+            {
+                auto composite = dynamic_pointer_cast<CompositeFood>(*component);
+                level = max(level, recipeLevel(next, composite->getRecipe().get(), levels) + 1);
+            }
+        }
+        entry->second = level;
+        return level;
+    }
+
+    // Recomputes each of the given recipe bodies once, lowest level first so
+    // that composites nested inside composites see up-to-date values. Bodies
+    // of one level do not depend on each other and are recomputed in
+    // parallel. A body whose values move is replaced by an updated copy, and
+    // so is every composite using it. Returns the IDs of those composites.
+    vector<string> updateRecipes(FoodCatalog &next, const RecipeUsers &users)
+    {
+        map<const Recipe *, int> levels;
+        vector<vector<const Recipe *>> byLevel;
+        for (const auto &[recipe, foods] : users)
+        {
+            size_t level = recipeLevel(next, recipe, levels);
+            byLevel.resize(max(byLevel.size(), level + 1));
+            byLevel[level].push_back(recipe);
+        }
+
+        vector<string> changed;
+        for (const auto &recipes : byLevel)
+        {
+            vector<shared_ptr<Recipe>> updated(recipes.size());
+            TaskScheduler::instance().parallelFor(0, recipes.size(), RECIPE_GRAIN, [&](size_t first, size_t last)
+                                                  {
+                for (size_t i = first; i < last; ++i)
+                {
+                    auto copy = make_shared<Recipe>(*recipes[i]);
+                    copy->updateNutrients(next.foods);
+                    if (!(copy->nutrients == recipes[i]->nutrients && copy->servingGrams == recipes[i]->servingGrams))
+                    {
+                        updated[i] = copy;
+                    }
+                } });
+
+            for (size_t i = 0; i < recipes.size(); ++i)
+            {
+                if (!updated[i])
+                {
+                    continue;
+                }
+                replaceInterned(recipes[i], updated[i]);
+                for (const auto &food : users.at(recipes[i]))
+                {
+                    auto copy = make_shared<CompositeFood>(*food);
+                    copy->setRecipe(updated[i]);
+                    next.foods.getOrCreate(food->getId()) = copy;
+                    changed.push_back(food->getId());
+                }
+            }
+        }
+        return changed;
+    }
+
+    // Recomputes the bodies of every composite in the catalog
+    vector<string> updateAllRecipes(FoodCatalog &next)
+    {
+        RecipeUsers users;
+        next.foods.forEach([&](const string &, const shared_ptr<Food> &food)
+                           {
+            if (food->getType() == "composite")
+            {
+                auto composite = dynamic_pointer_cast<CompositeFood>(food);
+                users[composite->getRecipe().get()].push_back(composite);
+            } });
+        return updateRecipes(next, users);
+    }
+
+    // Inserts or replaces foods, then recomputes the affected recipes once
+    // for all
+    void applyFoods(const vector<shared_ptr<Food>> &foods)
+    {
+        if (isShared())
+        {
+            return; // Read-only; callers check isShared() and report it
+        }
+        catalog.update([&](FoodCatalog &next)
+                       {
+            vector<string> ids;
+            for (const auto &food : foods)
+            {
+                if (food->getType() == "composite")
+                {
+                    canonicalize(dynamic_pointer_cast<CompositeFood>(food));
+                }
+                if (const shared_ptr<Food> *replaced = next.foods.find(food->getId()))
+                {
+                    indexComponents(*replaced, false);
+                }
+                indexComponents(food, true);
+                next.foods.getOrCreate(food->getId()) = food;
+                ids.push_back(food->getId());
+            }
+            refreshAfterChange(next, ids); });
+        modified = true;
+    }
+
+    bool loadFromFile(const string &filename, FoodCatalog &next)
     {
         try
         {
@@ -204,19 +961,41 @@ public:
             json j;
             file >> j;
 
+            // Foods are built in parallel; interning recipes and adding the
+            // foods to the catalog stay in file order
+            vector<const json *> entries;
             for (const auto &foodJson : j)
             {
-                string type = foodJson["type"];
-                if (type == "basic")
+                entries.push_back(&foodJson);
+            }
+            vector<shared_ptr<Food>> foods(entries.size());
+            TaskScheduler::instance().parallelFor(0, entries.size(), LOAD_GRAIN, [&](size_t first, size_t last)
+                                                  {
+                for (size_t i = first; i < last; ++i)
+                {
+                    const json &foodJson = *entries[i];
+                    string type = foodJson["type"];
+                    if (type == "basic")
+                    {
+                        foods[i] = basicFoodFactory->createBasicFood(foodJson);
+                    }
+                    else if (type == "composite")
+                    {
+                        foods[i] = CompositeFood::fromJson(foodJson);
+                    }
+                } });
+
+            for (const auto &food : foods)
+            {
+                if (!food)
                 {
-                    auto food = basicFoodFactory->createBasicFood(foodJson);
-                    foodDatabase[food->getId()] = food;
+                    continue;
                 }
-                else if (type == "composite")
+                if (food->getType() == "composite")
                 {
-                    auto food = CompositeFood::fromJson(foodJson);
-                    foodDatabase[food->getId()] = food;
+                    canonicalize(dynamic_pointer_cast<CompositeFood>(food));
                 }
+                next.foods.getOrCreate(food->getId()) = food;
             }
 
             return true;
@@ -228,70 +1007,198 @@ public:
         }
     }
 
-    bool loadDatabase()
+public:
+    // One catalog version, pinned while the view exists. Lookups through it
+    // agree with each other and touch no shared counters. Keep views short:
+    // versions replaced in the meantime are only freed once they are gone.
+    class View
     {
-        bool basicLoaded = loadFromFile("basic_foods.json");
-        bool compositeLoaded = loadFromFile("composite_foods.json");
+    private:
+        RcuPointer<FoodCatalog>::Guard guard;
 
-        // Update calories of composite foods
-        for (auto &[id, food] : foodDatabase)
+    public:
+        explicit View(const RcuPointer<FoodCatalog> &catalog) : guard(catalog.read()) {}
+
+        const Food *find(const string &id) const
         {
-            if (food->getType() == "composite")
+            const shared_ptr<Food> *food = guard->find(id);
+            return food ? food->get() : nullptr;
+        }
+
+        // Visits every food in ID order
+        template <typename Visitor>
+        void forEach(Visitor visit) const
+        {
+            guard->forEach(visit);
+        }
+
+        // The attached shared catalog, or null
+        const SharedFoods *getShared() const { return guard->shared.get(); }
+
+        uint64_t getNutrientEpoch() const { return guard->nutrientEpoch; }
+
+        bool nutrientsChangedSince(const string &id, uint64_t epoch) const
+        {
+            if (epoch < guard->invalidationEpoch)
             {
-                auto compositeFood = dynamic_pointer_cast<CompositeFood>(food);
-                compositeFood->updateCalories(foodDatabase);
+                return true;
             }
+            const uint64_t *revision = guard->nutrientRevisions.find(id);
+            return revision && *revision > epoch;
         }
+    };
 
-        return basicLoaded || compositeLoaded;
-    }
-
-    bool saveDatabase()
+    // Stages food additions and applies them together on commit. Nothing is
+    // visible in the database until then, and a commit that fails validation
+    // changes nothing.
+    class Transaction
     {
-        try
+    private:
+        FoodManager &foodManager;
+        vector<shared_ptr<Food>> staged;
+
+    public:
+        Transaction(FoodManager &foodManager) : foodManager(foodManager) {}
+
+        void addBasicFood(const string &id, const vector<string> &keywords,
+                          double calories, const string &description,
+                          double proteins, double carbs, double fats,
+                          double servingGrams = 0)
         {
-            json basicFoods = json::array();
-            json compositeFoods = json::array();
+            staged.push_back(make_shared<BasicFood>(id, keywords, calories, description, proteins, carbs, fats, servingGrams));
+        }
 
-            for (const auto &[id, food] : foodDatabase)
+        void createCompositeFood(const string &id, const vector<string> &keywords,
+                                 const map<string, Servings> &components)
+        {
+            auto food = make_shared<CompositeFood>(id, keywords);
+            for (const auto &[foodId, servings] : components)
             {
-                if (food->getType() == "basic")
+                food->addComponent(foodId, servings);
+            }
+            staged.push_back(food);
+        }
+
+        size_t size() const { return staged.size(); }
+
+        // Components may refer to foods staged in the same transaction
+        bool commit(string &error)
+        {
+            if (foodManager.isShared() && !staged.empty())
+            {
+                error = "The food database is shared read-only.";
+                return false;
+            }
+
+            set<string> stagedIds;
+            for (const auto &food : staged)
+            {
+                stagedIds.insert(food->getId());
+            }
+
+            View view = foodManager.read();
+            for (const auto &food : staged)
+            {
+                if (food->getType() != "composite")
                 {
-                    basicFoods.push_back(food->toJson());
+                    continue;
                 }
-                else if (food->getType() == "composite")
+                for (const auto &[foodId, servings] : dynamic_pointer_cast<CompositeFood>(food)->getComponents())
                 {
-                    compositeFoods.push_back(food->toJson());
+                    if (!stagedIds.count(foodId) && !view.find(foodId))
+                    {
+                        error = "Unknown component '" + foodId + "' in " + food->getId() + ".";
+                        return false;
+                    }
                 }
             }
 
-            ofstream basicFile("basic_foods.json");
-            basicFile << basicFoods.dump(2);
+            foodManager.applyFoods(staged);
+            staged.clear();
+            return true;
+        }
 
-            ofstream compositeFile("composite_foods.json");
-            compositeFile << compositeFoods.dump(2);
+        void rollback() { staged.clear(); }
+    };
 
-            modified = false;
-            return true;
+    FoodManager(shared_ptr<BasicFoodFactory> factory)
+        : catalog(make_unique<FoodCatalog>()), basicFoodFactory(factory) {}
+
+    Transaction beginTransaction() { return Transaction(*this); }
+
+    View read() const { return View(catalog); }
+
+    bool loadDatabase()
+    {
+        if (isShared())
+        {
+            return true; // The attached catalog stands in for the files
         }
-        catch (exception &e)
+        return catalog.update([&](FoodCatalog &next)
+                              {
+            bool basicLoaded = loadFromFile("basic_foods.json", next);
+            bool compositeLoaded = loadFromFile("composite_foods.json", next);
+
+            // Update calories of composite foods, once per distinct recipe
+            updateAllRecipes(next);
+            rebuildDependents(next);
+            next.invalidationEpoch = ++next.nutrientEpoch;
+
+            return basicLoaded || compositeLoaded; });
+    }
+
+    // Captures the database as it is now and clears the modified flag. The
+    // snapshots share the catalog version, so they can be written later from
+    // any thread while foods keep being added.
+    vector<FileSnapshot> captureSave()
+    {
+        modified = false; // A change made from here on sets it again
+        if (isShared())
+        {
+            return {}; // The files belong to the publishing process
+        }
+        auto foods = make_shared<FoodMap>(catalog.read()->foods);
+
+        auto render = [foods](const string &type)
+        {
+            json j = json::array();
+            foods->forEach([&](const string &, const shared_ptr<Food> &food)
+                           {
+                if (food->getType() == type)
+                {
+                    j.push_back(food->toJson());
+                } });
+            return j.dump(2);
+        };
+
+        return {{"basic_foods.json", [render]
+                 { return render("basic"); }},
+                {"composite_foods.json", [render]
+                 { return render("composite"); }}};
+    }
+
+    bool saveDatabase()
+    {
+        string error;
+        if (!writeSnapshots(captureSave(), false, error))
         {
-            cerr << "Error saving database: " << e.what() << endl;
+            cerr << "Error saving database: " << error << endl;
+            modified = true;
             return false;
         }
+        return true;
     }
 
     void addBasicFood(const string &id, const vector<string> &keywords,
                       double calories, const string &description,
-                      double proteins, double carbs, double fats)
+                      double proteins, double carbs, double fats,
+                      double servingGrams = 0)
     {
-        auto food = make_shared<BasicFood>(id, keywords, calories, description, proteins, carbs, fats);
-        foodDatabase[id] = food;
-        modified = true;
+        applyFoods({make_shared<BasicFood>(id, keywords, calories, description, proteins, carbs, fats, servingGrams)});
     }
 
     void createCompositeFood(const string &id, const vector<string> &keywords,
-                             const map<string, int> &components)
+                             const map<string, Servings> &components)
     {
         auto food = make_shared<CompositeFood>(id, keywords);
 
@@ -300,79 +1207,240 @@ public:
             food->addComponent(foodId, servings);
         }
 
-        food->updateCalories(foodDatabase);
-        foodDatabase[id] = food;
-        modified = true;
+        applyFoods({food});
     }
 
-    vector<shared_ptr<Food>> searchFoods(const vector<string> &keywords, bool matchAll)
+    // Groups of composite IDs that share an identical recipe body
+    vector<vector<string>> findDuplicateRecipes() const
     {
-        vector<shared_ptr<Food>> results;
+        map<Recipe *, vector<string>> groups;
+        read().forEach([&](const shared_ptr<Food> &food)
+                       {
+            if (food->getType() == "composite")
+            {
+                auto compositeFood = dynamic_pointer_cast<CompositeFood>(food);
+                groups[compositeFood->getRecipe().get()].push_back(food->getId());
+            } });
 
-        for (const auto &[id, food] : foodDatabase)
+        vector<vector<string>> duplicates;
+        for (auto &[recipe, ids] : groups)
         {
-            auto foodKeywords = food->getKeywords();
+            if (ids.size() > 1)
+            {
+                duplicates.push_back(move(ids));
+            }
+        }
+        return duplicates;
+    }
 
-            if (matchAll)
+    // Scans the catalog in parallel blocks, or uses the keyword index of an
+    // attached shared catalog; results are in ID order
+    vector<shared_ptr<Food>> searchFoods(const vector<string> &keywords, bool matchAll) const
+    {
+        View catalog = read();
+        if (const SharedFoods *shared = catalog.getShared())
+        {
+            // Answered from the segment's keyword index
+            vector<shared_ptr<Food>> results;
+            for (size_t index : shared->getSegment().search(keywords, matchAll))
             {
-                bool allMatch = true;
-                for (const auto &keyword : keywords)
-                {
-                    if (find(foodKeywords.begin(), foodKeywords.end(), keyword) == foodKeywords.end())
-                    {
-                        allMatch = false;
-                        break;
-                    }
-                }
-                if (allMatch)
+                results.push_back(shared->food(index));
+            }
+            return results;
+        }
+
+        vector<const shared_ptr<Food> *> foods;
+        catalog.forEach([&](const shared_ptr<Food> &food)
+                        { foods.push_back(&food); });
+
+        size_t blocks = TaskScheduler::blockCount(0, foods.size(), SEARCH_GRAIN);
+        vector<vector<shared_ptr<Food>>> found(blocks);
+        TaskScheduler::instance().parallelFor(0, foods.size(), SEARCH_GRAIN, [&](size_t first, size_t last)
+                                              {
+            auto &results = found[first / SEARCH_GRAIN];
+            for (size_t i = first; i < last; ++i)
+            {
+                if (matchesKeywords(**foods[i], keywords, matchAll))
                 {
-                    results.push_back(food);
+                    results.push_back(*foods[i]);
                 }
+            } });
+
+        vector<shared_ptr<Food>> results;
+        for (auto &block : found)
+        {
+            results.insert(results.end(), make_move_iterator(block.begin()), make_move_iterator(block.end()));
+        }
+        return results;
+    }
+
+    static bool matchesKeywords(const Food &food, const vector<string> &keywords, bool matchAll)
+    {
+        auto foodKeywords = food.getKeywords();
+        auto has = [&](const string &keyword)
+        { return find(foodKeywords.begin(), foodKeywords.end(), keyword) != foodKeywords.end(); };
+        return matchAll ? all_of(keywords.begin(), keywords.end(), has) : any_of(keywords.begin(), keywords.end(), has);
+    }
+
+    // Parses a quantity typed by the user: either servings ("1.5") or a
+    // weight in grams ("150g"), which needs the food's serving weight.
+    bool parseQuantity(const string &foodId, const string &text, Servings &servings, string &error) const
+    {
+        return parseQuantity(getFoodById(foodId).get(), text, servings, error);
+    }
+
+    static bool parseQuantity(const Food *food, const string &text, Servings &servings, string &error)
+    {
+        string trimmed = text;
+        trimmed.erase(0, trimmed.find_first_not_of(" \t"));
+        trimmed.erase(trimmed.find_last_not_of(" \t") + 1);
+
+        bool inGrams = !trimmed.empty() && (trimmed.back() == 'g' || trimmed.back() == 'G');
+        if (inGrams)
+        {
+            trimmed.pop_back();
+            trimmed.erase(trimmed.find_last_not_of(" \t") + 1);
+        }
+
+        Fixed amount;
+        if (!Fixed::parse(trimmed, amount))
+        {
+            error = "Invalid quantity. Enter servings (e.g. 1.5) or grams (e.g. 150g).";
+            return false;
+        }
+
+        if (inGrams)
+        {
+            if (!food || food->getServingGrams() <= Fixed())
+            {
+                error = "Serving weight unknown for this food. Enter servings instead.";
+                return false;
             }
-            else
+            amount = amount / food->getServingGrams();
+        }
+
+        if (amount <= Fixed())
+        {
+            error = "Quantity must be positive.";
+            return false;
+        }
+
+        servings = amount;
+        return true;
+    }
+
+    shared_ptr<Food> getFoodById(const string &id) const
+    {
+        auto view = catalog.read();
+        const shared_ptr<Food> *food = view->find(id);
+        return food ? *food : nullptr;
+    }
+
+    vector<shared_ptr<Food>> getAllFoods() const
+    {
+        vector<shared_ptr<Food>> foods;
+        read().forEach([&](const shared_ptr<Food> &food)
+                       { foods.push_back(food); });
+        return foods;
+    }
+
+    bool isModified() const
+    {
+        return modified;
+    }
+
+    // Publishes the current catalog as the named shared catalog (see
+    // SharedCatalog). Returns the new generation, 0 on failure.
+    uint64_t publishShared(const string &name, string &error) const
+    {
+        SharedCatalogBuilder builder;
+        map<const Recipe *, uint32_t> recipes;
+        read().forEach([&](const shared_ptr<Food> &food)
+                       {
+            SharedFoodRecord record;
+            record.id = food->getId();
+            record.keywords = food->getKeywords();
+            Nutrients nutrients = food->getNutrientsPerServing();
+            record.calories = nutrients.calories.getMilli();
+            record.proteins = nutrients.proteins.getMilli();
+            record.carbs = nutrients.carbs.getMilli();
+            record.fats = nutrients.fats.getMilli();
+            record.servingGrams = food->getServingGrams().getMilli();
+            if (food->getType() == "composite")
             {
-                bool anyMatch = false;
-                for (const auto &keyword : keywords)
+                const Recipe *recipe = dynamic_pointer_cast<CompositeFood>(food)->getRecipe().get();
+                auto [entry, inserted] = recipes.emplace(recipe, 0);
+                if (inserted)
                 {
-                    if (find(foodKeywords.begin(), foodKeywords.end(), keyword) != foodKeywords.end())
+                    vector<pair<string, int64_t>> components;
+                    for (const auto &[foodId, servings] : recipe->getComponents())
                     {
-                        anyMatch = true;
-                        break;
+                        components.emplace_back(foodId, servings.getMilli());
                     }
+                    entry->second = builder.addRecipe(components);
                 }
-                if (anyMatch)
-                {
-                    results.push_back(food);
-                }
+                record.composite = true;
+                record.recipe = entry->second;
             }
-        }
-
-        return results;
+            else if (auto basic = dynamic_pointer_cast<BasicFood>(food))
+            {
+                record.description = basic->getPlainDescription();
+            }
+            builder.addFood(record); });
+        return SharedCatalog::publish(name, builder, error);
     }
 
-    shared_ptr<Food> getFoodById(const string &id) const
+    // Serves the foods from the named shared catalog instead of the data
+    // files. The catalog is then read-only in this process.
+    bool attachShared(const string &name, string &error)
     {
-        auto it = foodDatabase.find(id);
-        if (it != foodDatabase.end())
+        auto segment = SharedCatalog::attach(name, error);
+        if (!segment)
         {
-            return it->second;
+            return false;
         }
-        return nullptr;
+        sharedName = name;
+        useShared(segment);
+        return true;
     }
 
-    vector<shared_ptr<Food>> getAllFoods()
+    // Moves to the newest generation of the attached shared catalog, if one
+    // was published since. Cheap when none was; returns whether it moved.
+    bool refreshShared()
     {
-        vector<shared_ptr<Food>> foods;
-        for (const auto &[id, food] : foodDatabase)
         {
-            foods.push_back(food);
+            View view = read();
+            if (!view.getShared() || !view.getShared()->getSegment().isStale())
+            {
+                return false;
+            }
         }
-        return foods;
+        string error;
+        auto segment = SharedCatalog::attach(sharedName, error);
+        if (!segment)
+        {
+            cerr << "Cannot refresh the shared food database: " << error << endl;
+            return false;
+        }
+        useShared(segment);
+        return true;
     }
 
-    bool isModified() const
+    bool isShared() const
     {
-        return modified;
+        return read().getShared() != nullptr;
+    }
+
+    // Epoch counter for cached nutrient totals: a cache stamped with the
+    // current epoch is valid without looking at any food
+    uint64_t getNutrientEpoch() const
+    {
+        return read().getNutrientEpoch();
+    }
+
+    bool nutrientsChangedSince(const string &id, uint64_t epoch) const
+    {
+        return read().nutrientsChangedSince(id, epoch);
     }
 };
 
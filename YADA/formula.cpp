@@ -0,0 +1,434 @@
+#ifndef FORMULA_CPP
+#define FORMULA_CPP
+
+#include <string>
+#include <vector>
+#include <cctype>
+#include <cstdlib>
+#include <cstdint>
+using namespace std;
+
+// Inputs a formula can refer to, by name
+enum class FormulaVariable : uint8_t
+{
+    Weight,  // kg
+    Height,  // cm
+    Age,     // years
+    Male,    // 1 for male, 0 otherwise
+    BodyFat, // percent
+    Count
+};
+
+constexpr const char *FORMULA_VARIABLE_NAMES[] = {"weight", "height", "age", "male", "bodyFat"};
+
+// An arithmetic expression over the formula variables, parsed once and
+// compiled to bytecode for a small stack machine. Constant subexpressions
+// are folded at compile time.
+//
+// Grammar:  expr   := term (('+' | '-') term)*
+//           term   := unary (('*' | '/') unary)*
+//           unary  := '-' unary | number | variable | '(' expr ')'
+class FormulaProgram
+{
+public:
+    static constexpr size_t MAX_DEPTH = 32;   // Evaluation stack slots
+    static constexpr size_t BLOCK = 256;      // Rows evaluated together in batch mode
+    static constexpr size_t MAX_NESTING = 64; // Parentheses and signs the parser descends into
+
+private:
+    enum Op : uint8_t
+    {
+        PushConstant, // operand: index into constants
+        PushVariable, // operand: FormulaVariable
+        Add,
+        Subtract,
+        Multiply,
+        Divide,
+        Negate
+    };
+
+    struct Instruction
+    {
+        Op op;
+        uint8_t operand;
+    };
+
+    vector<Instruction> code;
+    vector<double> constants;
+    size_t depth = 0; // Stack slots needed
+
+    // Parser state, only used while compiling
+    const string *text = nullptr;
+    size_t position = 0;
+    size_t currentDepth = 0;
+    size_t nesting = 0; // Recursion depth of parseUnary
+    string error;
+
+    void skipSpaces()
+    {
+        while (position < text->size() && isspace(static_cast<unsigned char>((*text)[position])))
+        {
+            position++;
+        }
+    }
+
+    bool fail(const string &message)
+    {
+        if (error.empty())
+        {
+            error = message + " at position " + to_string(position + 1);
+        }
+        return false;
+    }
+
+    void push()
+    {
+        currentDepth++;
+        depth = max(depth, currentDepth);
+    }
+
+    bool emitConstant(double value)
+    {
+        if (constants.size() == 256)
+        {
+            return fail("Too many constants");
+        }
+        constants.push_back(value);
+        code.push_back({PushConstant, static_cast<uint8_t>(constants.size() - 1)});
+        push();
+        return true;
+    }
+
+    bool lastIsConstant(size_t back) const
+    {
+        return code.size() >= back && code[code.size() - back].op == PushConstant;
+    }
+
+    double constantAt(size_t back) const
+    {
+        return constants[code[code.size() - back].operand];
+    }
+
+    // Emits a binary operator, folding it if both operands are constants
+    bool emitBinary(Op op)
+    {
+        currentDepth--;
+        if (lastIsConstant(1) && lastIsConstant(2))
+        {
+            double right = constantAt(1), left = constantAt(2);
+            constants.resize(constants.size() - 2); // Both were the latest constants
+            code.resize(code.size() - 2);
+            currentDepth--;
+            return emitConstant(apply(op, left, right));
+        }
+        code.push_back({op, 0});
+        return true;
+    }
+
+    static double apply(Op op, double left, double right)
+    {
+        switch (op)
+        {
+        case Add:
+            return left + right;
+        case Subtract:
+            return left - right;
+        case Multiply:
+            return left * right;
+        default:
+            return left / right;
+        }
+    }
+
+    bool parseExpression()
+    {
+        if (!parseTerm())
+        {
+            return false;
+        }
+        while (true)
+        {
+            skipSpaces();
+            char c = position < text->size() ? (*text)[position] : '\0';
+            if (c != '+' && c != '-')
+            {
+                return true;
+            }
+            position++;
+            if (!parseTerm() || !emitBinary(c == '+' ? Add : Subtract))
+            {
+                return false;
+            }
+        }
+    }
+
+    bool parseTerm()
+    {
+        if (!parseUnary())
+        {
+            return false;
+        }
+        while (true)
+        {
+            skipSpaces();
+            char c = position < text->size() ? (*text)[position] : '\0';
+            if (c != '*' && c != '/')
+            {
+                return true;
+            }
+            position++;
+            if (!parseUnary() || !emitBinary(c == '*' ? Multiply : Divide))
+            {
+                return false;
+            }
+        }
+    }
+
+    bool parseUnary()
+    {
+        skipSpaces();
+        if (position >= text->size())
+        {
+            return fail("Expected a value");
+        }
+
+        char c = (*text)[position];
+        if (c == '-')
+        {
+            position++;
+            if (++nesting > MAX_NESTING)
+            {
+                return fail("Formula nested too deeply");
+            }
+            bool parsed = parseUnary();
+            nesting--;
+            if (!parsed)
+            {
+                return false;
+            }
+            if (lastIsConstant(1))
+            {
+                constants.back() = -constants.back();
+                return true;
+            }
+            code.push_back({Negate, 0});
+            return true;
+        }
+
+        if (c == '(')
+        {
+            position++;
+            if (currentDepth >= MAX_DEPTH - 1 || ++nesting > MAX_NESTING)
+            {
+                return fail("Formula nested too deeply");
+            }
+            bool parsed = parseExpression();
+            nesting--;
+            if (!parsed)
+            {
+                return false;
+            }
+            skipSpaces();
+            if (position >= text->size() || (*text)[position] != ')')
+            {
+                return fail("Expected ')'");
+            }
+            position++;
+            return true;
+        }
+
+        if (currentDepth >= MAX_DEPTH)
+        {
+            return fail("Formula nested too deeply");
+        }
+
+        if (isdigit(static_cast<unsigned char>(c)) || c == '.')
+        {
+            const char *start = text->c_str() + position;
+            char *end;
+            double value = strtod(start, &end);
+            if (end == start)
+            {
+                return fail("Invalid number");
+            }
+            position += end - start;
+            return emitConstant(value);
+        }
+
+        if (isalpha(static_cast<unsigned char>(c)))
+        {
+            size_t start = position;
+            while (position < text->size() && isalnum(static_cast<unsigned char>((*text)[position])))
+            {
+                position++;
+            }
+            string name = text->substr(start, position - start);
+            for (size_t i = 0; i < static_cast<size_t>(FormulaVariable::Count); ++i)
+            {
+                if (name == FORMULA_VARIABLE_NAMES[i])
+                {
+                    code.push_back({PushVariable, static_cast<uint8_t>(i)});
+                    push();
+                    return true;
+                }
+            }
+            position = start;
+            return fail("Unknown variable '" + name + "'");
+        }
+
+        return fail(string("Unexpected '") + c + "'");
+    }
+
+public:
+    // Replaces the program with the compiled formula. On failure the program
+    // is left empty and error describes the problem.
+    bool compile(const string &formula, string &errorMessage)
+    {
+        code.clear();
+        constants.clear();
+        depth = currentDepth = nesting = position = 0;
+        error.clear();
+        text = &formula;
+
+        bool ok = parseExpression();
+        skipSpaces();
+        if (ok && position < formula.size())
+        {
+            ok = fail(string("Unexpected '") + formula[position] + "'");
+        }
+        text = nullptr;
+
+        if (!ok)
+        {
+            code.clear();
+            constants.clear();
+            errorMessage = error;
+        }
+        return ok;
+    }
+
+    bool empty() const { return code.empty(); }
+
+    // Variables indexed by FormulaVariable
+    double evaluate(const double *variables) const
+    {
+        double stack[MAX_DEPTH];
+        size_t top = 0;
+        for (const auto &instruction : code)
+        {
+            switch (instruction.op)
+            {
+            case PushConstant:
+                stack[top++] = constants[instruction.operand];
+                break;
+            case PushVariable:
+                stack[top++] = variables[instruction.operand];
+                break;
+            case Add:
+                top--;
+                stack[top - 1] = stack[top - 1] + stack[top];
+                break;
+            case Subtract:
+                top--;
+                stack[top - 1] = stack[top - 1] - stack[top];
+                break;
+            case Multiply:
+                top--;
+                stack[top - 1] = stack[top - 1] * stack[top];
+                break;
+            case Divide:
+                top--;
+                stack[top - 1] = stack[top - 1] / stack[top];
+                break;
+            case Negate:
+                stack[top - 1] = -stack[top - 1];
+                break;
+            }
+        }
+        return top ? stack[0] : 0.0;
+    }
+
+    // Evaluates count (at most BLOCK) rows at once: each instruction runs as a
+    // loop over the rows, so dispatch is paid once per block and the loops
+    // vectorize. columns[v] points to count values of variable v; scratch
+    // needs depth() * BLOCK doubles. Every row sees the same operations as
+    // evaluate(), so the results are identical.
+    void evaluateBlock(const double *const *columns, size_t count, double *scratch, double *out) const
+    {
+        size_t top = 0;
+        auto slot = [&](size_t index)
+        { return scratch + index * BLOCK; };
+
+        for (const auto &instruction : code)
+        {
+            switch (instruction.op)
+            {
+            case PushConstant:
+            {
+                double *target = slot(top++);
+                double value = constants[instruction.operand];
+                for (size_t i = 0; i < count; ++i)
+                {
+                    target[i] = value;
+                }
+                break;
+            }
+            case PushVariable:
+            {
+                double *target = slot(top++);
+                const double *source = columns[instruction.operand];
+                for (size_t i = 0; i < count; ++i)
+                {
+                    target[i] = source[i];
+                }
+                break;
+            }
+            case Negate:
+            {
+                double *target = slot(top - 1);
+                for (size_t i = 0; i < count; ++i)
+                {
+                    target[i] = -target[i];
+                }
+                break;
+            }
+            default:
+            {
+                top--;
+                double *left = slot(top - 1);
+                const double *right = slot(top);
+                switch (instruction.op)
+                {
+                case Add:
+                    for (size_t i = 0; i < count; ++i)
+                        left[i] = left[i] + right[i];
+                    break;
+                case Subtract:
+                    for (size_t i = 0; i < count; ++i)
+                        left[i] = left[i] - right[i];
+                    break;
+                case Multiply:
+                    for (size_t i = 0; i < count; ++i)
+                        left[i] = left[i] * right[i];
+                    break;
+                default:
+                    for (size_t i = 0; i < count; ++i)
+                        left[i] = left[i] / right[i];
+                    break;
+                }
+                break;
+            }
+            }
+        }
+
+        const double *result = slot(0);
+        for (size_t i = 0; i < count; ++i)
+        {
+            out[i] = top ? result[i] : 0.0;
+        }
+    }
+
+    size_t getDepth() const { return depth; }
+};
+
+#endif
@@ -0,0 +1,627 @@
+#ifndef HTTPCLIENT_CPP
+#define HTTPCLIENT_CPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#ifdef YADA_WITH_OPENSSL
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
+using namespace std;
+
+// Client side of HTTP, for the online food search. Callers go through
+// HttpTransport, so the way requests reach the server can be replaced,
+// for example by a plain-HTTP mock server on localhost.
+
+struct HttpClientResponse
+{
+    int status = 0;
+    string body;
+};
+
+class HttpTransport
+{
+public:
+    virtual ~HttpTransport() = default;
+
+    // Sends a GET for url; a response with any status is a success.
+    // Must be safe to call from several threads at once.
+    virtual bool get(const string &url, HttpClientResponse &response, string &error) = 0;
+};
+
+// HTTP/1.1 over sockets owned by this process. Connections are kept open
+// after a response and reused by the next request to the same origin, so
+// a series of searches pays for the TCP (and TLS) handshake once. HTTPS
+// needs a build with -DYADA_WITH_OPENSSL (linked with -lssl -lcrypto);
+// otherwise https URLs go to httpsFallback.
+class SocketHttpTransport : public HttpTransport
+{
+private:
+    struct Url
+    {
+        bool secure = false;
+        string host;
+        string port;
+        string target; // Path and query
+    };
+
+    struct Connection
+    {
+        int fd = -1;
+#ifdef YADA_WITH_OPENSSL
+        SSL *ssl = nullptr;
+#endif
+        string input; // Received but not yet parsed
+
+        ~Connection()
+        {
+#ifdef YADA_WITH_OPENSSL
+            if (ssl)
+            {
+                SSL_free(ssl);
+            }
+#endif
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+
+        // Returns the number of bytes read, 0 when the peer closed, -1 on errors
+        ssize_t readSome(char *buffer, size_t size)
+        {
+#ifdef YADA_WITH_OPENSSL
+            if (ssl)
+            {
+                int count = SSL_read(ssl, buffer, static_cast<int>(size));
+                return count > 0 ? count : SSL_get_error(ssl, count) == SSL_ERROR_ZERO_RETURN ? 0 : -1;
+            }
+#endif
+            while (true)
+            {
+                ssize_t count = recv(fd, buffer, size, 0);
+                if (count >= 0 || errno != EINTR)
+                {
+                    return count;
+                }
+            }
+        }
+
+        bool writeAll(const string &data)
+        {
+            size_t sent = 0;
+            while (sent < data.size())
+            {
+                ssize_t count;
+#ifdef YADA_WITH_OPENSSL
+                if (ssl)
+                {
+                    count = SSL_write(ssl, data.data() + sent, static_cast<int>(data.size() - sent));
+                    if (count <= 0)
+                    {
+                        return false;
+                    }
+                    sent += count;
+                    continue;
+                }
+#endif
+                count = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+                if (count < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (count <= 0)
+                {
+                    return false;
+                }
+                sent += count;
+            }
+            return true;
+        }
+
+        // Appends more of the response to input
+        bool fill(string &error)
+        {
+            char buffer[16 * 1024];
+            ssize_t count = readSome(buffer, sizeof(buffer));
+            if (count <= 0)
+            {
+                error = count == 0 ? "Connection closed by server" : "Cannot read the response";
+                return false;
+            }
+            input.append(buffer, count);
+            return true;
+        }
+    };
+
+    static constexpr size_t MAX_HEADER_BYTES = 64 * 1024;
+    static constexpr size_t MAX_BODY_BYTES = 64 * 1024 * 1024;
+    static constexpr size_t MAX_IDLE_PER_ORIGIN = 4;
+    static constexpr int TIMEOUT_SECONDS = 20;
+
+    shared_ptr<HttpTransport> httpsFallback;
+    mutex idleMutex;
+    map<string, vector<unique_ptr<Connection>>> idle; // By scheme, host and port
+#ifdef YADA_WITH_OPENSSL
+    SSL_CTX *tls = nullptr;
+#endif
+
+    static string trim(const string &text)
+    {
+        size_t first = text.find_first_not_of(" \t");
+        if (first == string::npos)
+        {
+            return "";
+        }
+        size_t last = text.find_last_not_of(" \t");
+        return text.substr(first, last - first + 1);
+    }
+
+    static string lowercase(string text)
+    {
+        for (char &c : text)
+        {
+            c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        }
+        return text;
+    }
+
+    static bool parseUrl(const string &url, Url &parsed, string &error)
+    {
+        size_t schemeEnd = url.find("://");
+        string scheme = schemeEnd == string::npos ? "" : lowercase(url.substr(0, schemeEnd));
+        if (scheme != "http" && scheme != "https")
+        {
+            error = "Unsupported URL " + url;
+            return false;
+        }
+        parsed.secure = scheme == "https";
+
+        size_t authorityStart = schemeEnd + 3;
+        size_t pathStart = url.find_first_of("/?", authorityStart);
+        string authority = url.substr(authorityStart, pathStart == string::npos ? string::npos : pathStart - authorityStart);
+        parsed.target = pathStart == string::npos ? "/" : url.substr(pathStart);
+        if (parsed.target[0] == '?')
+        {
+            parsed.target.insert(0, "/");
+        }
+
+        // [v6 address]:port or host:port
+        size_t portColon = authority.rfind(':');
+        size_t bracket = authority.rfind(']');
+        if (portColon != string::npos && (bracket == string::npos || portColon > bracket))
+        {
+            parsed.host = authority.substr(0, portColon);
+            parsed.port = authority.substr(portColon + 1);
+        }
+        else
+        {
+            parsed.host = authority;
+            parsed.port = parsed.secure ? "443" : "80";
+        }
+        if (parsed.host.size() > 1 && parsed.host.front() == '[' && parsed.host.back() == ']')
+        {
+            parsed.host = parsed.host.substr(1, parsed.host.size() - 2);
+        }
+        if (parsed.host.empty() || parsed.port.empty())
+        {
+            error = "Invalid URL " + url;
+            return false;
+        }
+        return true;
+    }
+
+    unique_ptr<Connection> connectTo(const Url &url, string &error)
+    {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo *addresses = nullptr;
+        int status = getaddrinfo(url.host.c_str(), url.port.c_str(), &hints, &addresses);
+        if (status != 0)
+        {
+            error = "Cannot resolve " + url.host + ": " + gai_strerror(status);
+            return nullptr;
+        }
+
+        auto connection = make_unique<Connection>();
+        string lastError = "no address";
+        for (addrinfo *address = addresses; address; address = address->ai_next)
+        {
+            int fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+            if (fd < 0)
+            {
+                lastError = strerror(errno);
+                continue;
+            }
+            timeval timeout{TIMEOUT_SECONDS, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            if (::connect(fd, address->ai_addr, address->ai_addrlen) == 0)
+            {
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                connection->fd = fd;
+                break;
+            }
+            lastError = strerror(errno);
+            close(fd);
+        }
+        freeaddrinfo(addresses);
+        if (connection->fd < 0)
+        {
+            error = "Cannot connect to " + url.host + ":" + url.port + ": " + lastError;
+            return nullptr;
+        }
+
+#ifdef YADA_WITH_OPENSSL
+        if (url.secure)
+        {
+            connection->ssl = SSL_new(tls);
+            if (!connection->ssl || !SSL_set_fd(connection->ssl, connection->fd) ||
+                !SSL_set_tlsext_host_name(connection->ssl, url.host.c_str()) ||
+                !SSL_set1_host(connection->ssl, url.host.c_str()) || SSL_connect(connection->ssl) != 1)
+            {
+                char reason[256] = "handshake failed";
+                if (unsigned long code = ERR_get_error())
+                {
+                    ERR_error_string_n(code, reason, sizeof(reason));
+                }
+                ERR_clear_error();
+                error = "TLS connection to " + url.host + " failed: " + reason;
+                return nullptr;
+            }
+        }
+#endif
+        return connection;
+    }
+
+    // Reads one response. reusable tells whether the connection can carry
+    // another request; received whether any of the response arrived.
+    static bool readResponse(Connection &connection, HttpClientResponse &response, bool &reusable, bool &received, string &error)
+    {
+        size_t headerEnd;
+        while ((headerEnd = connection.input.find("\r\n\r\n")) == string::npos)
+        {
+            if (connection.input.size() > MAX_HEADER_BYTES)
+            {
+                error = "Response headers too large";
+                return false;
+            }
+            if (!connection.fill(error))
+            {
+                return false;
+            }
+            received = true;
+        }
+        received = true;
+
+        string head = connection.input.substr(0, headerEnd);
+        connection.input.erase(0, headerEnd + 4);
+
+        size_t lineEnd = head.find("\r\n");
+        string statusLine = head.substr(0, lineEnd);
+        if (statusLine.compare(0, 5, "HTTP/") != 0 || statusLine.size() < 12)
+        {
+            error = "Malformed response";
+            return false;
+        }
+        reusable = statusLine.compare(0, 8, "HTTP/1.0") != 0;
+        response.status = atoi(statusLine.c_str() + 9);
+
+        bool chunked = false;
+        bool lengthKnown = false;
+        size_t contentLength = 0;
+        size_t position = lineEnd == string::npos ? head.size() : lineEnd + 2;
+        while (position < head.size())
+        {
+            size_t next = head.find("\r\n", position);
+            string header = head.substr(position, next == string::npos ? string::npos : next - position);
+            position = next == string::npos ? head.size() : next + 2;
+
+            size_t colon = header.find(':');
+            if (colon == string::npos)
+            {
+                continue;
+            }
+            string name = lowercase(trim(header.substr(0, colon)));
+            string value = lowercase(trim(header.substr(colon + 1)));
+            if (name == "content-length")
+            {
+                contentLength = strtoull(value.c_str(), nullptr, 10);
+                lengthKnown = true;
+            }
+            else if (name == "transfer-encoding")
+            {
+                chunked = value.find("chunked") != string::npos;
+            }
+            else if (name == "connection")
+            {
+                reusable = value == "keep-alive" || (reusable && value != "close");
+            }
+        }
+
+        response.body.clear();
+        if (response.status == 204 || response.status == 304 || (response.status >= 100 && response.status < 200))
+        {
+            return true;
+        }
+
+        if (chunked)
+        {
+            while (true)
+            {
+                size_t sizeEnd;
+                while ((sizeEnd = connection.input.find("\r\n")) == string::npos)
+                {
+                    if (!connection.fill(error))
+                    {
+                        return false;
+                    }
+                }
+                size_t size = strtoull(connection.input.c_str(), nullptr, 16); // Extensions are ignored
+                connection.input.erase(0, sizeEnd + 2);
+                if (size == 0)
+                {
+                    // Trailers, then the empty line
+                    size_t trailerEnd;
+                    while ((trailerEnd = connection.input.find("\r\n")) != 0)
+                    {
+                        if (trailerEnd != string::npos)
+                        {
+                            connection.input.erase(0, trailerEnd + 2);
+                        }
+                        else if (!connection.fill(error))
+                        {
+                            return false;
+                        }
+                    }
+                    connection.input.erase(0, 2);
+                    return true;
+                }
+                if (size > MAX_BODY_BYTES - response.body.size())
+                {
+                    error = "Response too large";
+                    return false;
+                }
+                while (connection.input.size() < size + 2)
+                {
+                    if (!connection.fill(error))
+                    {
+                        return false;
+                    }
+                }
+                response.body.append(connection.input, 0, size);
+                connection.input.erase(0, size + 2);
+            }
+        }
+
+        if (lengthKnown)
+        {
+            if (contentLength > MAX_BODY_BYTES)
+            {
+                error = "Response too large";
+                return false;
+            }
+            while (connection.input.size() < contentLength)
+            {
+                if (!connection.fill(error))
+                {
+                    return false;
+                }
+            }
+            response.body = connection.input.substr(0, contentLength);
+            connection.input.erase(0, contentLength);
+            return true;
+        }
+
+        // No length: the body ends when the server closes the connection
+        reusable = false;
+        string ignored;
+        while (connection.fill(ignored))
+        {
+            if (connection.input.size() > MAX_BODY_BYTES)
+            {
+                error = "Response too large";
+                return false;
+            }
+        }
+        response.body = move(connection.input);
+        connection.input.clear();
+        return true;
+    }
+
+    unique_ptr<Connection> takeIdle(const string &origin)
+    {
+        lock_guard<mutex> lock(idleMutex);
+        auto it = idle.find(origin);
+        if (it == idle.end() || it->second.empty())
+        {
+            return nullptr;
+        }
+        unique_ptr<Connection> connection = move(it->second.back());
+        it->second.pop_back();
+        return connection;
+    }
+
+    void keepIdle(const string &origin, unique_ptr<Connection> connection)
+    {
+        lock_guard<mutex> lock(idleMutex);
+        auto &connections = idle[origin];
+        if (connections.size() < MAX_IDLE_PER_ORIGIN)
+        {
+            connections.push_back(move(connection));
+        }
+    }
+
+public:
+    explicit SocketHttpTransport(shared_ptr<HttpTransport> httpsFallback = nullptr)
+        : httpsFallback(move(httpsFallback))
+    {
+#ifdef YADA_WITH_OPENSSL
+        tls = SSL_CTX_new(TLS_client_method());
+        if (tls)
+        {
+            SSL_CTX_set_min_proto_version(tls, TLS1_2_VERSION);
+            SSL_CTX_set_default_verify_paths(tls);
+            SSL_CTX_set_verify(tls, SSL_VERIFY_PEER, nullptr);
+        }
+#endif
+    }
+
+    ~SocketHttpTransport()
+    {
+        idle.clear();
+#ifdef YADA_WITH_OPENSSL
+        if (tls)
+        {
+            SSL_CTX_free(tls);
+        }
+#endif
+    }
+
+    SocketHttpTransport(const SocketHttpTransport &) = delete;
+    SocketHttpTransport &operator=(const SocketHttpTransport &) = delete;
+
+    bool get(const string &url, HttpClientResponse &response, string &error) override
+    {
+        Url parsed;
+        if (!parseUrl(url, parsed, error))
+        {
+            return false;
+        }
+#ifdef YADA_WITH_OPENSSL
+        if (parsed.secure && !tls)
+        {
+            error = "Cannot set up TLS";
+            return false;
+        }
+#else
+        if (parsed.secure)
+        {
+            if (!httpsFallback)
+            {
+                error = "HTTPS needs a build with -DYADA_WITH_OPENSSL";
+                return false;
+            }
+            return httpsFallback->get(url, response, error);
+        }
+#endif
+
+        string origin = (parsed.secure ? "https://" : "http://") + parsed.host + ":" + parsed.port;
+        string hostHeader = parsed.host.find(':') != string::npos ? "[" + parsed.host + "]" : parsed.host;
+        if (parsed.port != (parsed.secure ? "443" : "80"))
+        {
+            hostHeader += ":" + parsed.port;
+        }
+        string request = "GET " + parsed.target + " HTTP/1.1\r\n"
+                         "Host: " + hostHeader + "\r\n"
+                         "Accept: application/json\r\n"
+                         "Connection: keep-alive\r\n"
+                         "User-Agent: YADA\r\n\r\n";
+
+        // A kept connection may have been closed by the server meanwhile;
+        // if nothing came back on it, the request is sent again on a new one
+        while (true)
+        {
+            unique_ptr<Connection> connection = takeIdle(origin);
+            bool reused = connection != nullptr;
+            if (!connection && !(connection = connectTo(parsed, error)))
+            {
+                return false;
+            }
+
+            bool reusable = false, received = false;
+            if (!connection->writeAll(request))
+            {
+                if (reused)
+                {
+                    continue;
+                }
+                error = "Cannot send the request to " + parsed.host;
+                return false;
+            }
+            if (!readResponse(*connection, response, reusable, received, error))
+            {
+                if (reused && !received)
+                {
+                    continue;
+                }
+                return false;
+            }
+            if (reusable && connection->input.empty())
+            {
+                keepIdle(origin, move(connection));
+            }
+            return true;
+        }
+    }
+};
+
+// Runs the curl program for each request, for builds without TLS support.
+// Nothing is reused between requests.
+class CommandHttpTransport : public HttpTransport
+{
+public:
+    bool get(const string &url, HttpClientResponse &response, string &error) override
+    {
+        if (url.find('\'') != string::npos)
+        {
+            error = "Invalid URL " + url;
+            return false;
+        }
+        // The status code follows the body on a line of its own
+        string command = "curl -s --max-time 20 -w '\\n%{http_code}' '" + url + "'";
+        unique_ptr<FILE, decltype(&pclose)> pipe(popen(command.c_str(), "r"), pclose);
+        if (!pipe)
+        {
+            error = "Cannot run curl";
+            return false;
+        }
+
+        string output;
+        char buffer[16 * 1024];
+        size_t count;
+        while ((count = fread(buffer, 1, sizeof(buffer), pipe.get())) > 0)
+        {
+            output.append(buffer, count);
+        }
+
+        size_t newline = output.rfind('\n');
+        response.status = newline == string::npos ? 0 : atoi(output.c_str() + newline + 1);
+        if (response.status == 0)
+        {
+            error = "No response from " + url.substr(0, url.find('?'));
+            return false;
+        }
+        output.resize(newline);
+        response.body = move(output);
+        return true;
+    }
+};
+
+// The transport used unless one is given: in-process for everything with
+// TLS support, and curl for HTTPS without it
+inline shared_ptr<HttpTransport> makeHttpTransport()
+{
+#ifdef YADA_WITH_OPENSSL
+    return make_shared<SocketHttpTransport>();
+#else
+    return make_shared<SocketHttpTransport>(make_shared<CommandHttpTransport>());
+#endif
+}
+
+#endif
@@ -0,0 +1,223 @@
+#ifndef IMPORTER_CPP
+#define IMPORTER_CPP
+
+#include "food.cpp"
+#include "log.cpp"
+#include "date.cpp"
+#include <unordered_map>
+using namespace std;
+
+// Outcome of a bulk import
+struct ImportReport
+{
+    size_t rowsRead = 0;
+    size_t imported = 0;
+    size_t malformed = 0;
+    vector<size_t> malformedLines;  // Line numbers of the first few malformed rows
+    map<string, size_t> unresolved; // Unknown food ID to number of rows skipped
+};
+
+// Streams historical logs from CSV ("date,foodId,servings", optional header)
+// or JSON Lines ({"date": ..., "foodId": ..., "servings": ...}) into a
+// LogManager. Rows are buffered into batches; each batch resolves its
+// distinct food IDs once and is appended without undo bookkeeping.
+class LogImporter
+{
+private:
+    struct PendingRow
+    {
+        int day;
+        string foodId;
+        string quantity;
+        size_t line;
+    };
+
+    static constexpr size_t MAX_REPORTED_LINES = 10;
+
+    const FoodManager &foodManager;
+    LogManager &logManager;
+    size_t batchSize;
+
+    vector<PendingRow> pending;
+    vector<pair<int, LogEntry>> batch;
+    struct ResolvedFood
+    {
+        shared_ptr<Food> food; // Null when the ID is unknown
+        FoodHandle handle;
+    };
+    unordered_map<string, ResolvedFood> resolved; // Food ID lookups, kept across batches
+
+    string lastDate; // Consecutive rows usually share a date
+    int lastDay = 0;
+
+    static string trim(const string &text)
+    {
+        size_t first = text.find_first_not_of(" \t\r\"");
+        if (first == string::npos)
+        {
+            return "";
+        }
+        size_t last = text.find_last_not_of(" \t\r\"");
+        return text.substr(first, last - first + 1);
+    }
+
+    void noteMalformed(size_t line, ImportReport &report)
+    {
+        report.malformed++;
+        if (report.malformedLines.size() < MAX_REPORTED_LINES)
+        {
+            report.malformedLines.push_back(line);
+        }
+    }
+
+    void addRow(const string &date, const string &foodId, const string &quantity, size_t line, ImportReport &report)
+    {
+        if (date != lastDate)
+        {
+            if (!Date::parse(date, lastDay))
+            {
+                lastDate.clear();
+                noteMalformed(line, report);
+                return;
+            }
+            lastDate = date;
+        }
+
+        if (foodId.empty())
+        {
+            noteMalformed(line, report);
+            return;
+        }
+
+        pending.push_back({lastDay, foodId, quantity, line});
+        if (pending.size() >= batchSize)
+        {
+            flush(report);
+        }
+    }
+
+    bool parseCsvLine(const string &line, size_t lineNumber, ImportReport &report)
+    {
+        size_t first = line.find(',');
+        size_t second = (first == string::npos) ? string::npos : line.find(',', first + 1);
+        if (second == string::npos)
+        {
+            return false;
+        }
+
+        addRow(trim(line.substr(0, first)), trim(line.substr(first + 1, second - first - 1)), trim(line.substr(second + 1)), lineNumber, report);
+        return true;
+    }
+
+    bool parseJsonLine(const string &line, size_t lineNumber, ImportReport &report)
+    {
+        try
+        {
+            json j = json::parse(line);
+            const json &servings = j.at("servings");
+            string quantity = servings.is_string() ? servings.get<string>() : servings.dump();
+            addRow(j.at("date").get<string>(), j.at("foodId").get<string>(), quantity, lineNumber, report);
+            return true;
+        }
+        catch (exception &)
+        {
+            return false;
+        }
+    }
+
+public:
+    LogImporter(const FoodManager &foodManager, LogManager &logManager, size_t batchSize = 65536)
+        : foodManager(foodManager), logManager(logManager), batchSize(batchSize)
+    {
+        pending.reserve(batchSize);
+        batch.reserve(batchSize);
+    }
+
+    // Resolves and appends the buffered rows
+    void flush(ImportReport &report)
+    {
+        for (const auto &row : pending)
+        {
+            if (resolved.find(row.foodId) == resolved.end())
+            {
+                resolved.emplace(row.foodId, ResolvedFood{foodManager.getFoodById(row.foodId),
+                                                          FoodIdTable::instance().intern(row.foodId)});
+            }
+        }
+
+        string error;
+        for (const auto &row : pending)
+        {
+            const auto &match = resolved[row.foodId];
+            if (!match.food)
+            {
+                report.unresolved[row.foodId]++;
+                continue;
+            }
+
+            Servings servings;
+            if (!FoodManager::parseQuantity(match.food.get(), row.quantity, servings, error))
+            {
+                noteMalformed(row.line, report);
+                continue;
+            }
+
+            batch.emplace_back(row.day, LogEntry(match.handle, servings));
+        }
+
+        report.imported += batch.size();
+        logManager.appendEntries(batch);
+        pending.clear();
+        batch.clear();
+    }
+
+    // Imports a whole stream. JSON Lines is detected by a leading '{'.
+    ImportReport importStream(istream &input)
+    {
+        ImportReport report;
+        string line;
+        size_t lineNumber = 0;
+        int format = 0; // 0 = undecided, 1 = CSV, 2 = JSON Lines
+
+        while (getline(input, line))
+        {
+            lineNumber++;
+            if (line.find_first_not_of(" \t\r") == string::npos)
+            {
+                continue;
+            }
+            if (format == 0)
+            {
+                format = (line[line.find_first_not_of(" \t")] == '{') ? 2 : 1;
+                if (format == 1 && trim(line.substr(0, line.find(','))) == "date")
+                {
+                    continue; // CSV header row
+                }
+            }
+
+            report.rowsRead++;
+            bool parsed = (format == 2) ? parseJsonLine(line, lineNumber, report)
+                                        : parseCsvLine(line, lineNumber, report);
+            if (!parsed)
+            {
+                noteMalformed(lineNumber, report);
+            }
+        }
+
+        flush(report);
+        return report;
+    }
+
+    ImportReport importFile(const string &path, bool &opened)
+    {
+        ifstream file(path);
+        opened = file.is_open();
+        if (!opened)
+        {
+            return ImportReport();
+        }
+        return importStream(file);
+    }
+};
+
+#endif
@@ -2,97 +2,394 @@
 #define LOG_CPP
 
 #include "food.cpp"
+#include "date.cpp"
+#include "rollup.cpp"
+#include "pmap.cpp"
+#include "storage.cpp"
+#include <climits>
 #include <ctime>
-#include <stack>
 using namespace std;
 
 // Log Entry class
 class LogEntry
 {
 private:
-    string foodId;
-    int servings;
+    FoodHandle food;
+    Servings servings;
 
 public:
-    LogEntry() : foodId(""), servings(0) {}
-    LogEntry(const string &foodId, int servings)
-        : foodId(foodId), servings(servings) {}
+    LogEntry() : food(FoodIdTable::instance().intern("")), servings() {}
+    LogEntry(const string &foodId, Servings servings)
+        : food(FoodIdTable::instance().intern(foodId)), servings(servings) {}
+    LogEntry(FoodHandle food, Servings servings)
+        : food(food), servings(servings) {}
 
-    string getFoodId() const { return foodId; }
-    int getServings() const { return servings; }
-    void addServings(int additionalServings) { servings += additionalServings; }
+    const string &getFoodId() const { return FoodIdTable::instance().idOf(food); }
+    FoodHandle getFoodHandle() const { return food; }
+    Servings getServings() const { return servings; }
+    void addServings(Servings additionalServings) { servings += additionalServings; }
 
     json toJson() const
     {
         json j;
-        j["foodId"] = foodId;
-        j["servings"] = servings;
+        j["foodId"] = getFoodId();
+        j["servings"] = servings.toJson();
         return j;
     }
 
     static LogEntry fromJson(const json &j)
     {
-        return LogEntry(j["foodId"].get<string>(), j["servings"].get<int>());
+        return LogEntry(j["foodId"].get<string>(), Servings::fromJson(j["servings"]));
     }
 
-    double getTotalCalories(const FoodManager &foodManager) const
+    Nutrients getTotalNutrients(const FoodManager::View &catalog) const
     {
-        auto food = foodManager.getFoodById(foodId);
-        if (food)
+        if (const Food *food = catalog.find(getFoodId()))
         {
-            return food->getCaloriesPerServing() * servings;
+            return food->getNutrientsPerServing().scaled(servings);
         }
-        return 0.0;
+        return Nutrients();
+    }
+
+    Nutrients getTotalNutrients(const FoodManager &foodManager) const
+    {
+        return getTotalNutrients(foodManager.read());
     }
+
+    double getTotalCalories(const FoodManager &foodManager) const
+    {
+        return getTotalNutrients(foodManager).calories.toDouble();
+    }
+};
+
+// One undoable log mutation. Records are fixed-size and refer to foods by
+// handle, so the history needs no per-command allocation.
+struct CommandRecord
+{
+    enum Type : uint8_t
+    {
+        AddFood = 1,    // servings of food were added to day
+        RemoveEntry = 2 // the entry for food (holding servings) was removed from day
+    };
+
+    Type type;
+    int32_t day;
+    FoodHandle food;
+    int64_t servings;    // Fixed-point thousandths
+    uint32_t slot = 0;   // RemoveEntry: the entry's position in its day, restored by undo
+    bool linked = false; // Undone and redone together with the record before it
 };
 
-// Command interface for undo functionality
-class Command
+// Bounded undo/redo history kept in a ring buffer. Records before the cursor
+// can be undone, records from the cursor on can be redone; pushing a new
+// record discards the redo tail, and once full the oldest group of linked
+// records is dropped.
+class UndoHistory
 {
+private:
+    vector<CommandRecord> ring; // Grows up to capacity, then wraps
+    size_t capacity;
+    size_t start = 0;  // Position of the oldest record
+    size_t count = 0;  // Records held
+    size_t cursor = 0; // Records currently applied
+
+    CommandRecord &at(size_t offset)
+    {
+        return ring[(start + offset) % capacity];
+    }
+
 public:
-    virtual ~Command() = default;
-    virtual void execute() = 0;
-    virtual void undo() = 0;
+    UndoHistory(size_t capacity = 100) : capacity(capacity) {}
+
+    size_t getCapacity() const { return capacity; }
+    size_t size() const { return count; }
+    size_t getCursor() const { return cursor; }
+    bool canUndo() const { return cursor > 0; }
+    bool canRedo() const { return cursor < count; }
+
+    void push(const CommandRecord &record)
+    {
+        if (capacity == 0)
+        {
+            return;
+        }
+
+        count = cursor;
+        if (count == capacity)
+        {
+            do
+            {
+                start = (start + 1) % capacity;
+                count--;
+            } while (count > 0 && at(0).linked);
+        }
+
+        size_t position = (start + count) % capacity;
+        if (position == ring.size())
+        {
+            ring.push_back(record);
+        }
+        else
+        {
+            ring[position] = record;
+        }
+        if (count == 0)
+        {
+            ring[position].linked = false; // Its group was too large to keep
+        }
+        count++;
+        cursor = count;
+    }
+
+    const CommandRecord &undo()
+    {
+        cursor--;
+        return at(cursor);
+    }
+
+    const CommandRecord &redo()
+    {
+        return at(cursor++);
+    }
+
+    // The record redo() would return next
+    const CommandRecord &peekRedo() const
+    {
+        return get(cursor);
+    }
+
+    // Record at the given age, 0 being the oldest held
+    const CommandRecord &get(size_t offset) const
+    {
+        return ring[(start + offset) % capacity];
+    }
+
+    void clear()
+    {
+        ring.clear();
+        start = count = cursor = 0;
+    }
+
+    // Changes the depth, keeping the newest records
+    void setCapacity(size_t newCapacity)
+    {
+        vector<CommandRecord> kept;
+        size_t skip = (count > newCapacity) ? count - newCapacity : 0;
+        for (size_t i = skip; i < count; ++i)
+        {
+            kept.push_back(get(i));
+        }
+        while (!kept.empty() && kept.front().linked)
+        {
+            kept.erase(kept.begin()); // Never keep half of a group
+            skip++;
+        }
+
+        size_t newCursor = (cursor > skip) ? cursor - skip : 0;
+        ring = move(kept);
+        capacity = newCapacity;
+        start = 0;
+        count = ring.size();
+        cursor = newCursor;
+    }
+
+    void setCursor(size_t newCursor)
+    {
+        cursor = min(newCursor, count);
+    }
 };
 
 // Daily Log class
 class DailyLog
 {
 private:
-    vector<LogEntry> entries;
+    vector<LogEntry> entries;                // In display order
+    unordered_map<FoodHandle, size_t> slots; // Food handle to position in entries
+
+    // Running totals, maintained by the mutators and stamped with the food
+    // database epoch they were computed at (0 means not computed)
+    mutable Nutrients totals;
+    mutable uint64_t totalsEpoch = 0;
+
+    // Brings the totals up to the current epoch so a mutation can apply its
+    // delta. Returns false while they have never been computed.
+    bool syncTotals(const FoodManager &foodManager) const
+    {
+        if (totalsEpoch == 0)
+        {
+            return false;
+        }
+        getTotalNutrients(foodManager);
+        return true;
+    }
+
+    size_t findEntry(FoodHandle food) const
+    {
+        auto it = slots.find(food);
+        return it != slots.end() ? it->second : entries.size();
+    }
+
+    // Merges servings into an existing entry for the same food, returning the
+    // entry's position
+    size_t mergeEntry(const LogEntry &entry)
+    {
+        size_t index = findEntry(entry.getFoodHandle());
+        if (index < entries.size())
+        {
+            entries[index].addServings(entry.getServings());
+            return index;
+        }
+        slots[entry.getFoodHandle()] = index;
+        entries.push_back(entry);
+        return index;
+    }
+
+    // Erases an entry and shifts the slots of the entries after it, keeping
+    // the display order. This is O(1) for the latest entry, the common case
+    // when undoing an add.
+    void eraseEntry(size_t index)
+    {
+        slots.erase(entries[index].getFoodHandle());
+        entries.erase(entries.begin() + index);
+        for (size_t i = index; i < entries.size(); ++i)
+        {
+            slots[entries[i].getFoodHandle()] = i;
+        }
+    }
 
 public:
     const vector<LogEntry> &getEntries() const { return entries; }
 
-    void addEntry(const LogEntry &entry)
+    // Position of the entry for a food, or the number of entries if absent
+    size_t indexOf(FoodHandle food) const { return findEntry(food); }
+
+    // Entry totals are subtracted and re-added whole rather than adjusted by
+    // the added servings, so the running sum always matches a recomputation
+    void addEntry(const LogEntry &entry, const FoodManager &foodManager)
     {
-        for (auto &existingEntry : entries)
+        bool current = syncTotals(foodManager);
+        size_t index = findEntry(entry.getFoodHandle());
+        if (current && index < entries.size())
         {
-            if (existingEntry.getFoodId() == entry.getFoodId())
+            totals -= entries[index].getTotalNutrients(foodManager);
+        }
+
+        index = mergeEntry(entry);
+        if (current)
+        {
+            totals += entries[index].getTotalNutrients(foodManager);
+        }
+    }
+
+    // Puts a removed entry back at its old position, shifting the entries
+    // after it the way eraseEntry does. Merges if the food is logged again.
+    void restoreEntry(const LogEntry &entry, size_t index, const FoodManager &foodManager)
+    {
+        if (findEntry(entry.getFoodHandle()) < entries.size())
+        {
+            addEntry(entry, foodManager);
+            return;
+        }
+
+        index = min(index, entries.size());
+        entries.insert(entries.begin() + index, entry);
+        for (size_t i = index; i < entries.size(); ++i)
+        {
+            slots[entries[i].getFoodHandle()] = i;
+        }
+        if (syncTotals(foodManager))
+        {
+            totals += entry.getTotalNutrients(foodManager);
+        }
+    }
+
+    void removeEntry(size_t index, const FoodManager &foodManager)
+    {
+        if (index < entries.size())
+        {
+            if (syncTotals(foodManager))
             {
-                existingEntry.addServings(entry.getServings());
-                return;
+                totals -= entries[index].getTotalNutrients(foodManager);
             }
+            eraseEntry(index);
         }
-        entries.push_back(entry);
     }
 
-    void removeEntry(size_t index)
+    // Takes servings back off an entry, dropping it once nothing is left
+    void removeServings(FoodHandle food, Servings servings, const FoodManager &foodManager)
     {
-        if (index < entries.size())
+        size_t index = findEntry(food);
+        if (index == entries.size())
         {
-            entries.erase(entries.begin() + index);
+            return;
+        }
+
+        bool current = syncTotals(foodManager);
+        if (current)
+        {
+            totals -= entries[index].getTotalNutrients(foodManager);
+        }
+
+        entries[index].addServings(-servings);
+        if (entries[index].getServings() <= Servings())
+        {
+            eraseEntry(index);
+        }
+        else if (current)
+        {
+            totals += entries[index].getTotalNutrients(foodManager);
         }
     }
 
-    double getTotalCalories(const FoodManager &foodManager) const
+    // O(1) while no referenced food has changed; otherwise the entries are
+    // checked once and the totals recomputed only if one of them did change.
+    // Everything is read from one catalog version, so the epoch stamped on
+    // the totals is the one they were computed at.
+    Nutrients getTotalNutrients(const FoodManager &foodManager) const
     {
-        double total = 0.0;
+        auto catalog = foodManager.read();
+        if (totalsEpoch != 0 && totalsEpoch == catalog.getNutrientEpoch())
+        {
+            return totals;
+        }
+
+        bool stale = (totalsEpoch == 0);
         for (const auto &entry : entries)
         {
-            total += entry.getTotalCalories(foodManager);
+            if (stale)
+            {
+                break;
+            }
+            stale = catalog.nutrientsChangedSince(entry.getFoodId(), totalsEpoch);
+        }
+
+        if (stale)
+        {
+            totals = Nutrients();
+            for (const auto &entry : entries)
+            {
+                totals += entry.getTotalNutrients(catalog);
+            }
         }
-        return total;
+        totalsEpoch = catalog.getNutrientEpoch();
+        return totals;
+    }
+
+    double getTotalCalories(const FoodManager &foodManager) const
+    {
+        return getTotalNutrients(foodManager).calories.toDouble();
+    }
+
+    // Bulk merge for imports: no per-entry totals bookkeeping, the totals are
+    // recomputed once on next access instead
+    void appendEntries(const LogEntry *first, const LogEntry *last)
+    {
+        entries.reserve(entries.size() + (last - first));
+        for (const LogEntry *entry = first; entry != last; ++entry)
+        {
+            mergeEntry(*entry);
+        }
+        totalsEpoch = 0;
     }
 
     json toJson() const
@@ -110,111 +407,379 @@ public:
         DailyLog log;
         for (const auto &entryJson : j)
         {
-            log.addEntry(LogEntry::fromJson(entryJson));
+            log.mergeEntry(LogEntry::fromJson(entryJson));
         }
         return log;
     }
 };
 
-// Add food command
-class AddFoodLogCommand : public Command
+// Daily logs keyed by day number in a persistent ordered map. Lookups and
+// inserts are O(log n), and copying a store is an O(1) snapshot that later
+// edits of the original do not affect, so a snapshot can be read on another
+// thread while the live store keeps changing.
+class LogStore
 {
 private:
-    map<string, DailyLog> &logs;
-    string date;
-    string foodId;
-    int servings;
+    PersistentMap<int, DailyLog> logs;
 
 public:
-    AddFoodLogCommand(map<string, DailyLog> &logs, const string &date, const string &foodId, int servings)
-        : logs(logs), date(date), foodId(foodId), servings(servings) {}
+    size_t size() const { return logs.size(); }
 
-    void execute() override
+    const DailyLog *find(int day) const { return logs.find(day); }
+    DailyLog *find(int day) { return logs.findMutable(day); }
+    DailyLog &getOrCreate(int day) { return logs.getOrCreate(day); }
+
+    // Adds empty logs for the given days (sorted, distinct) in one merge pass,
+    // instead of one insertion per day
+    void insertDays(const vector<int> &newDays)
     {
-        logs[date].addEntry(LogEntry(foodId, servings));
+        logs.insertKeys(newDays);
     }
 
-    void undo() override
+    // Visits the days in [fromDay, toDay] in ascending order
+    template <typename Visitor>
+    void forEachInRange(int fromDay, int toDay, Visitor visit) const
     {
-        auto &log = logs[date];
-        auto &entries = const_cast<vector<LogEntry> &>(log.getEntries());
+        logs.forEachInRange(fromDay, toDay, visit);
+    }
 
-        for (auto it = entries.begin(); it != entries.end(); ++it)
-        {
-            if (it->getFoodId() == foodId)
-            {
-                it->addServings(-servings); // Reduce servings
-                if (it->getServings() <= 0)
-                {
-                    entries.erase(it); // Remove entry if servings become zero
-                }
-                break;
-            }
-        }
+    template <typename Visitor>
+    void forEach(Visitor visit) const
+    {
+        logs.forEachInRange(INT_MIN, INT_MAX, visit);
     }
+
+    void clear() { logs.clear(); }
 };
 
-class RemoveFoodLogCommand : public Command
+// Log Manager class
+class LogManager
 {
 private:
-    map<string, DailyLog> &logs;
-    string date;
-    size_t index;
-    LogEntry removedEntry;
+    LogStore logs;
+    map<string, json> unparsedLogs; // Entries under keys that are not valid dates, kept as-is
+    UndoHistory history;
+    bool persistHistory = false; // Save the history next to the log file
+    int currentDay;
+    const FoodManager &foodManager; // Shared catalog, possibly used by several users
+    string logFile;
+    bool modified = false;
+    mutable NutrientRollup rollup;    // Per-day totals for range reports
+    mutable uint64_t rollupEpoch = 0; // Food epoch the rollup was built at, 0 if not built
 
-public:
-    RemoveFoodLogCommand(map<string, DailyLog> &logs, const string &date, size_t index)
-        : logs(logs), date(date), index(index)
+    // Days per block for the bulk operations run on the TaskScheduler
+    static constexpr size_t LOAD_GRAIN = 64;
+    static constexpr size_t ROLLUP_GRAIN = 256;
+
+    // Rebuilds the rollup when it is missing or a food's nutrients changed
+    void ensureRollup() const
     {
-        if (logs.find(date) != logs.end() && index < logs[date].getEntries().size())
+        // Read first: a food changed while rebuilding then triggers another rebuild
+        uint64_t epoch = foodManager.getNutrientEpoch();
+        if (rollupEpoch != 0 && rollupEpoch == epoch)
+        {
+            return;
+        }
+
+        // Days are totalled in parallel, then added to the rollup in order
+        vector<pair<int, const DailyLog *>> days;
+        logs.forEach([&](int day, const DailyLog &log)
+                     { days.emplace_back(day, &log); });
+        vector<Nutrients> totals(days.size());
+        TaskScheduler::instance().parallelFor(0, days.size(), ROLLUP_GRAIN, [&](size_t first, size_t last)
+                                              {
+            for (size_t i = first; i < last; ++i)
+            {
+                totals[i] = days[i].second->getTotalNutrients(foodManager);
+            } });
+
+        rollup.clear();
+        for (size_t i = 0; i < days.size(); ++i)
         {
-            removedEntry = logs[date].getEntries()[index];
+            rollup.set(days[i].first, totals[i], !days[i].second->getEntries().empty());
         }
+        rollupEpoch = epoch;
     }
 
-    void execute() override
+    // Pushes one day's new totals into the rollup after a mutation
+    void updateRollup(int day)
     {
-        if (logs.find(date) != logs.end())
+        if (rollupEpoch == 0)
+        {
+            return;
+        }
+        if (rollupEpoch != foodManager.getNutrientEpoch())
+        {
+            rollupEpoch = 0; // Other days may be stale too; rebuild on next query
+            return;
+        }
+
+        if (const DailyLog *log = logs.find(day))
         {
-            logs[date].removeEntry(index);
+            rollup.set(day, log->getTotalNutrients(foodManager), !log->getEntries().empty());
         }
     }
 
-    void undo() override
+    // Applies a record forwards (redo) or backwards (undo). Callers update the
+    // rollup for the record's day and set the modified flag.
+    void applyRecord(const CommandRecord &record, bool forwards)
     {
-        if (!removedEntry.getFoodId().empty())
+        Servings servings = Servings::fromMilli(record.servings);
+        bool adding = (record.type == CommandRecord::AddFood) == forwards;
+
+        if (adding && record.type == CommandRecord::RemoveEntry)
+        {
+            logs.getOrCreate(record.day).restoreEntry(LogEntry(record.food, servings), record.slot, foodManager);
+        }
+        else if (adding)
+        {
+            logs.getOrCreate(record.day).addEntry(LogEntry(record.food, servings), foodManager);
+        }
+        else if (DailyLog *log = logs.find(record.day))
         {
-            logs[date].addEntry(removedEntry); // Restore the removed entry
+            if (record.type == CommandRecord::AddFood)
+            {
+                log->removeServings(record.food, servings, foodManager);
+            }
+            else
+            {
+                log->removeEntry(log->indexOf(record.food), foodManager);
+            }
         }
     }
-};
 
-// Log Manager class
-class LogManager
-{
-private:
-    map<string, DailyLog> logs;
-    stack<shared_ptr<Command>> undoStack;
-    string currentDate;
-    FoodManager &foodManager;
-    bool modified = false;
+    // Applies records as one linked group and records it in the history
+    void applyGroup(const vector<CommandRecord> &records)
+    {
+        set<int> days;
+        for (size_t i = 0; i < records.size(); ++i)
+        {
+            CommandRecord record = records[i];
+            record.linked = i > 0;
+            if (record.type == CommandRecord::RemoveEntry)
+            {
+                const DailyLog *log = logs.find(record.day);
+                record.slot = static_cast<uint32_t>(log ? log->indexOf(record.food) : 0);
+            }
+            applyRecord(record, true);
+            history.push(record);
+            days.insert(record.day);
+        }
+
+        for (int day : days)
+        {
+            updateRollup(day);
+        }
+        modified = true;
+    }
+
+    string historyFile() const
+    {
+        string base = logFile;
+        if (base.size() >= 5 && base.compare(base.size() - 5, 5, ".json") == 0)
+        {
+            base.erase(base.size() - 5);
+        }
+        return base + ".history.json";
+    }
+
+    // A damaged history file is dropped: the logs themselves are loaded
+    // already, and only undo and redo are lost
+    void loadHistory()
+    {
+        history.clear();
+        ifstream file(historyFile());
+        if (!file.is_open())
+        {
+            return;
+        }
+
+        try
+        {
+            json j;
+            file >> j;
+            const json &records = j["records"];
+            size_t savedCursor = j.value("cursor", records.size());
+
+            // File positions of the records pushed, oldest first. The ring
+            // keeps the newest of them once the file holds more than the depth.
+            vector<size_t> pushed;
+            bool groupStarted = false; // A record of the current group was pushed
+            size_t position = 0;
+            int day;
+            for (const auto &recordJson : records)
+            {
+                size_t index = position++;
+                bool linked = recordJson.value("linked", false);
+                groupStarted = groupStarted && linked;
+                if (!Date::parse(recordJson["date"].get<string>(), day))
+                {
+                    continue;
+                }
+                CommandRecord record;
+                record.type = (recordJson["op"] == "add") ? CommandRecord::AddFood : CommandRecord::RemoveEntry;
+                record.day = day;
+                record.food = FoodIdTable::instance().intern(recordJson["foodId"].get<string>());
+                record.servings = Servings::fromJson(recordJson["servings"]).getMilli();
+                record.slot = recordJson.value("slot", UINT32_MAX); // Older files: restored at the end
+                record.linked = linked && groupStarted; // A group that lost its first records starts later
+                history.push(record);
+                pushed.push_back(index);
+                groupStarted = true;
+            }
+
+            // The saved cursor counts every record in the file; only the
+            // records still held that were applied count here
+            size_t cursor = 0;
+            for (size_t i = pushed.size() - history.size(); i < pushed.size(); ++i)
+            {
+                cursor += pushed[i] < savedCursor;
+            }
+            while (cursor > 0 && cursor < history.size() && history.get(cursor).linked)
+            {
+                cursor--; // Never inside a group
+            }
+            history.setCursor(cursor);
+        }
+        catch (const exception &)
+        {
+            history.clear();
+        }
+    }
+
+    static string renderHistory(const UndoHistory &history)
+    {
+        json records = json::array();
+        for (size_t i = 0; i < history.size(); ++i)
+        {
+            const CommandRecord &record = history.get(i);
+            json recordJson;
+            recordJson["op"] = (record.type == CommandRecord::AddFood) ? "add" : "remove";
+            recordJson["date"] = Date::format(record.day);
+            recordJson["foodId"] = FoodIdTable::instance().idOf(record.food);
+            recordJson["servings"] = Servings::fromMilli(record.servings).toJson();
+            if (record.type == CommandRecord::RemoveEntry)
+            {
+                recordJson["slot"] = record.slot;
+            }
+            if (record.linked)
+            {
+                recordJson["linked"] = true;
+            }
+            records.push_back(recordJson);
+        }
+
+        json j;
+        j["cursor"] = history.getCursor();
+        j["records"] = records;
+        return j.dump(2);
+    }
 
 public:
-    LogManager(FoodManager &foodManager) : foodManager(foodManager)
+    // Stages log changes and applies them together on commit, as a single
+    // undo step. A commit that fails validation changes nothing.
+    class Transaction
+    {
+    private:
+        LogManager &logManager;
+        vector<CommandRecord> staged; // Servings of removals are filled in on commit
+
+    public:
+        Transaction(LogManager &logManager) : logManager(logManager) {}
+
+        void addFood(const string &foodId, Servings servings)
+        {
+            addFood(foodId, servings, logManager.currentDay);
+        }
+
+        void addFood(const string &foodId, Servings servings, int day)
+        {
+            staged.push_back({CommandRecord::AddFood, day, FoodIdTable::instance().intern(foodId), servings.getMilli()});
+        }
+
+        // Removes the whole entry for a food
+        void removeFood(const string &foodId, int day)
+        {
+            staged.push_back({CommandRecord::RemoveEntry, day, FoodIdTable::instance().intern(foodId), 0});
+        }
+
+        size_t size() const { return staged.size(); }
+
+        bool commit(string &error)
+        {
+            // Replay the staged changes against the servings currently logged
+            // so that a failure is found before anything is applied
+            map<pair<int, FoodHandle>, int64_t> logged;
+            auto current = [&](const CommandRecord &record) -> int64_t &
+            {
+                auto key = make_pair(int(record.day), record.food);
+                auto it = logged.find(key);
+                if (it != logged.end())
+                {
+                    return it->second;
+                }
+                int64_t milli = 0;
+                if (const DailyLog *log = logManager.logs.find(record.day))
+                {
+                    size_t index = log->indexOf(record.food);
+                    if (index < log->getEntries().size())
+                    {
+                        milli = log->getEntries()[index].getServings().getMilli();
+                    }
+                }
+                return logged[key] = milli;
+            };
+
+            for (auto &record : staged)
+            {
+                const string &foodId = FoodIdTable::instance().idOf(record.food);
+                if (record.type == CommandRecord::AddFood)
+                {
+                    if (!logManager.foodManager.getFoodById(foodId))
+                    {
+                        error = "Food '" + foodId + "' not found.";
+                        return false;
+                    }
+                    if (record.servings <= 0)
+                    {
+                        error = "Servings for '" + foodId + "' must be positive.";
+                        return false;
+                    }
+                    current(record) += record.servings;
+                }
+                else
+                {
+                    int64_t &milli = current(record);
+                    if (milli == 0)
+                    {
+                        error = "No entry for '" + foodId + "' on " + Date::format(record.day) + ".";
+                        return false;
+                    }
+                    record.servings = milli;
+                    milli = 0;
+                }
+            }
+
+            logManager.applyGroup(staged);
+            staged.clear();
+            return true;
+        }
+
+        void rollback() { staged.clear(); }
+    };
+
+    LogManager(const FoodManager &foodManager, const string &logFile = "daily_logs.json")
+        : foodManager(foodManager), logFile(logFile)
     {
         // Initialize current date
-        time_t t = time(nullptr);
-        tm timeinfo = *localtime(&t);
-        char buffer[11];
-        strftime(buffer, sizeof(buffer), "%Y-%m-%d", &timeinfo);
-        currentDate = string(buffer);
+        Date::parse(Date::today(), currentDay);
     }
 
     bool loadLog()
     {
         try
         {
-            ifstream file("daily_logs.json");
+            ifstream file(logFile);
             if (!file.is_open())
             {
                 return false;
@@ -223,11 +788,38 @@ public:
             json j;
             file >> j;
 
+            // Days are parsed in parallel. JSON objects iterate their keys in
+            // sorted order, so each new day lands at the end of the store.
+            vector<pair<int, const json *>> days;
+            int day;
             for (const auto &[date, logJson] : j.items())
             {
-                logs[date] = DailyLog::fromJson(logJson);
+                if (Date::parse(date, day))
+                {
+                    days.emplace_back(day, &logJson);
+                }
+                else
+                {
+                    unparsedLogs[date] = logJson;
+                }
+            }
+            vector<DailyLog> parsed(days.size());
+            TaskScheduler::instance().parallelFor(0, days.size(), LOAD_GRAIN, [&](size_t first, size_t last)
+                                                  {
+                for (size_t i = first; i < last; ++i)
+                {
+                    parsed[i] = DailyLog::fromJson(*days[i].second);
+                } });
+            for (size_t i = 0; i < days.size(); ++i)
+            {
+                logs.getOrCreate(days[i].first) = move(parsed[i]);
             }
 
+            rollupEpoch = 0;
+            if (persistHistory)
+            {
+                loadHistory();
+            }
             modified = false;
             return true;
         }
@@ -238,77 +830,142 @@ public:
         }
     }
 
-    bool saveLog()
+    // Captures the logs (and the history, if it is kept) as they are now and
+    // clears the modified flag. The store is copied in O(1), so this is cheap
+    // enough to call after every change; the snapshots can be written from
+    // any thread.
+    vector<FileSnapshot> captureSave()
     {
-        try
+        modified = false;
+        vector<FileSnapshot> snapshots;
+        snapshots.push_back({logFile, [logs = logs, unparsed = unparsedLogs]
+                             {
+                                 json j;
+                                 for (const auto &[date, logJson] : unparsed)
+                                 {
+                                     j[date] = logJson;
+                                 }
+                                 logs.forEach([&](int day, const DailyLog &log)
+                                              { j[Date::format(day)] = log.toJson(); });
+                                 return j.dump(2);
+                             }});
+        if (persistHistory)
         {
-            json j;
-            for (const auto &[date, log] : logs)
-            {
-                j[date] = log.toJson();
-            }
+            snapshots.push_back({historyFile(), [history = history]
+                                 { return renderHistory(history); }});
+        }
+        return snapshots;
+    }
 
-            ofstream file("daily_logs.json");
-            file << j.dump(2);
+    // For callers that write captured snapshots themselves and failed to
+    void markModified() { modified = true; }
 
-            modified = false;
-            return true;
-        }
-        catch (exception &e)
+    bool saveLog()
+    {
+        string error;
+        if (!writeSnapshots(captureSave(), false, error))
         {
-            cerr << "Error saving log: " << e.what() << endl;
+            cerr << "Error saving log: " << error << endl;
+            modified = true;
             return false;
         }
+        return true;
     }
 
-    void setCurrentDate(const string &date)
+    bool setCurrentDate(const string &date)
     {
-        currentDate = date;
+        return Date::parse(date, currentDay);
     }
 
     string getCurrentDate() const
     {
-        return currentDate;
+        return Date::format(currentDay);
     }
 
-    void addFoodToLog(const string &foodId, int servings)
+    int getCurrentDay() const
     {
-        auto command = make_shared<AddFoodLogCommand>(logs, currentDate, foodId, servings);
-        command->execute();
-        undoStack.push(command);
-        modified = true;
+        return currentDay;
+    }
+
+    // Sets the undo depth and whether the history is saved with the log
+    void configureHistory(size_t depth, bool persist)
+    {
+        history.setCapacity(depth);
+        persistHistory = persist;
+    }
+
+    void addFoodToLog(const string &foodId, Servings servings)
+    {
+        applyGroup({{CommandRecord::AddFood, currentDay, FoodIdTable::instance().intern(foodId), servings.getMilli()}});
     }
 
     void removeFoodFromLog(size_t index)
     {
-        auto command = make_shared<RemoveFoodLogCommand>(logs, currentDate, index);
-        command->execute();
-        undoStack.push(command);
-        modified = true;
+        const DailyLog *log = logs.find(currentDay);
+        if (!log || index >= log->getEntries().size())
+        {
+            return;
+        }
+
+        const LogEntry &entry = log->getEntries()[index];
+        applyGroup({{CommandRecord::RemoveEntry, currentDay, entry.getFoodHandle(), entry.getServings().getMilli()}});
     }
 
-    void undo()
+    Transaction beginTransaction() { return Transaction(*this); }
+
+    // Returns false if there is nothing to undo
+    bool undo()
     {
-        if (!undoStack.empty())
+        if (history.canUndo())
         {
-            auto command = undoStack.top();
-            undoStack.pop();
-            command->undo();
+            set<int> days;
+            bool linked;
+            do
+            {
+                const CommandRecord &record = history.undo();
+                applyRecord(record, false);
+                days.insert(record.day);
+                linked = record.linked;
+            } while (linked && history.canUndo());
+
+            for (int day : days)
+            {
+                updateRollup(day);
+            }
             modified = true;
-            cout << "Last action undone.\n";
+            return true;
         }
-        else
+        return false;
+    }
+
+    // Returns false if there is nothing to redo
+    bool redo()
+    {
+        if (history.canRedo())
         {
-            cout << "Nothing to undo.\n";
+            set<int> days;
+            do
+            {
+                const CommandRecord &record = history.redo();
+                applyRecord(record, true);
+                days.insert(record.day);
+            } while (history.canRedo() && history.peekRedo().linked);
+
+            for (int day : days)
+            {
+                updateRollup(day);
+            }
+            modified = true;
+            return true;
         }
+        return false;
     }
 
     const DailyLog &getCurrentDayLog() const
     {
-        auto it = logs.find(currentDate);
-        if (it != logs.end())
+        if (const DailyLog *log = logs.find(currentDay))
         {
-            return it->second;
+            return *log;
         }
 
         // Return an empty log if not found
@@ -316,14 +973,18 @@ public:
         return emptyLog;
     }
 
-    double getTotalCaloriesForDay() const
+    Nutrients getTotalNutrientsForDay() const
     {
-        auto it = logs.find(currentDate);
-        if (it != logs.end())
+        if (const DailyLog *log = logs.find(currentDay))
         {
-            return it->second.getTotalCalories(foodManager);
+            return log->getTotalNutrients(foodManager);
         }
-        return 0.0;
+        return Nutrients();
+    }
+
+    double getTotalCaloriesForDay() const
+    {
+        return getTotalNutrientsForDay().calories.toDouble();
     }
 
     bool isModified() const
@@ -331,17 +992,79 @@ public:
         return modified;
     }
 
-    vector<string> getAllLogDates() const
+    // Appends a batch of (day, entry) pairs without undo bookkeeping, as used
+    // by bulk imports. The batch is sorted by day in place.
+    void appendEntries(vector<pair<int, LogEntry>> &batch)
     {
-        vector<string> dates;
-        for (const auto &[date, _] : logs)
+        if (batch.empty())
+        {
+            return;
+        }
+
+        stable_sort(batch.begin(), batch.end(),
+                    [](const pair<int, LogEntry> &a, const pair<int, LogEntry> &b)
+                    { return a.first < b.first; });
+
+        vector<int> newDays;
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            int day = batch[i].first;
+            if ((i == 0 || batch[i - 1].first != day) && !logs.find(day))
+            {
+                newDays.push_back(day);
+            }
+        }
+        if (!newDays.empty())
         {
-            dates.push_back(date);
+            logs.insertDays(newDays);
         }
-        // Sort dates in descending order (newest first)
-        sort(dates.begin(), dates.end(), greater<string>());
+
+        vector<LogEntry> dayEntries;
+        for (size_t i = 0; i < batch.size();)
+        {
+            int day = batch[i].first;
+            dayEntries.clear();
+            for (; i < batch.size() && batch[i].first == day; ++i)
+            {
+                dayEntries.push_back(batch[i].second);
+            }
+            logs.find(day)->appendEntries(dayEntries.data(), dayEntries.data() + dayEntries.size());
+        }
+
+        rollupEpoch = 0;
+        modified = true;
+    }
+
+    // Totals over the inclusive range of day numbers, in O(log n)
+    RangeTotals summarizeRange(int fromDay, int toDay) const
+    {
+        ensureRollup();
+        return rollup.query(fromDay, toDay);
+    }
+
+    // Visits each logged day in [fromDay, toDay] in ascending order
+    template <typename Visitor>
+    void forEachDayInRange(int fromDay, int toDay, Visitor visit) const
+    {
+        logs.forEachInRange(fromDay, toDay, visit);
+    }
+
+    // O(1) copy of all logs as they are now, unaffected by later changes
+    LogStore snapshot() const
+    {
+        return logs;
+    }
+
+    vector<string> getAllLogDates() const
+    {
+        // Newest first; the store is already sorted oldest first
+        vector<string> dates;
+        dates.reserve(logs.size());
+        logs.forEach([&](int day, const DailyLog &)
+                     { dates.push_back(Date::format(day)); });
+        reverse(dates.begin(), dates.end());
         return dates;
     }
 };
 
-#endif
\ No newline at end of file
+#endif
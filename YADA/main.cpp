@@ -1,13 +1,239 @@
 #include "cli.cpp"
+#include "server.cpp"
+#include "batch.cpp"
+#include "rpc.cpp"
+#include "rpcbench.cpp"
 using namespace std;
 
-int main()
+int main(int argc, char *argv[])
 {
+    string user = UserManager::DEFAULT_USER;
+    string importPath, exportPath;
+    bool exportLog = true;
+    size_t historyDepth = 100;
+    bool persistHistory = false;
+    string batchPath;
+    bool serve = false;
+    string serveAddress = "127.0.0.1";
+    int servePort = 8080;
+    string rpcPath;
+    RpcBenchOptions bench;
+    string publishCatalog, sharedCatalog, unpublishCatalog;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "--user" && i + 1 < argc)
+        {
+            user = argv[++i];
+        }
+        else if (arg == "--import" && i + 1 < argc)
+        {
+            importPath = argv[++i];
+        }
+        else if (arg == "--history-depth" && i + 1 < argc)
+        {
+            historyDepth = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--batch" && i + 1 < argc)
+        {
+            batchPath = argv[++i];
+        }
+        else if (arg == "--serve")
+        {
+            serve = true;
+        }
+        else if (arg == "--port" && i + 1 < argc)
+        {
+            servePort = atoi(argv[++i]);
+        }
+        else if (arg == "--address" && i + 1 < argc)
+        {
+            serveAddress = argv[++i];
+        }
+        else if (arg == "--rpc" && i + 1 < argc)
+        {
+            rpcPath = argv[++i];
+        }
+        else if (arg == "--rpc-bench" && i + 1 < argc)
+        {
+            bench.socketPath = argv[++i];
+        }
+        else if (arg == "--bench-mode" && i + 1 < argc)
+        {
+            bench.mode = argv[++i];
+        }
+        else if (arg == "--bench-clients" && i + 1 < argc)
+        {
+            bench.clients = atoi(argv[++i]);
+        }
+        else if (arg == "--bench-frames" && i + 1 < argc)
+        {
+            bench.frames = atoi(argv[++i]);
+        }
+        else if (arg == "--bench-batch" && i + 1 < argc)
+        {
+            bench.batchSize = atoi(argv[++i]);
+        }
+        else if (arg == "--bench-pipeline" && i + 1 < argc)
+        {
+            bench.pipeline = atoi(argv[++i]);
+        }
+        else if (arg == "--bench-atomic")
+        {
+            bench.atomic = true;
+        }
+        else if (arg == "--workers" && i + 1 < argc)
+        {
+            TaskScheduler::setWorkerCount(strtoul(argv[++i], nullptr, 10));
+        }
+        else if (arg == "--pin-workers")
+        {
+            TaskScheduler::setPinning(true);
+        }
+        else if (arg == "--publish-catalog" && i + 1 < argc)
+        {
+            publishCatalog = argv[++i];
+        }
+        else if (arg == "--shared-catalog" && i + 1 < argc)
+        {
+            sharedCatalog = argv[++i];
+        }
+        else if (arg == "--unpublish-catalog" && i + 1 < argc)
+        {
+            unpublishCatalog = argv[++i];
+        }
+        else if (arg == "--persist-history")
+        {
+            persistHistory = true;
+        }
+        else if ((arg == "--export-log" || arg == "--export-foods") && i + 1 < argc)
+        {
+            exportLog = (arg == "--export-log");
+            exportPath = argv[++i];
+        }
+    }
+
+    if (!UserManager::isValidName(user))
+    {
+        cerr << "Invalid user name: " << user << "\n";
+        return 1;
+    }
+
+    // A client of another process; nothing is loaded here
+    if (!bench.socketPath.empty())
+    {
+        return RpcBench(bench).run(cout) ? 0 : 1;
+    }
+
+    for (const string *name : {&publishCatalog, &sharedCatalog, &unpublishCatalog})
+    {
+        if (!name->empty() && !SharedCatalog::isValidName(*name))
+        {
+            cerr << "Invalid shared catalog name: " << *name << "\n";
+            return 1;
+        }
+    }
+
+    string error;
+    if (!unpublishCatalog.empty())
+    {
+        if (!SharedCatalog::remove(unpublishCatalog, error))
+        {
+            cerr << error << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
     auto basicFoodFactory = make_shared<JsonBasicFoodFactory>();
     FoodManager foodManager(basicFoodFactory);
-    LogManager logManager(foodManager);
-    ProfileManager profileManager;
+    UserManager userManager(foodManager);
+    userManager.setHistoryOptions(historyDepth, persistHistory);
+
+    // Publishes the food database for other processes and exits; run it
+    // again to publish changes
+    if (!publishCatalog.empty())
+    {
+        if (!foodManager.loadDatabase())
+        {
+            cerr << "Warning: food database not found, publishing it empty\n";
+        }
+        uint64_t generation = foodManager.publishShared(publishCatalog, error);
+        if (generation == 0)
+        {
+            cerr << error << "\n";
+            return 1;
+        }
+        cout << "Published shared catalog " << publishCatalog << ", generation " << generation << endl;
+        return 0;
+    }
+
+    if (!sharedCatalog.empty() && !foodManager.attachShared(sharedCatalog, error))
+    {
+        cerr << error << "\n";
+        return 1;
+    }
+
+    if (!batchPath.empty())
+    {
+        ios::sync_with_stdio(false);
+        foodManager.loadDatabase();
+        BatchRunner runner(foodManager, userManager, user);
+        if (batchPath == "-")
+        {
+            return runner.run(cin) ? 0 : 1;
+        }
+        ifstream script(batchPath);
+        if (!script.is_open())
+        {
+            cerr << "Cannot open " << batchPath << "\n";
+            return 1;
+        }
+        return runner.run(script) ? 0 : 1;
+    }
+
+    if (!rpcPath.empty())
+    {
+        if (!foodManager.loadDatabase())
+        {
+            cerr << "Warning: food database not found, starting empty\n";
+        }
+        RpcServer server(foodManager, userManager, user);
+        if (!server.listenUnix(rpcPath, error))
+        {
+            cerr << error << "\n";
+            return 1;
+        }
+        cout << "Serving RPC on " << rpcPath << endl;
+        server.run();
+        return 0;
+    }
+
+    if (serve)
+    {
+        if (!foodManager.loadDatabase())
+        {
+            cerr << "Warning: food database not found, starting empty\n";
+        }
+        HttpServer server(foodManager, userManager, user);
+        if (!server.listen(serveAddress, servePort, error))
+        {
+            cerr << error << "\n";
+            return 1;
+        }
+        cout << "Serving on http://" << serveAddress << ":" << server.getPort() << "/" << endl;
+        server.run();
+        return 0;
+    }
 
-    CLI cli(foodManager, logManager, profileManager);
+    CLI cli(foodManager, userManager, user);
+    if (!importPath.empty())
+    {
+        return cli.runImport(importPath) ? 0 : 1;
+    }
+    if (!exportPath.empty())
+    {
+        return cli.runExport(exportPath, exportLog) ? 0 : 1;
+    }
     cli.run();
-}
\ No newline at end of file
+}
@@ -0,0 +1,276 @@
+#ifndef PMAP_CPP
+#define PMAP_CPP
+
+#include <memory>
+#include <vector>
+#include <utility>
+#include <algorithm>
+using namespace std;
+
+// Ordered map with structural sharing: copying one is O(1) and the copies
+// then evolve independently. A write copies only the nodes on the path to
+// the key that are shared with another copy (and the value itself if a copy
+// still refers to it); nodes owned by one map alone are updated in place,
+// so a map that is never copied behaves like an ordinary AVL tree.
+//
+// A copy handed to another thread may be read there while this one is
+// modified, as long as the reader does not copy or modify it.
+template <typename Key, typename Value>
+class PersistentMap
+{
+private:
+    struct Node
+    {
+        Key key;
+        shared_ptr<Value> value;
+        shared_ptr<Node> left, right;
+        int height = 1;
+        size_t size = 1;
+    };
+    using NodePtr = shared_ptr<Node>;
+
+    NodePtr root;
+
+    static int height(const NodePtr &node) { return node ? node->height : 0; }
+    static size_t count(const NodePtr &node) { return node ? node->size : 0; }
+
+    static void update(Node &node)
+    {
+        node.height = 1 + max(height(node.left), height(node.right));
+        node.size = 1 + count(node.left) + count(node.right);
+    }
+
+    // Makes the node in the slot private to this map, copying it if another
+    // map shares it. The copy shares the children and the value.
+    static Node &own(NodePtr &slot)
+    {
+        if (slot.use_count() != 1)
+        {
+            slot = make_shared<Node>(*slot);
+        }
+        return *slot;
+    }
+
+    static void rotateRight(NodePtr &slot)
+    {
+        Node &node = own(slot);
+        own(node.left);
+        NodePtr pivot = node.left;
+        node.left = pivot->right;
+        update(node);
+        pivot->right = slot;
+        update(*pivot);
+        slot = pivot;
+    }
+
+    static void rotateLeft(NodePtr &slot)
+    {
+        Node &node = own(slot);
+        own(node.right);
+        NodePtr pivot = node.right;
+        node.right = pivot->left;
+        update(node);
+        pivot->left = slot;
+        update(*pivot);
+        slot = pivot;
+    }
+
+    // Restores the AVL invariant at an owned node after an insertion below
+    static void rebalance(NodePtr &slot)
+    {
+        Node &node = *slot;
+        update(node);
+        int balance = height(node.left) - height(node.right);
+        if (balance > 1)
+        {
+            if (height(node.left->left) < height(node.left->right))
+            {
+                rotateLeft(node.left);
+            }
+            rotateRight(slot);
+        }
+        else if (balance < -1)
+        {
+            if (height(node.right->right) < height(node.right->left))
+            {
+                rotateRight(node.right);
+            }
+            rotateLeft(slot);
+        }
+    }
+
+    // Returns the private value for key, inserting a default one if absent.
+    // Rotations move nodes but not values, so the reference stays valid.
+    static Value &findOrInsert(NodePtr &slot, const Key &key)
+    {
+        if (!slot)
+        {
+            slot = make_shared<Node>();
+            slot->key = key;
+            slot->value = make_shared<Value>();
+            return *slot->value;
+        }
+
+        Node &node = own(slot);
+        if (key < node.key || node.key < key)
+        {
+            size_t before = count(key < node.key ? node.left : node.right);
+            Value &value = findOrInsert(key < node.key ? node.left : node.right, key);
+            if (count(key < node.key ? node.left : node.right) != before)
+            {
+                rebalance(slot);
+            }
+            return value;
+        }
+
+        if (node.value.use_count() != 1)
+        {
+            node.value = make_shared<Value>(*node.value);
+        }
+        return *node.value;
+    }
+
+    // Balanced tree over entries [first, last) of a sorted run
+    static NodePtr build(vector<pair<Key, shared_ptr<Value>>> &items, size_t first, size_t last)
+    {
+        if (first == last)
+        {
+            return nullptr;
+        }
+        size_t middle = first + (last - first) / 2;
+        auto node = make_shared<Node>();
+        node->key = items[middle].first;
+        node->value = move(items[middle].second);
+        node->left = build(items, first, middle);
+        node->right = build(items, middle + 1, last);
+        update(*node);
+        return node;
+    }
+
+    template <typename Visitor>
+    static void visitRange(const Node *node, const Key &from, const Key &to, Visitor &visit)
+    {
+        while (node)
+        {
+            if (node->key < from)
+            {
+                node = node->right.get();
+            }
+            else if (to < node->key)
+            {
+                node = node->left.get();
+            }
+            else
+            {
+                visitRange(node->left.get(), from, to, visit);
+                visit(node->key, static_cast<const Value &>(*node->value));
+                node = node->right.get();
+            }
+        }
+    }
+
+    template <typename Visitor>
+    static void visitAll(const Node *node, Visitor &visit)
+    {
+        while (node)
+        {
+            visitAll(node->left.get(), visit);
+            visit(node->key, static_cast<const Value &>(*node->value));
+            node = node->right.get();
+        }
+    }
+
+    static void collect(const NodePtr &node, vector<pair<Key, shared_ptr<Value>>> &items)
+    {
+        if (node)
+        {
+            collect(node->left, items);
+            items.emplace_back(node->key, node->value);
+            collect(node->right, items);
+        }
+    }
+
+public:
+    size_t size() const { return count(root); }
+    bool empty() const { return !root; }
+
+    const Value *find(const Key &key) const
+    {
+        const Node *node = root.get();
+        while (node)
+        {
+            if (key < node->key)
+            {
+                node = node->left.get();
+            }
+            else if (node->key < key)
+            {
+                node = node->right.get();
+            }
+            else
+            {
+                return node->value.get();
+            }
+        }
+        return nullptr;
+    }
+
+    // Writable access to an existing value, or nullptr
+    Value *findMutable(const Key &key)
+    {
+        return find(key) ? &findOrInsert(root, key) : nullptr;
+    }
+
+    Value &getOrCreate(const Key &key)
+    {
+        return findOrInsert(root, key);
+    }
+
+    // Adds default values for the given keys (sorted, distinct) by merging
+    // them with the current contents and rebuilding the tree in O(n + k)
+    void insertKeys(const vector<Key> &keys)
+    {
+        vector<pair<Key, shared_ptr<Value>>> current, merged;
+        current.reserve(size());
+        collect(root, current);
+        merged.reserve(current.size() + keys.size());
+
+        size_t i = 0, j = 0;
+        while (i < current.size() || j < keys.size())
+        {
+            if (j == keys.size() || (i < current.size() && !(keys[j] < current[i].first)))
+            {
+                if (j < keys.size() && !(current[i].first < keys[j]))
+                {
+                    j++;
+                }
+                merged.push_back(move(current[i++]));
+            }
+            else
+            {
+                merged.emplace_back(keys[j++], make_shared<Value>());
+            }
+        }
+
+        current.clear();
+        root = build(merged, 0, merged.size());
+    }
+
+    // Visits the entries with keys in [from, to] in ascending order
+    template <typename Visitor>
+    void forEachInRange(const Key &from, const Key &to, Visitor visit) const
+    {
+        visitRange(root.get(), from, to, visit);
+    }
+
+    // Visits every entry in ascending key order
+    template <typename Visitor>
+    void forEach(Visitor visit) const
+    {
+        visitAll(root.get(), visit);
+    }
+
+    void clear() { root.reset(); }
+};
+
+#endif
@@ -2,90 +2,301 @@
 #define PROFILE_CPP
 
 #include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <variant>
+#include <algorithm>
+#include <climits>
 #include "json.hpp"
+#include "date.cpp"
+#include "formula.cpp"
+#include "storage.cpp"
 #include <fstream>
 #include <iostream>
 using namespace std;
 
 using json = nlohmann::json;
 
+enum class Gender : uint8_t
+{
+    Female = 0,
+    Male = 1
+};
 
-// User Profile class
-class CalorieCalculationStrategy
+enum class ActivityLevel : uint8_t
 {
-public:
-    virtual ~CalorieCalculationStrategy() = default;
-    virtual double calculateCalories(const string &gender, double height, int age, double weight, const string &activityLevel) const = 0;
+    Sedentary = 0,
+    Light = 1,
+    Moderate = 2,
+    Active = 3,
+    VeryActive = 4
 };
 
-class HarrisBenedictStrategy : public CalorieCalculationStrategy
+// Anything but "male" is calculated with the female constants
+inline Gender parseGender(const string &gender)
 {
-public:
-    double calculateCalories(const string &gender, double height, int age, double weight, const string &activityLevel) const override
+    return gender == "male" ? Gender::Male : Gender::Female;
+}
+
+constexpr size_t ACTIVITY_LEVEL_COUNT = 5;
+
+// Indexed by ActivityLevel
+constexpr const char *ACTIVITY_LEVEL_NAMES[ACTIVITY_LEVEL_COUNT] = {"sedentary", "light", "moderate", "active", "very active"};
+constexpr double ACTIVITY_FACTORS[ACTIVITY_LEVEL_COUNT] = {1.2, 1.375, 1.55, 1.725, 1.9};
+
+// Unknown levels count as sedentary
+inline ActivityLevel parseActivityLevel(const string &activityLevel)
+{
+    for (size_t level = 1; level < ACTIVITY_LEVEL_COUNT; ++level)
     {
-        double bmr = 0.0;
-        if (gender == "male")
+        if (activityLevel == ACTIVITY_LEVEL_NAMES[level])
         {
-            bmr = 88.362 + (13.397 * weight) + (4.799 * height) - (5.677 * age);
+            return static_cast<ActivityLevel>(level);
         }
-        else
+    }
+    return ActivityLevel::Sedentary;
+}
+
+// Branch-free choice between two doubles by masking their bit patterns.
+// Plain ?: chains over constants become branches or table loads that stop
+// the batch loops from vectorizing; this compiles to vector and/or on any
+// x86-64 target and returns exactly one of the two inputs.
+inline double selectValue(bool condition, double ifTrue, double ifFalse)
+{
+    uint64_t trueBits, falseBits;
+    memcpy(&trueBits, &ifTrue, sizeof(double));
+    memcpy(&falseBits, &ifFalse, sizeof(double));
+    uint64_t mask = -static_cast<uint64_t>(condition);
+    uint64_t bits = (trueBits & mask) | (falseBits & ~mask);
+    double result;
+    memcpy(&result, &bits, sizeof(double));
+    return result;
+}
+
+// One select per table entry rather than a table load; see selectValue
+inline double activityFactor(ActivityLevel level)
+{
+    double factor = ACTIVITY_FACTORS[0];
+    for (size_t other = 1; other < ACTIVITY_LEVEL_COUNT; ++other)
+    {
+        factor = selectValue(static_cast<size_t>(level) == other, ACTIVITY_FACTORS[other], factor);
+    }
+    return factor;
+}
+
+// Struct-of-arrays profile columns for evaluating many profiles at once.
+// Gender and activity level hold Gender and ActivityLevel values as bytes;
+// GCC does not vectorize loads of enum-typed elements.
+struct ProfileColumns
+{
+    vector<uint8_t> gender;
+    vector<double> height; // in cm
+    vector<int> age;
+    vector<double> weight; // in kg
+    vector<uint8_t> activityLevel;
+    vector<double> bodyFat; // percent, 0 if unknown
+
+    size_t size() const { return height.size(); }
+
+    void reserve(size_t count)
+    {
+        gender.reserve(count);
+        height.reserve(count);
+        age.reserve(count);
+        weight.reserve(count);
+        activityLevel.reserve(count);
+        bodyFat.reserve(count);
+    }
+
+    void add(const string &g, double h, int a, double w, const string &al, double bf = 0)
+    {
+        gender.push_back(static_cast<uint8_t>(parseGender(g)));
+        height.push_back(h);
+        age.push_back(a);
+        weight.push_back(w);
+        activityLevel.push_back(static_cast<uint8_t>(parseActivityLevel(al)));
+        bodyFat.push_back(bf);
+    }
+};
+
+// Calorie strategies. Each formula is written once as an inline kernel over
+// one profile; the scalar call and the batch loop both evaluate it with the
+// same operations in the same order, so their results are bit-for-bit equal.
+// Built with -O3 (see the readme), the batch loops vectorize.
+//
+// A strategy derives from CalorieFormula<itself> and supplies a stable id,
+// which is what the profile file stores, and a static kernel.
+template <typename Formula>
+struct CalorieFormula
+{
+    double calculateCalories(const string &gender, double height, int age, double weight, const string &activityLevel,
+                             double /* bodyFat */ = 0) const
+    {
+        return Formula::kernel(parseGender(gender), height, age, weight, parseActivityLevel(activityLevel));
+    }
+
+    // Writes one target per profile to out[0, profiles.size())
+    void calculateBatch(const ProfileColumns &profiles, double *out) const
+    {
+        const uint8_t *gender = profiles.gender.data();
+        const double *height = profiles.height.data();
+        const int *age = profiles.age.data();
+        const double *weight = profiles.weight.data();
+        const uint8_t *activityLevel = profiles.activityLevel.data();
+        size_t count = profiles.size();
+        for (size_t i = 0; i < count; ++i)
         {
-            bmr = 447.593 + (9.247 * weight) + (3.098 * height) - (4.330 * age);
+            out[i] = Formula::kernel(static_cast<Gender>(gender[i]), height[i], age[i], weight[i],
+                                     static_cast<ActivityLevel>(activityLevel[i]));
         }
+    }
+};
+
+struct HarrisBenedictStrategy : CalorieFormula<HarrisBenedictStrategy>
+{
+    static constexpr const char *id = "harris-benedict";
 
-        double activityFactor = getActivityFactor(activityLevel);
-        return bmr * activityFactor;
+    static double kernel(Gender gender, double height, int age, double weight, ActivityLevel activityLevel)
+    {
+        bool male = gender == Gender::Male;
+        double bmr = selectValue(male, 88.362, 447.593) + (selectValue(male, 13.397, 9.247) * weight) +
+                     (selectValue(male, 4.799, 3.098) * height) - (selectValue(male, 5.677, 4.330) * age);
+        return bmr * activityFactor(activityLevel);
     }
+};
 
-private:
-    double getActivityFactor(const string &activityLevel) const
-    {
-        if (activityLevel == "light")
-            return 1.375;
-        else if (activityLevel == "moderate")
-            return 1.55;
-        else if (activityLevel == "active")
-            return 1.725;
-        else if (activityLevel == "very active")
-            return 1.9;
-        return 1.2; // Default: sedentary
+struct MifflinStJeorStrategy : CalorieFormula<MifflinStJeorStrategy>
+{
+    static constexpr const char *id = "mifflin-st-jeor";
+
+    static double kernel(Gender gender, double height, int age, double weight, ActivityLevel activityLevel)
+    {
+        double bmr = (10 * weight) + (6.25 * height) - (5 * age) + selectValue(gender == Gender::Male, 5, -161);
+        return bmr * activityFactor(activityLevel);
     }
 };
 
-class MifflinStJeorStrategy : public CalorieCalculationStrategy
+// A user-defined BMR formula over weight, height, age, male (1 or 0) and
+// bodyFat, compiled once; the target is its value times the activity factor.
+// Batches are evaluated a block of rows per instruction (see FormulaProgram).
+struct FormulaStrategy
 {
-public:
-    double calculateCalories(const string &gender, double height, int age, double weight, const string &activityLevel) const override
+    static constexpr const char *id = "formula";
+
+    shared_ptr<const FormulaProgram> program; // Immutable once compiled, so copies share it
+    string source;
+
+    bool compile(const string &formula, string &error)
     {
-        double bmr = 0.0;
-        if (gender == "male")
+        auto compiled = make_shared<FormulaProgram>();
+        if (!compiled->compile(formula, error))
         {
-            bmr = (10 * weight) + (6.25 * height) - (5 * age) + 5;
+            return false;
         }
-        else
+        program = compiled;
+        source = formula;
+        return true;
+    }
+
+    double calculateCalories(const string &gender, double height, int age, double weight, const string &activityLevel,
+                             double bodyFat = 0) const
+    {
+        if (!program)
         {
-            bmr = (10 * weight) + (6.25 * height) - (5 * age) - 161;
+            return 0.0;
         }
-
-        double activityFactor = getActivityFactor(activityLevel);
-        return bmr * activityFactor;
+        double variables[] = {weight, height, static_cast<double>(age), parseGender(gender) == Gender::Male ? 1.0 : 0.0, bodyFat};
+        return program->evaluate(variables) * activityFactor(parseActivityLevel(activityLevel));
     }
 
-private:
-    double getActivityFactor(const string &activityLevel) const
-    {
-        if (activityLevel == "light")
-            return 1.375;
-        else if (activityLevel == "moderate")
-            return 1.55;
-        else if (activityLevel == "active")
-            return 1.725;
-        else if (activityLevel == "very active")
-            return 1.9;
-        return 1.2; // Default: sedentary
+    void calculateBatch(const ProfileColumns &profiles, double *out) const
+    {
+        size_t count = profiles.size();
+        if (!program)
+        {
+            fill(out, out + count, 0.0);
+            return;
+        }
+
+        constexpr size_t BLOCK = FormulaProgram::BLOCK;
+        vector<double> scratch(program->getDepth() * BLOCK);
+        double age[BLOCK], male[BLOCK];
+        for (size_t first = 0; first < count; first += BLOCK)
+        {
+            size_t rows = min(BLOCK, count - first);
+            for (size_t i = 0; i < rows; ++i)
+            {
+                age[i] = profiles.age[first + i];
+                male[i] = profiles.gender[first + i] == static_cast<uint8_t>(Gender::Male) ? 1.0 : 0.0;
+            }
+
+            // Indexed by FormulaVariable
+            const double *columns[] = {profiles.weight.data() + first, profiles.height.data() + first,
+                                       age, male, profiles.bodyFat.data() + first};
+            program->evaluateBlock(columns, rows, scratch.data(), out + first);
+
+            for (size_t i = 0; i < rows; ++i)
+            {
+                out[first + i] = out[first + i] * activityFactor(static_cast<ActivityLevel>(profiles.activityLevel[first + i]));
+            }
+        }
     }
 };
 
+// The closed set of strategies; the first is the default. Calls dispatch on
+// the variant index, with no virtual calls, RTTI or allocation.
+using CalorieStrategy = variant<HarrisBenedictStrategy, MifflinStJeorStrategy, FormulaStrategy>;
+
+inline const char *strategyId(const CalorieStrategy &strategy)
+{
+    return visit([](const auto &alternative)
+                 { return alternative.id; },
+                 strategy);
+}
+
+// Sets strategy to the one with the given id; false if there is none. A
+// formula strategy set this way has no formula yet and yields 0.
+template <size_t Index = 0>
+bool strategyFromId(const string &id, CalorieStrategy &strategy)
+{
+    if constexpr (Index < variant_size_v<CalorieStrategy>)
+    {
+        using Alternative = variant_alternative_t<Index, CalorieStrategy>;
+        if (id == Alternative::id)
+        {
+            strategy = Alternative();
+            return true;
+        }
+        return strategyFromId<Index + 1>(id, strategy);
+    }
+    else
+    {
+        return false;
+    }
+}
+
+// Evaluates a whole batch with one dispatch
+inline void calculateBatch(const CalorieStrategy &strategy, const ProfileColumns &profiles, double *out)
+{
+    visit([&](const auto &alternative)
+          { alternative.calculateBatch(profiles, out); },
+          strategy);
+}
+
+// Whether two strategies compute the same targets: the same alternative
+// and, for formulas, the same compiled program
+inline bool sameStrategy(const CalorieStrategy &a, const CalorieStrategy &b)
+{
+    if (a.index() != b.index())
+    {
+        return false;
+    }
+    auto *formula = get_if<FormulaStrategy>(&a);
+    return !formula || formula->program == get<FormulaStrategy>(b).program;
+}
+
 // User Profile class
 class UserProfile
 {
@@ -95,25 +306,34 @@ private:
     int age;
     double weight; // in kg
     string activityLevel;
-    shared_ptr<CalorieCalculationStrategy> calorieStrategy; // Strategy pattern
+    double bodyFat = 0; // percent, 0 if unknown; only formulas use it
+    CalorieStrategy calorieStrategy; // Strategy pattern
 
 public:
     UserProfile()
-        : gender(""), height(0), age(0), weight(0), activityLevel(""),
-          calorieStrategy(make_shared<HarrisBenedictStrategy>()) {} // Default strategy
+        : gender(""), height(0), age(0), weight(0), activityLevel("") {} // Default strategy is the variant's first
 
-    void setCalorieCalculationStrategy(shared_ptr<CalorieCalculationStrategy> strategy)
+    void setCalorieCalculationStrategy(const CalorieStrategy &strategy)
     {
         calorieStrategy = strategy;
     }
 
+    const CalorieStrategy &getCalorieCalculationStrategy() const { return calorieStrategy; }
+
+    bool isComplete() const
+    {
+        return !gender.empty() && height > 0 && age > 0 && weight > 0 && !activityLevel.empty();
+    }
+
     double calculateTargetCalories() const
     {
-        if (!calorieStrategy || gender.empty() || height <= 0 || age <= 0 || weight <= 0 || activityLevel.empty())
+        if (!isComplete())
         {
             return 0.0;
         }
-        return calorieStrategy->calculateCalories(gender, height, age, weight, activityLevel);
+        return visit([&](const auto &strategy)
+                     { return strategy.calculateCalories(gender, height, age, weight, activityLevel, bodyFat); },
+                     calorieStrategy);
     }
 
     string getGender() const { return gender; }
@@ -121,21 +341,15 @@ public:
     int getAge() const { return age; }
     double getWeight() const { return weight; }
     string getActivityLevel() const { return activityLevel; }
-    string getCalculationMethod() const
-    {
-        if (dynamic_cast<HarrisBenedictStrategy *>(calorieStrategy.get()))
-            return "harris-benedict";
-        else if (dynamic_cast<MifflinStJeorStrategy *>(calorieStrategy.get()))
-            return "mifflin-st-jeor";
-
-        return "unknown";
-    }
+    double getBodyFat() const { return bodyFat; }
+    string getCalculationMethod() const { return strategyId(calorieStrategy); }
 
     void setGender(const string &g) { gender = g; }
     void setHeight(double h) { height = h; }
     void setAge(int a) { age = a; }
     void setWeight(double w) { weight = w; }
     void setActivityLevel(const string &al) { activityLevel = al; }
+    void setBodyFat(double bf) { bodyFat = bf; }
 
     json toJson() const
     {
@@ -145,6 +359,15 @@ public:
         j["age"] = age;
         j["weight"] = weight;
         j["activityLevel"] = activityLevel;
+        if (bodyFat > 0)
+        {
+            j["bodyFat"] = bodyFat;
+        }
+        j["calculationMethod"] = strategyId(calorieStrategy);
+        if (auto *formula = get_if<FormulaStrategy>(&calorieStrategy))
+        {
+            j["formula"] = formula->source;
+        }
         return j;
     }
 
@@ -156,23 +379,182 @@ public:
         profile.setAge(j["age"].get<int>());
         profile.setWeight(j["weight"].get<double>());
         profile.setActivityLevel(j["activityLevel"].get<string>());
+        profile.setBodyFat(j.value("bodyFat", 0.0));
+
+        // Files written before the method was saved use the default
+        CalorieStrategy strategy;
+        if (strategyFromId(j.value("calculationMethod", ""), strategy))
+        {
+            if (auto *formula = get_if<FormulaStrategy>(&strategy))
+            {
+                string error;
+                if (!formula->compile(j.value("formula", ""), error))
+                {
+                    cerr << "Error in saved formula: " << error << endl;
+                }
+            }
+            profile.setCalorieCalculationStrategy(strategy);
+        }
         return profile;
     }
 };
 
+// A profile as it was from a given day until the next revision
+struct ProfileRevision
+{
+    int day; // INT_MIN for a revision with no known start
+    UserProfile profile;
+};
+
+// Dated profile revisions, oldest first. Each revision's target is computed
+// once and cached, so looking up the target for a day is a binary search
+// over the revisions rather than a strategy evaluation. Consecutive
+// revisions with the same strategy are computed as one batch. Days before
+// the first revision use the first one.
+class ProfileHistory
+{
+private:
+    vector<ProfileRevision> revisions;
+    mutable vector<double> targets; // Per revision; empty when stale
+
+    void ensureTargets() const
+    {
+        if (targets.size() == revisions.size())
+        {
+            return;
+        }
+        targets.assign(revisions.size(), 0.0); // Incomplete profiles stay 0
+        ProfileColumns columns;
+        vector<size_t> rows; // Revision of each column row
+        vector<double> out;
+        for (size_t first = 0, last; first < revisions.size(); first = last)
+        {
+            const CalorieStrategy &strategy = revisions[first].profile.getCalorieCalculationStrategy();
+            columns = ProfileColumns();
+            rows.clear();
+            for (last = first; last < revisions.size() &&
+                               sameStrategy(revisions[last].profile.getCalorieCalculationStrategy(), strategy);
+                 ++last)
+            {
+                const UserProfile &profile = revisions[last].profile;
+                if (profile.isComplete())
+                {
+                    columns.add(profile.getGender(), profile.getHeight(), profile.getAge(), profile.getWeight(),
+                                profile.getActivityLevel(), profile.getBodyFat());
+                    rows.push_back(last);
+                }
+            }
+
+            out.resize(columns.size());
+            calculateBatch(strategy, columns, out.data());
+            for (size_t i = 0; i < rows.size(); ++i)
+            {
+                targets[rows[i]] = out[i];
+            }
+        }
+    }
+
+    // Index of the revision in effect on the day
+    size_t indexFor(int day) const
+    {
+        auto it = upper_bound(revisions.begin(), revisions.end(), day,
+                              [](int value, const ProfileRevision &revision)
+                              { return value < revision.day; });
+        return it == revisions.begin() ? 0 : (it - revisions.begin()) - 1;
+    }
+
+public:
+    bool empty() const { return revisions.empty(); }
+    const vector<ProfileRevision> &getRevisions() const { return revisions; }
+
+    // Adds a revision, replacing one already made on the same day
+    void record(int day, const UserProfile &profile)
+    {
+        size_t index = revisions.empty() ? 0 : indexFor(day);
+        if (index < revisions.size() && revisions[index].day == day)
+        {
+            revisions[index].profile = profile;
+        }
+        else
+        {
+            size_t position = (index < revisions.size() && revisions[index].day < day) ? index + 1 : index;
+            revisions.insert(revisions.begin() + position, {day, profile});
+        }
+        targets.clear();
+    }
+
+    // 0 when there is no profile or it is incomplete
+    double targetOn(int day) const
+    {
+        if (revisions.empty())
+        {
+            return 0.0;
+        }
+        ensureTargets();
+        return targets[indexFor(day)];
+    }
+
+    void clear()
+    {
+        revisions.clear();
+        targets.clear();
+    }
+
+    json toJson() const
+    {
+        json j = json::array();
+        for (const auto &revision : revisions)
+        {
+            json revisionJson = revision.profile.toJson();
+            if (revision.day != INT_MIN)
+            {
+                revisionJson["since"] = Date::format(revision.day);
+            }
+            j.push_back(revisionJson);
+        }
+        return j;
+    }
+
+    static ProfileHistory fromJson(const json &j)
+    {
+        ProfileHistory history;
+        for (const auto &revisionJson : j)
+        {
+            int day = INT_MIN;
+            if (revisionJson.contains("since") && !Date::parse(revisionJson["since"].get<string>(), day))
+            {
+                continue;
+            }
+            history.record(day, UserProfile::fromJson(revisionJson));
+        }
+        return history;
+    }
+};
+
 // Profile Manager class
 class ProfileManager
 {
 private:
-    UserProfile profile;
+    UserProfile profile; // The latest revision
+    ProfileHistory history;
+    string profileFile;
     bool modified = false;
 
+    // Records the edited profile as today's revision
+    void recordRevision()
+    {
+        history.record(Date::todayDayNumber(), profile);
+        modified = true;
+    }
+
 public:
+    ProfileManager(const string &profileFile = "user_profile.json") : profileFile(profileFile) {}
+
     bool loadProfile()
     {
         try
         {
-            ifstream file("user_profile.json");
+            ifstream file(profileFile);
             if (!file.is_open())
             {
                 return false;
@@ -181,6 +563,17 @@ public:
             json j;
             file >> j;
             profile = UserProfile::fromJson(j);
+
+            // Files from before the history was kept hold one undated profile
+            if (j.contains("history"))
+            {
+                history = ProfileHistory::fromJson(j["history"]);
+            }
+            else
+            {
+                history.clear();
+                history.record(INT_MIN, profile);
+            }
             modified = false;
             return true;
         }
@@ -191,44 +584,73 @@ public:
         }
     }
 
+    // Captures the profile and its revisions as they are now and clears the
+    // modified flag; the snapshot can be written from any thread
+    vector<FileSnapshot> captureSave()
+    {
+        modified = false;
+        return {{profileFile, [profile = profile, history = history]
+                 {
+                     json j = profile.toJson();
+                     j["history"] = history.toJson();
+                     return j.dump(2);
+                 }}};
+    }
+
+    // For callers that write captured snapshots themselves and failed to
+    void markModified() { modified = true; }
+
     bool saveProfile()
     {
-        try
-        {
-            json j = profile.toJson();
-            ofstream file("user_profile.json");
-            file << j.dump(2);
-            modified = false;
-            return true;
-        }
-        catch (exception &e)
+        string error;
+        if (!writeSnapshots(captureSave(), false, error))
         {
-            cerr << "Error saving profile: " << e.what() << endl;
+            cerr << "Error saving profile: " << error << endl;
+            modified = true;
             return false;
         }
+        return true;
     }
 
-    void updateProfile( double height, int age, double weight, const string &activityLevel)
+    void updateProfile( double height, int age, double weight, const string &activityLevel, double bodyFat = 0)
     {
         // profile.setGender(gender);
         profile.setHeight(height);
         profile.setAge(age);
         profile.setWeight(weight);
         profile.setActivityLevel(activityLevel);
-        modified = true;
+        profile.setBodyFat(bodyFat);
+        recordRevision();
+    }
+
+    // Switches to a custom formula; leaves the profile unchanged on error
+    bool setFormula(const string &formula, string &error)
+    {
+        FormulaStrategy strategy;
+        if (!strategy.compile(formula, error))
+        {
+            return false;
+        }
+        profile.setCalorieCalculationStrategy(strategy);
+        recordRevision();
+        return true;
     }
 
-    void setCalculationMethod(const string &method)
+    // Switches to a built-in method; formulas go through setFormula.
+    // Returns false for an unknown method, leaving the profile unchanged.
+    bool setCalculationMethod(const string &method)
     {
-        if (method == "harris-benedict")
+        CalorieStrategy strategy;
+        if (!strategyFromId(method, strategy) || holds_alternative<FormulaStrategy>(strategy))
         {
-            profile.setCalorieCalculationStrategy(make_shared<HarrisBenedictStrategy>());
+            return false;
         }
-        else if (method == "mifflin-st-jeor")
+        if (profile.getCalculationMethod() != method)
         {
-            profile.setCalorieCalculationStrategy(make_shared<MifflinStJeorStrategy>());
+            profile.setCalorieCalculationStrategy(strategy);
+            recordRevision();
         }
-        modified = true;
+        return true;
     }
 
     double getTargetCalories() const
@@ -236,6 +658,17 @@ public:
         return profile.calculateTargetCalories();
     }
 
+    // Target from the profile revision in effect on the day
+    double getTargetCaloriesOn(int day) const
+    {
+        return history.empty() ? getTargetCalories() : history.targetOn(day);
+    }
+
+    const ProfileHistory &getHistory() const
+    {
+        return history;
+    }
+
     const UserProfile &getProfile() const
     {
         return profile;
@@ -0,0 +1,240 @@
+#ifndef RCU_CPP
+#define RCU_CPP
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <type_traits>
+#include <cstdint>
+using namespace std;
+
+// Epoch-based reclamation for read-mostly data. A reader announces the
+// global epoch in a slot of its own while it reads; a writer that replaces
+// a version advances the epoch and frees the old version once no slot shows
+// an epoch from before the replacement. Readers only write to their own
+// cache line, so reads neither block nor contend with each other.
+class RcuDomain
+{
+public:
+    static constexpr size_t MAX_READERS = 256; // Threads reading at the same time
+
+private:
+    struct alignas(64) Slot
+    {
+        atomic<uint64_t> epoch{0}; // Epoch the current read section began in, 0 when idle
+        atomic<bool> owned{false};
+    };
+
+    // A thread keeps its slot until it exits; read sections may nest
+    struct ThreadState
+    {
+        Slot *slot = nullptr;
+        unsigned depth = 0;
+
+        ~ThreadState()
+        {
+            if (slot)
+            {
+                slot->owned.store(false, memory_order_release);
+            }
+        }
+    };
+
+    Slot slots[MAX_READERS];
+    atomic<size_t> slotsInUse{0}; // Slots past this were never handed out
+    atomic<uint64_t> globalEpoch{1};
+
+    static ThreadState &threadState()
+    {
+        static thread_local ThreadState state;
+        return state;
+    }
+
+    Slot &acquireSlot()
+    {
+        while (true)
+        {
+            for (size_t i = 0; i < MAX_READERS; ++i)
+            {
+                bool expected = false;
+                if (!slots[i].owned.load(memory_order_relaxed) &&
+                    slots[i].owned.compare_exchange_strong(expected, true))
+                {
+                    size_t used = slotsInUse.load();
+                    while (used < i + 1 && !slotsInUse.compare_exchange_weak(used, i + 1))
+                    {
+                    }
+                    return slots[i];
+                }
+            }
+            this_thread::yield(); // More reader threads than slots; wait for one to exit
+        }
+    }
+
+public:
+    static RcuDomain &instance()
+    {
+        static RcuDomain domain;
+        return domain;
+    }
+
+    void enter()
+    {
+        ThreadState &state = threadState();
+        if (state.depth++ == 0)
+        {
+            if (!state.slot)
+            {
+                state.slot = &acquireSlot();
+            }
+            state.slot->epoch.store(globalEpoch.load(memory_order_acquire));
+        }
+    }
+
+    void leave()
+    {
+        ThreadState &state = threadState();
+        if (--state.depth == 0)
+        {
+            state.slot->epoch.store(0, memory_order_release);
+        }
+    }
+
+    // Called after a new version is published; returns the epoch that marks
+    // the old one
+    uint64_t retire()
+    {
+        return globalEpoch.fetch_add(1);
+    }
+
+    // True once no read section that may have seen a version retired at
+    // the given epoch is still running
+    bool isReclaimable(uint64_t retiredAt) const
+    {
+        size_t used = slotsInUse.load();
+        for (size_t i = 0; i < used; ++i)
+        {
+            uint64_t epoch = slots[i].epoch.load();
+            if (epoch != 0 && epoch <= retiredAt)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Waits for the read sections running now to end. Must not be called
+    // from inside a read section.
+    void synchronize()
+    {
+        uint64_t epoch = retire();
+        while (!isReclaimable(epoch))
+        {
+            this_thread::yield();
+        }
+    }
+};
+
+// Pointer to an immutable value that is replaced as a whole. Readers pin
+// the current version with read(); writers copy it, change the copy and
+// publish it. Replaced versions are freed by later writers once no reader
+// can still see them.
+template <typename T>
+class RcuPointer
+{
+private:
+    atomic<const T *> current;
+    mutex writeMutex; // Serializes writers; readers never take it
+    vector<pair<uint64_t, const T *>> retired;
+
+    // Frees the retired versions no reader can see any more
+    void reclaim()
+    {
+        RcuDomain &domain = RcuDomain::instance();
+        size_t kept = 0;
+        for (auto &[epoch, version] : retired)
+        {
+            if (domain.isReclaimable(epoch))
+            {
+                delete version;
+            }
+            else
+            {
+                retired[kept++] = {epoch, version};
+            }
+        }
+        retired.resize(kept);
+    }
+
+public:
+    // Keeps one version alive and unchanged while it exists
+    class Guard
+    {
+    private:
+        const T *value;
+
+    public:
+        explicit Guard(const atomic<const T *> &source)
+        {
+            RcuDomain::instance().enter();
+            value = source.load();
+        }
+
+        ~Guard() { RcuDomain::instance().leave(); }
+
+        Guard(const Guard &) = delete;
+        Guard &operator=(const Guard &) = delete;
+
+        const T &operator*() const { return *value; }
+        const T *operator->() const { return value; }
+    };
+
+    explicit RcuPointer(unique_ptr<T> initial) : current(initial.release()) {}
+
+    ~RcuPointer()
+    {
+        RcuDomain::instance().synchronize();
+        for (auto &[epoch, version] : retired)
+        {
+            delete version;
+        }
+        delete current.load();
+    }
+
+    RcuPointer(const RcuPointer &) = delete;
+    RcuPointer &operator=(const RcuPointer &) = delete;
+
+    Guard read() const { return Guard(current); }
+
+    // Publishes a copy of the current version as changed by edit(T &).
+    // Returns what edit returns.
+    template <typename Edit>
+    auto update(Edit edit)
+    {
+        lock_guard<mutex> lock(writeMutex);
+        auto next = make_unique<T>(*current.load());
+        auto publish = [&]
+        {
+            const T *previous = current.exchange(next.release());
+            retired.emplace_back(RcuDomain::instance().retire(), previous);
+            reclaim();
+        };
+
+        if constexpr (is_void_v<decltype(edit(*next))>)
+        {
+            edit(*next);
+            publish();
+        }
+        else
+        {
+            auto result = edit(*next);
+            publish();
+            return result;
+        }
+    }
+};
+
+#endif
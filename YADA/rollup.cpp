@@ -0,0 +1,132 @@
+#ifndef ROLLUP_CPP
+#define ROLLUP_CPP
+
+#include "food.cpp"
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+// Totals over a range of days
+struct RangeTotals
+{
+    Nutrients totals;
+    int64_t loggedDays = 0; // Days in the range with at least one entry
+};
+
+// Fenwick tree of per-day totals keyed by day number. Only days that have a
+// log take a slot, so sparse histories stay small. Range sums are O(log n);
+// updating a day, or appending a day after the last one, is O(log n).
+class NutrientRollup
+{
+private:
+    vector<int> days;           // Sorted day numbers
+    vector<RangeTotals> values; // Per-day values, parallel to days
+    vector<RangeTotals> tree;   // 1-based Fenwick tree over values
+
+    static void add(RangeTotals &target, const RangeTotals &value)
+    {
+        target.totals += value.totals;
+        target.loggedDays += value.loggedDays;
+    }
+
+    static void subtract(RangeTotals &target, const RangeTotals &value)
+    {
+        target.totals -= value.totals;
+        target.loggedDays -= value.loggedDays;
+    }
+
+    void update(size_t index, const RangeTotals &delta)
+    {
+        for (size_t i = index + 1; i < tree.size(); i += i & (~i + 1))
+        {
+            add(tree[i], delta);
+        }
+    }
+
+    // Sum of the first count values
+    RangeTotals prefix(size_t count) const
+    {
+        RangeTotals sum;
+        for (size_t i = count; i > 0; i -= i & (~i + 1))
+        {
+            add(sum, tree[i]);
+        }
+        return sum;
+    }
+
+    void rebuild()
+    {
+        tree.assign(values.size() + 1, RangeTotals());
+        for (size_t i = 1; i < tree.size(); ++i)
+        {
+            add(tree[i], values[i - 1]);
+            size_t parent = i + (i & (~i + 1));
+            if (parent < tree.size())
+            {
+                add(tree[parent], tree[i]);
+            }
+        }
+    }
+
+public:
+    void clear()
+    {
+        days.clear();
+        values.clear();
+        tree.assign(1, RangeTotals());
+    }
+
+    void set(int day, const Nutrients &totals, bool logged)
+    {
+        RangeTotals value;
+        value.totals = totals;
+        value.loggedDays = logged ? 1 : 0;
+
+        auto it = lower_bound(days.begin(), days.end(), day);
+        size_t index = it - days.begin();
+        if (it != days.end() && *it == day)
+        {
+            RangeTotals delta = value;
+            subtract(delta, values[index]);
+            values[index] = value;
+            update(index, delta);
+        }
+        else if (it == days.end())
+        {
+            // Appending: the new node covers (n + 1 - lowbit, n + 1]
+            days.push_back(day);
+            values.push_back(value);
+            size_t node = values.size();
+            RangeTotals covered = value;
+            add(covered, prefix(node - 1));
+            subtract(covered, prefix(node - (node & (~node + 1))));
+            if (tree.empty())
+            {
+                tree.push_back(RangeTotals());
+            }
+            tree.push_back(covered);
+        }
+        else
+        {
+            days.insert(it, day);
+            values.insert(values.begin() + index, value);
+            rebuild();
+        }
+    }
+
+    // Totals over the inclusive day range [fromDay, toDay]
+    RangeTotals query(int fromDay, int toDay) const
+    {
+        if (fromDay > toDay || tree.empty())
+        {
+            return RangeTotals();
+        }
+        size_t low = lower_bound(days.begin(), days.end(), fromDay) - days.begin();
+        size_t high = upper_bound(days.begin(), days.end(), toDay) - days.begin();
+        RangeTotals sum = prefix(high);
+        subtract(sum, prefix(low));
+        return sum;
+    }
+};
+
+#endif
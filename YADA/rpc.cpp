@@ -0,0 +1,433 @@
+#ifndef RPC_CPP
+#define RPC_CPP
+
+#include "server.cpp"
+#include "rpcproto.cpp"
+#include <optional>
+using namespace std;
+
+// Serves the manager APIs over the binary frame protocol in rpcproto.cpp,
+// normally on a Unix-domain socket for processes on the same machine. A
+// frame carries any number of calls for one user; they are executed
+// together, without calls from other connections in between, and answered
+// with a single frame. Frames may be pipelined.
+class RpcServer : public StreamServer
+{
+private:
+    struct Call
+    {
+        RpcOp op;
+        int day = 0;
+        int toDay = 0;
+        string foodId;
+        vector<string> keywords;
+        int64_t amount = 0;
+        bool flag = false; // matchAll for SearchFoods, inGrams for AddToLog
+    };
+
+    static bool isLogChange(RpcOp op)
+    {
+        return op == RpcOp::AddToLog || op == RpcOp::RemoveFromLog;
+    }
+
+    // A frame with none of these calls does not create the user
+    static bool changesUser(RpcOp op)
+    {
+        return isLogChange(op) || op == RpcOp::Undo || op == RpcOp::Redo;
+    }
+
+    static bool usesSession(RpcOp op)
+    {
+        return op != RpcOp::GetFood && op != RpcOp::SearchFoods && op != RpcOp::Save;
+    }
+
+    static RpcNutrients wireNutrients(const Nutrients &nutrients)
+    {
+        return {nutrients.calories.getMilli(), nutrients.proteins.getMilli(),
+                nutrients.carbs.getMilli(), nutrients.fats.getMilli()};
+    }
+
+    static string errorResult(RpcStatus status, const string &message)
+    {
+        RpcWriter writer;
+        writer.put(static_cast<uint8_t>(status));
+        writer.putString(message);
+        return move(writer.data());
+    }
+
+    static bool decodeCall(RpcReader &reader, Call &call)
+    {
+        call.op = static_cast<RpcOp>(reader.get<uint8_t>());
+        switch (call.op)
+        {
+        case RpcOp::GetFood:
+            call.foodId = reader.getString();
+            break;
+        case RpcOp::SearchFoods:
+        {
+            call.flag = reader.get<uint8_t>() != 0;
+            uint32_t count = reader.get<uint32_t>();
+            for (uint32_t i = 0; i < count && !reader.hasFailed(); ++i)
+            {
+                call.keywords.push_back(reader.getString());
+            }
+            break;
+        }
+        case RpcOp::GetDay:
+        case RpcOp::GetTarget:
+            call.day = reader.get<int32_t>();
+            break;
+        case RpcOp::AddToLog:
+            call.day = reader.get<int32_t>();
+            call.foodId = reader.getString();
+            call.amount = reader.get<int64_t>();
+            call.flag = reader.get<uint8_t>() != 0;
+            break;
+        case RpcOp::RemoveFromLog:
+            call.day = reader.get<int32_t>();
+            call.foodId = reader.getString();
+            break;
+        case RpcOp::Summarize:
+            call.day = reader.get<int32_t>();
+            call.toDay = reader.get<int32_t>();
+            break;
+        case RpcOp::Undo:
+        case RpcOp::Redo:
+        case RpcOp::Save:
+            break;
+        default:
+            return false;
+        }
+        // Days the date parser would not accept are rejected like malformed input
+        return !reader.hasFailed() && Date::isValidDayNumber(call.day) && Date::isValidDayNumber(call.toDay);
+    }
+
+    // Stages a log change; returns an error result if it is invalid
+    optional<string> stageLogChange(const FoodManager::View &catalog, const Call &call,
+                                    LogManager::Transaction &transaction)
+    {
+        if (call.op == RpcOp::RemoveFromLog)
+        {
+            transaction.removeFood(call.foodId, call.day);
+            return nullopt;
+        }
+
+        const Food *food = catalog.find(call.foodId);
+        if (!food)
+        {
+            return errorResult(RpcStatus::NotFound, "Food '" + call.foodId + "' not found");
+        }
+        Servings servings;
+        string error;
+        string quantity = Fixed::fromMilli(call.amount).toString() + (call.flag ? "g" : "");
+        if (!FoodManager::parseQuantity(food, quantity, servings, error))
+        {
+            return errorResult(RpcStatus::Invalid, error);
+        }
+        transaction.addFood(call.foodId, servings, call.day);
+        return nullopt;
+    }
+
+    // Answers a call other than a log change; session is only null for
+    // calls that do not use it
+    string execute(const FoodManager::View &catalog, UserSession *session, const Call &call)
+    {
+        RpcWriter writer;
+        writer.put(static_cast<uint8_t>(RpcStatus::Ok));
+        switch (call.op)
+        {
+        case RpcOp::GetFood:
+        {
+            const Food *food = catalog.find(call.foodId);
+            if (!food)
+            {
+                return errorResult(RpcStatus::NotFound, "Food '" + call.foodId + "' not found");
+            }
+            writer.putString(food->getId());
+            writer.putString(food->getType());
+            writer.putNutrients(wireNutrients(food->getNutrientsPerServing()));
+            writer.put(food->getServingGrams().getMilli());
+            break;
+        }
+        case RpcOp::SearchFoods:
+        {
+            vector<string> ids;
+            if (call.keywords.empty())
+            {
+                catalog.forEach([&](const shared_ptr<Food> &food)
+                                { ids.push_back(food->getId()); });
+            }
+            else
+            {
+                for (const auto &food : foodManager.searchFoods(call.keywords, call.flag))
+                {
+                    ids.push_back(food->getId());
+                }
+            }
+            writer.put(static_cast<uint32_t>(ids.size()));
+            for (const auto &id : ids)
+            {
+                writer.putString(id);
+            }
+            break;
+        }
+        case RpcOp::GetDay:
+        {
+            vector<pair<const LogEntry *, Nutrients>> entries;
+            Nutrients totals;
+            session->logManager.forEachDayInRange(call.day, call.day, [&](int, const DailyLog &log)
+                                                 {
+                for (const auto &entry : log.getEntries())
+                {
+                    Nutrients nutrients = entry.getTotalNutrients(catalog);
+                    entries.emplace_back(&entry, nutrients);
+                    totals += nutrients;
+                } });
+            writer.put(static_cast<uint32_t>(entries.size()));
+            for (const auto &[entry, nutrients] : entries)
+            {
+                writer.putString(entry->getFoodId());
+                writer.put(entry->getServings().getMilli());
+                writer.put(nutrients.calories.getMilli());
+            }
+            writer.putNutrients(wireNutrients(totals));
+            writer.put(session->profileManager.getTargetCaloriesOn(call.day));
+            break;
+        }
+        case RpcOp::Undo:
+            writer.put(static_cast<uint8_t>(session->logManager.undo()));
+            break;
+        case RpcOp::Redo:
+            writer.put(static_cast<uint8_t>(session->logManager.redo()));
+            break;
+        case RpcOp::Summarize:
+        {
+            if (call.day > call.toDay)
+            {
+                return errorResult(RpcStatus::Invalid, "from must not be after to");
+            }
+            RangeTotals range = session->logManager.summarizeRange(call.day, call.toDay);
+            writer.put(static_cast<int32_t>(range.loggedDays));
+            writer.putNutrients(wireNutrients(range.totals));
+            break;
+        }
+        case RpcOp::GetTarget:
+            writer.put(session->profileManager.getTargetCaloriesOn(call.day));
+            break;
+        case RpcOp::Save:
+            writer.put(static_cast<uint8_t>(saveAll()));
+            break;
+        default:
+            break;
+        }
+        return move(writer.data());
+    }
+
+    // Answers a frame that cannot be handled; the connection is then closed
+    static void appendFrameError(string &output, const string &message)
+    {
+        RpcWriter writer;
+        writer.beginFrame();
+        writer.put(static_cast<uint8_t>(RpcStatus::Invalid));
+        writer.putString(message);
+        writer.endFrame();
+        output += writer.data();
+    }
+
+    // Decodes and runs one request frame, appending the response frame.
+    // Returns false if the frame was malformed.
+    bool handleFrame(const char *payload, size_t size, string &output)
+    {
+        RpcReader reader(payload, size);
+        uint8_t flags = reader.get<uint8_t>();
+        string user = reader.getString();
+        uint32_t count = reader.get<uint32_t>();
+        vector<Call> calls;
+        calls.reserve(min<size_t>(count, size));
+        for (uint32_t i = 0; i < count && !reader.hasFailed(); ++i)
+        {
+            Call call;
+            if (!decodeCall(reader, call))
+            {
+                appendFrameError(output, "Malformed call " + to_string(i));
+                return false;
+            }
+            calls.push_back(move(call));
+        }
+        if (reader.hasFailed() || !reader.atEnd())
+        {
+            appendFrameError(output, "Malformed request");
+            return false;
+        }
+        if (user.empty())
+        {
+            user = defaultUser;
+        }
+        if (!UserManager::isValidName(user))
+        {
+            appendFrameError(output, "Invalid user name '" + user + "'");
+            return false;
+        }
+
+        bool changes = any_of(calls.begin(), calls.end(), [](const Call &call)
+                              { return changesUser(call.op); });
+        UserSession *session = changes ? &userManager.getSession(user) : userManager.findSession(user);
+        FoodManager::View catalog = foodManager.read();
+        vector<string> results(calls.size());
+
+        // Log changes waiting to be committed together (RPC_ATOMIC_LOG).
+        // There is always a session when the frame has any.
+        optional<LogManager::Transaction> transaction;
+        if (session)
+        {
+            transaction.emplace(session->logManager);
+        }
+        vector<size_t> staged;
+        auto commitStaged = [&]
+        {
+            if (staged.empty())
+            {
+                return;
+            }
+            string error;
+            bool committed = transaction->commit(error);
+            transaction->rollback(); // A failed commit keeps what was staged
+            for (size_t index : staged)
+            {
+                results[index] = committed ? string(1, char(RpcStatus::Ok)) : errorResult(RpcStatus::Failed, error);
+            }
+            staged.clear();
+        };
+
+        for (size_t i = 0; i < calls.size(); ++i)
+        {
+            const Call &call = calls[i];
+            try
+            {
+                if (!session && usesSession(call.op))
+                {
+                    results[i] = errorResult(RpcStatus::NotFound, "Unknown user '" + user + "'");
+                    continue;
+                }
+                if (!isLogChange(call.op))
+                {
+                    commitStaged();
+                    results[i] = execute(catalog, session, call);
+                    continue;
+                }
+
+                if (!(flags & RPC_ATOMIC_LOG))
+                {
+                    auto single = session->logManager.beginTransaction();
+                    string error;
+                    if (auto invalid = stageLogChange(catalog, call, single))
+                    {
+                        results[i] = move(*invalid);
+                    }
+                    else if (!single.commit(error))
+                    {
+                        results[i] = errorResult(RpcStatus::Failed, error);
+                    }
+                    else
+                    {
+                        results[i] = string(1, char(RpcStatus::Ok));
+                    }
+                    continue;
+                }
+
+                if (auto invalid = stageLogChange(catalog, call, *transaction))
+                {
+                    // Nothing of the group is applied if one change is invalid
+                    transaction->rollback();
+                    for (size_t index : staged)
+                    {
+                        results[index] = errorResult(RpcStatus::Failed, "Another change in the group was invalid");
+                    }
+                    staged.clear();
+                    results[i] = move(*invalid);
+                    while (i + 1 < calls.size() && isLogChange(calls[i + 1].op))
+                    {
+                        results[++i] = errorResult(RpcStatus::Failed, "Another change in the group was invalid");
+                    }
+                    continue;
+                }
+                staged.push_back(i);
+            }
+            catch (exception &e)
+            {
+                results[i] = errorResult(RpcStatus::Failed, e.what());
+            }
+        }
+        commitStaged();
+
+        RpcWriter writer;
+        writer.beginFrame();
+        writer.put(static_cast<uint8_t>(RpcStatus::Ok));
+        writer.put(static_cast<uint32_t>(results.size()));
+        for (const auto &result : results)
+        {
+            writer.append(result);
+        }
+        writer.endFrame();
+        output += writer.data();
+        return true;
+    }
+
+    bool handleRequests(Connection &connection) override
+    {
+        // Frames are consumed by offset and erased once, so a buffer holding
+        // many pipelined frames is not shifted after each of them
+        size_t consumed = 0;
+        bool more = false;
+        while (!connection.closeAfterWrite)
+        {
+            if (!hasOutputRoom(connection))
+            {
+                more = true;
+                break;
+            }
+
+            uint32_t length;
+            size_t available = connection.input.size() - consumed;
+            if (available < sizeof(length))
+            {
+                connection.closeAfterWrite = connection.peerClosed;
+                break;
+            }
+            memcpy(&length, connection.input.data() + consumed, sizeof(length));
+            if (length > RPC_MAX_FRAME_BYTES)
+            {
+                appendFrameError(connection.output, "Frame too large");
+                connection.closeAfterWrite = true;
+                break;
+            }
+            if (available - sizeof(length) < length)
+            {
+                connection.closeAfterWrite = connection.peerClosed;
+                break;
+            }
+
+            if (!handleFrame(connection.input.data() + consumed + sizeof(length), length, connection.output))
+            {
+                connection.closeAfterWrite = true;
+            }
+            consumed += sizeof(length) + length;
+        }
+
+        if (connection.closeAfterWrite)
+        {
+            connection.input.clear();
+        }
+        else
+        {
+            connection.input.erase(0, consumed);
+        }
+        return more;
+    }
+
+public:
+    RpcServer(FoodManager &foodManager, UserManager &userManager, const string &defaultUser)
+        : StreamServer(foodManager, userManager, defaultUser) {}
+};
+
+#endif
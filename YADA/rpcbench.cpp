@@ -0,0 +1,189 @@
+#ifndef RPCBENCH_CPP
+#define RPCBENCH_CPP
+
+#include "rpcclient.cpp"
+#include "date.cpp"
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <chrono>
+#include <deque>
+#include <algorithm>
+using namespace std;
+
+struct RpcBenchOptions
+{
+    string socketPath;
+    string mode = "lookup"; // "lookup" or "log"
+    int clients = 1;
+    int frames = 10000;    // Per client
+    int batchSize = 16;    // Calls per frame
+    int pipeline = 1;      // Frames in flight per client
+    bool atomic = false;   // Send log frames with RPC_ATOMIC_LOG
+};
+
+// Load generator for a running RPC server. Each client thread keeps up to
+// `pipeline` frames of `batchSize` calls in flight and times every frame
+// from send to response. "lookup" frames are GetFood calls cycling through
+// the catalog; "log" frames add foods to the rpc-bench user's log on
+// 2000-01-01 and remove them again, leaving the log as it was.
+class RpcBench
+{
+private:
+    static constexpr const char *BENCH_USER = "rpc-bench";
+
+    RpcBenchOptions options;
+    vector<string> foodIds;
+
+    RpcBatch makeBatch(size_t &next) const
+    {
+        RpcBatch batch(BENCH_USER, options.atomic ? RPC_ATOMIC_LOG : 0);
+        if (options.mode == "log")
+        {
+            int day;
+            Date::parse("2000-01-01", day);
+            size_t first = next;
+            for (int i = 0; i < options.batchSize / 2; ++i)
+            {
+                batch.addToLog(day, foodIds[next++ % foodIds.size()], 1000);
+            }
+            for (int i = 0; i < options.batchSize / 2; ++i)
+            {
+                batch.removeFromLog(day, foodIds[first++ % foodIds.size()]);
+            }
+            return batch;
+        }
+
+        for (int i = 0; i < options.batchSize; ++i)
+        {
+            batch.getFood(foodIds[next++ % foodIds.size()]);
+        }
+        return batch;
+    }
+
+    // Runs one client; fills latencies (microseconds per frame)
+    bool runClient(int index, vector<double> &latencies, size_t &failedCalls, string &error) const
+    {
+        using Clock = chrono::steady_clock;
+        RpcClient client;
+        if (!client.connect(options.socketPath, error))
+        {
+            return false;
+        }
+
+        size_t next = index * 7919; // Spread the clients over the catalog
+        deque<pair<RpcBatch, Clock::time_point>> inFlight;
+        vector<RpcResult> results;
+        int sent = 0;
+        while (sent < options.frames || !inFlight.empty())
+        {
+            while (sent < options.frames && static_cast<int>(inFlight.size()) < options.pipeline)
+            {
+                inFlight.emplace_back(makeBatch(next), Clock::now());
+                if (!client.send(inFlight.back().first, error))
+                {
+                    return false;
+                }
+                ++sent;
+            }
+
+            if (!client.receive(inFlight.front().first, results, error))
+            {
+                return false;
+            }
+            latencies.push_back(chrono::duration<double, micro>(Clock::now() - inFlight.front().second).count());
+            inFlight.pop_front();
+            for (const auto &result : results)
+            {
+                failedCalls += !result.ok();
+            }
+        }
+        return true;
+    }
+
+    static double percentile(const vector<double> &sorted, double fraction)
+    {
+        if (sorted.empty())
+        {
+            return 0;
+        }
+        size_t index = min(sorted.size() - 1, static_cast<size_t>(fraction * sorted.size()));
+        return sorted[index];
+    }
+
+public:
+    explicit RpcBench(const RpcBenchOptions &options) : options(options) {}
+
+    // Prints throughput and latency percentiles; returns false on errors
+    bool run(ostream &out)
+    {
+        if ((options.mode != "lookup" && options.mode != "log") || options.clients < 1 ||
+            options.frames < 1 || options.batchSize < (options.mode == "log" ? 2 : 1) || options.pipeline < 1)
+        {
+            out << "Invalid benchmark options\n";
+            return false;
+        }
+
+        RpcClient client;
+        vector<RpcResult> results;
+        string error;
+        if (!client.connect(options.socketPath, error) ||
+            !client.call(RpcBatch(BENCH_USER).searchFoods({}), results, error))
+        {
+            out << error << "\n";
+            return false;
+        }
+        foodIds = results[0].foodIds;
+        if (foodIds.empty())
+        {
+            out << "The server has no foods to benchmark with\n";
+            return false;
+        }
+        client.close();
+
+        vector<vector<double>> latencies(options.clients);
+        vector<size_t> failedCalls(options.clients, 0);
+        vector<string> errors(options.clients);
+        vector<thread> threads;
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < options.clients; ++i)
+        {
+            threads.emplace_back([&, i]
+                                 { runClient(i, latencies[i], failedCalls[i], errors[i]); });
+        }
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        vector<double> all;
+        size_t failed = 0;
+        for (int i = 0; i < options.clients; ++i)
+        {
+            all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+            failed += failedCalls[i];
+            if (!errors[i].empty())
+            {
+                out << "Client " << i << ": " << errors[i] << "\n";
+            }
+        }
+        sort(all.begin(), all.end());
+
+        size_t calls = all.size() * (options.mode == "log" ? options.batchSize / 2 * 2 : options.batchSize);
+        out << fixed << setprecision(1);
+        out << options.mode << ": " << options.clients << " client(s), " << options.batchSize
+            << " calls/frame, pipeline " << options.pipeline << (options.atomic ? ", atomic" : "") << "\n";
+        out << "  " << all.size() << " frames, " << calls << " calls in " << setprecision(3) << seconds << " s\n";
+        out << setprecision(0) << "  " << all.size() / seconds << " frames/s, " << calls / seconds << " calls/s\n";
+        out << setprecision(1) << "  frame latency us: p50 " << percentile(all, 0.50) << ", p90 " << percentile(all, 0.90)
+            << ", p99 " << percentile(all, 0.99) << ", max " << (all.empty() ? 0 : all.back()) << "\n";
+        if (failed > 0)
+        {
+            out << "  " << failed << " calls failed\n";
+        }
+        return all.size() == static_cast<size_t>(options.clients) * options.frames;
+    }
+};
+
+#endif
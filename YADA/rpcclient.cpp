@@ -0,0 +1,338 @@
+#ifndef RPCCLIENT_CPP
+#define RPCCLIENT_CPP
+
+#include "rpcproto.cpp"
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+using namespace std;
+
+// Client side of the local RPC protocol, for processes that talk to a
+// running `--rpc` server. It depends only on rpcproto.cpp, not on the
+// managers. Days are day numbers as in Date (days since 1970-01-01) and
+// amounts are in thousandths.
+
+// Calls to send in one frame, all for the same user
+class RpcBatch
+{
+private:
+    string user;
+    uint8_t flags;
+    vector<RpcOp> ops;
+    RpcWriter calls;
+
+    RpcBatch &begin(RpcOp op)
+    {
+        ops.push_back(op);
+        calls.put(static_cast<uint8_t>(op));
+        return *this;
+    }
+
+public:
+    // An empty user means the server's default user; flags as RPC_ATOMIC_LOG
+    explicit RpcBatch(const string &user = "", uint8_t flags = 0) : user(user), flags(flags) {}
+
+    RpcBatch &getFood(const string &id)
+    {
+        begin(RpcOp::GetFood).calls.putString(id);
+        return *this;
+    }
+
+    // Without keywords, lists every food
+    RpcBatch &searchFoods(const vector<string> &keywords, bool matchAll = true)
+    {
+        begin(RpcOp::SearchFoods);
+        calls.put(static_cast<uint8_t>(matchAll));
+        calls.put(static_cast<uint32_t>(keywords.size()));
+        for (const auto &keyword : keywords)
+        {
+            calls.putString(keyword);
+        }
+        return *this;
+    }
+
+    RpcBatch &getDay(int day)
+    {
+        begin(RpcOp::GetDay).calls.put(static_cast<int32_t>(day));
+        return *this;
+    }
+
+    // amountMilli is servings, or grams with inGrams, in thousandths
+    RpcBatch &addToLog(int day, const string &foodId, int64_t amountMilli, bool inGrams = false)
+    {
+        begin(RpcOp::AddToLog).calls.put(static_cast<int32_t>(day));
+        calls.putString(foodId);
+        calls.put(amountMilli);
+        calls.put(static_cast<uint8_t>(inGrams));
+        return *this;
+    }
+
+    RpcBatch &removeFromLog(int day, const string &foodId)
+    {
+        begin(RpcOp::RemoveFromLog).calls.put(static_cast<int32_t>(day));
+        calls.putString(foodId);
+        return *this;
+    }
+
+    RpcBatch &undo() { return begin(RpcOp::Undo); }
+    RpcBatch &redo() { return begin(RpcOp::Redo); }
+
+    RpcBatch &summarize(int fromDay, int toDay)
+    {
+        begin(RpcOp::Summarize).calls.put(static_cast<int32_t>(fromDay));
+        calls.put(static_cast<int32_t>(toDay));
+        return *this;
+    }
+
+    RpcBatch &getTarget(int day)
+    {
+        begin(RpcOp::GetTarget).calls.put(static_cast<int32_t>(day));
+        return *this;
+    }
+
+    RpcBatch &save() { return begin(RpcOp::Save); }
+
+    size_t size() const { return ops.size(); }
+    const vector<RpcOp> &getOps() const { return ops; }
+
+    // The request frame, length prefix included
+    string encode() const
+    {
+        RpcWriter writer;
+        writer.beginFrame();
+        writer.put(flags);
+        writer.putString(user);
+        writer.put(static_cast<uint32_t>(ops.size()));
+        writer.append(calls.data());
+        writer.endFrame();
+        return move(writer.data());
+    }
+};
+
+struct RpcLogEntry
+{
+    string foodId;
+    int64_t servings = 0;
+    int64_t calories = 0;
+};
+
+// The answer to one call. Only the members for the call's op are set.
+struct RpcResult
+{
+    RpcOp op;
+    RpcStatus status = RpcStatus::Ok;
+    string error;
+
+    // GetFood
+    string foodId;
+    string type;
+    RpcNutrients nutrients; // Also the totals of GetDay and Summarize
+    int64_t servingGrams = 0;
+
+    vector<string> foodIds;      // SearchFoods
+    vector<RpcLogEntry> entries; // GetDay
+    double targetCalories = 0;   // GetDay, GetTarget
+    int32_t loggedDays = 0;      // Summarize
+    bool done = false;           // Undo, Redo, Save
+
+    bool ok() const { return status == RpcStatus::Ok; }
+};
+
+// A blocking connection to the server. Several batches may be sent before
+// their responses are received; responses arrive in the order sent.
+class RpcClient
+{
+private:
+    int fd = -1;
+    string input;
+
+    static bool decodeResult(RpcReader &reader, RpcResult &result)
+    {
+        result.status = static_cast<RpcStatus>(reader.get<uint8_t>());
+        if (result.status != RpcStatus::Ok)
+        {
+            result.error = reader.getString();
+            return !reader.hasFailed();
+        }
+
+        switch (result.op)
+        {
+        case RpcOp::GetFood:
+            result.foodId = reader.getString();
+            result.type = reader.getString();
+            result.nutrients = reader.getNutrients();
+            result.servingGrams = reader.get<int64_t>();
+            break;
+        case RpcOp::SearchFoods:
+        {
+            uint32_t count = reader.get<uint32_t>();
+            for (uint32_t i = 0; i < count && !reader.hasFailed(); ++i)
+            {
+                result.foodIds.push_back(reader.getString());
+            }
+            break;
+        }
+        case RpcOp::GetDay:
+        {
+            uint32_t count = reader.get<uint32_t>();
+            for (uint32_t i = 0; i < count && !reader.hasFailed(); ++i)
+            {
+                RpcLogEntry entry;
+                entry.foodId = reader.getString();
+                entry.servings = reader.get<int64_t>();
+                entry.calories = reader.get<int64_t>();
+                result.entries.push_back(move(entry));
+            }
+            result.nutrients = reader.getNutrients();
+            result.targetCalories = reader.get<double>();
+            break;
+        }
+        case RpcOp::Undo:
+        case RpcOp::Redo:
+        case RpcOp::Save:
+            result.done = reader.get<uint8_t>() != 0;
+            break;
+        case RpcOp::Summarize:
+            result.loggedDays = reader.get<int32_t>();
+            result.nutrients = reader.getNutrients();
+            break;
+        case RpcOp::GetTarget:
+            result.targetCalories = reader.get<double>();
+            break;
+        default:
+            break;
+        }
+        return !reader.hasFailed();
+    }
+
+    bool fail(const string &message, string &error)
+    {
+        error = message;
+        close();
+        return false;
+    }
+
+public:
+    RpcClient() = default;
+    ~RpcClient() { close(); }
+
+    RpcClient(const RpcClient &) = delete;
+    RpcClient &operator=(const RpcClient &) = delete;
+
+    bool connect(const string &path, string &error)
+    {
+        close();
+        sockaddr_un address{};
+        if (path.empty() || path.size() >= sizeof(address.sun_path))
+        {
+            error = "Invalid socket path " + path;
+            return false;
+        }
+        address.sun_family = AF_UNIX;
+        memcpy(address.sun_path, path.c_str(), path.size());
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0)
+        {
+            return fail("Cannot connect to " + path + ": " + strerror(errno), error);
+        }
+        return true;
+    }
+
+    bool isConnected() const { return fd >= 0; }
+
+    void close()
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+            fd = -1;
+        }
+        input.clear();
+    }
+
+    bool send(const RpcBatch &batch, string &error)
+    {
+        string frame = batch.encode();
+        size_t sent = 0;
+        while (sent < frame.size())
+        {
+            ssize_t count = ::send(fd, frame.data() + sent, frame.size() - sent, MSG_NOSIGNAL);
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (count <= 0)
+            {
+                return fail(string("send: ") + strerror(errno), error);
+            }
+            sent += count;
+        }
+        return true;
+    }
+
+    // Reads the response to the oldest batch not yet answered
+    bool receive(const RpcBatch &batch, vector<RpcResult> &results, string &error)
+    {
+        uint32_t length = 0;
+        while (true)
+        {
+            if (input.size() >= sizeof(length))
+            {
+                memcpy(&length, input.data(), sizeof(length));
+                if (input.size() - sizeof(length) >= length)
+                {
+                    break;
+                }
+            }
+
+            char buffer[64 * 1024];
+            ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (count <= 0)
+            {
+                return fail(count == 0 ? "Connection closed by server" : string("recv: ") + strerror(errno), error);
+            }
+            input.append(buffer, count);
+        }
+
+        RpcReader reader(input.data() + sizeof(length), length);
+        RpcStatus status = static_cast<RpcStatus>(reader.get<uint8_t>());
+        if (status != RpcStatus::Ok)
+        {
+            return fail("Server rejected the request: " + reader.getString(), error);
+        }
+
+        uint32_t count = reader.get<uint32_t>();
+        const vector<RpcOp> &ops = batch.getOps();
+        if (count != ops.size())
+        {
+            return fail("Response does not match the request", error);
+        }
+        results.assign(count, RpcResult());
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            results[i].op = ops[i];
+            if (!decodeResult(reader, results[i]))
+            {
+                return fail("Malformed response", error);
+            }
+        }
+        input.erase(0, sizeof(length) + length);
+        return true;
+    }
+
+    bool call(const RpcBatch &batch, vector<RpcResult> &results, string &error)
+    {
+        return send(batch, error) && receive(batch, results, error);
+    }
+};
+
+#endif
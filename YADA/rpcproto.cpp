@@ -0,0 +1,181 @@
+#ifndef RPCPROTO_CPP
+#define RPCPROTO_CPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+using namespace std;
+
+// Binary protocol of the local RPC socket (see RpcServer and RpcClient).
+// Integers are in host byte order, little-endian on all supported
+// platforms, as in the columnar export format.
+//
+//   frame:    uint32 payloadLength, payload (at most RPC_MAX_FRAME_BYTES)
+//   request:  uint8 flags, string user (empty for the server's default),
+//             uint32 callCount, then per call uint8 RpcOp and its arguments
+//   response: uint8 RpcStatus for the whole frame, then
+//               Ok:        uint32 resultCount, one result per call in order
+//               otherwise: string error (the server then closes)
+//   result:   uint8 RpcStatus, then the op's result if Ok, else string error
+//
+//   string:    uint32 length, bytes
+//   day:       int32 days since 1970-01-01
+//   fixed:     int64 thousandths (servings, grams, nutrients)
+//   nutrients: fixed calories, proteins, carbs, fats
+//
+//   op             arguments                            result
+//   GetFood        string id                            string id, string type,
+//                                                       nutrients per serving, fixed servingGrams
+//   SearchFoods    uint8 matchAll, uint32 n, strings    uint32 n, string ids (no keywords: all)
+//   GetDay         day                                  uint32 n, per entry string foodId,
+//                                                       fixed servings, fixed calories;
+//                                                       nutrients totals, double targetCalories
+//   AddToLog       day, string foodId, fixed amount,    -
+//                  uint8 inGrams
+//   RemoveFromLog  day, string foodId                   -
+//   Undo, Redo     -                                    uint8 done
+//   Summarize      day from, day to                     int32 loggedDays, nutrients totals
+//   GetTarget      day                                  double targetCalories
+//   Save           -                                    uint8 saved
+//
+// With RPC_ATOMIC_LOG in the flags, consecutive AddToLog and RemoveFromLog
+// calls are committed together: one undo step, and none of them is applied
+// if one fails.
+
+constexpr uint32_t RPC_MAX_FRAME_BYTES = 1024 * 1024;
+constexpr uint8_t RPC_ATOMIC_LOG = 1;
+
+enum class RpcOp : uint8_t
+{
+    GetFood = 1,
+    SearchFoods = 2,
+    GetDay = 3,
+    AddToLog = 4,
+    RemoveFromLog = 5,
+    Undo = 6,
+    Redo = 7,
+    Summarize = 8,
+    GetTarget = 9,
+    Save = 10,
+};
+
+enum class RpcStatus : uint8_t
+{
+    Ok = 0,
+    NotFound = 1,
+    Invalid = 2,
+    Failed = 3,
+};
+
+// Nutrient amounts in thousandths, as Nutrients holds them
+struct RpcNutrients
+{
+    int64_t calories = 0;
+    int64_t proteins = 0;
+    int64_t carbs = 0;
+    int64_t fats = 0;
+};
+
+// Appends values in wire format; frames are opened and closed around them
+class RpcWriter
+{
+private:
+    string buffer;
+    size_t frameStart = 0;
+
+public:
+    template <typename T>
+    void put(T value)
+    {
+        buffer.append(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    void putString(const string &text)
+    {
+        put(static_cast<uint32_t>(text.size()));
+        buffer += text;
+    }
+
+    void putNutrients(const RpcNutrients &nutrients)
+    {
+        put(nutrients.calories);
+        put(nutrients.proteins);
+        put(nutrients.carbs);
+        put(nutrients.fats);
+    }
+
+    void append(const string &bytes) { buffer += bytes; }
+
+    // Reserves the length prefix, filled in by endFrame
+    void beginFrame()
+    {
+        frameStart = buffer.size();
+        put(uint32_t(0));
+    }
+
+    void endFrame()
+    {
+        uint32_t length = buffer.size() - frameStart - sizeof(uint32_t);
+        memcpy(&buffer[frameStart], &length, sizeof(length));
+    }
+
+    string &data() { return buffer; }
+    const string &data() const { return buffer; }
+};
+
+// Reads values in wire format. Reading past the end sets failed and yields
+// zeros, so a message can be decoded in one pass and checked at the end.
+class RpcReader
+{
+private:
+    const char *data;
+    size_t size;
+    size_t position = 0;
+    bool failed = false;
+
+public:
+    RpcReader(const char *data, size_t size) : data(data), size(size) {}
+
+    template <typename T>
+    T get()
+    {
+        T value{};
+        if (failed || size - position < sizeof(T))
+        {
+            failed = true;
+            return value;
+        }
+        memcpy(&value, data + position, sizeof(T));
+        position += sizeof(T);
+        return value;
+    }
+
+    string getString()
+    {
+        uint32_t length = get<uint32_t>();
+        if (failed || size - position < length)
+        {
+            failed = true;
+            return string();
+        }
+        string text(data + position, length);
+        position += length;
+        return text;
+    }
+
+    RpcNutrients getNutrients()
+    {
+        RpcNutrients nutrients;
+        nutrients.calories = get<int64_t>();
+        nutrients.proteins = get<int64_t>();
+        nutrients.carbs = get<int64_t>();
+        nutrients.fats = get<int64_t>();
+        return nutrients;
+    }
+
+    bool hasFailed() const { return failed; }
+    bool atEnd() const { return position == size; }
+};
+
+#endif
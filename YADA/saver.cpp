@@ -0,0 +1,180 @@
+#ifndef SAVER_CPP
+#define SAVER_CPP
+
+#include "food.cpp"
+#include "users.cpp"
+#include "storage.cpp"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+using namespace std;
+
+// Writes the data files on a thread of its own, so the interactive thread
+// never waits for the disk. collect() captures the managers that have
+// changes, which is cheap; the snapshots are written once none have arrived
+// for the debounce interval (at most MAX_DELAY after the first), and only
+// the newest snapshot of each file is written. Every write is fsynced.
+// A write that fails is kept and retried with the next one.
+class BackgroundSaver
+{
+public:
+    using Clock = chrono::steady_clock;
+    static constexpr chrono::milliseconds DEFAULT_DEBOUNCE{1000};
+    static constexpr chrono::milliseconds MAX_DELAY{5000};
+
+private:
+    FoodManager &foodManager;
+    UserManager &userManager;
+    chrono::milliseconds debounce;
+
+    mutex stateMutex;
+    condition_variable wake; // Worker: new snapshots or stopping
+    condition_variable idle; // flush(): the worker finished a batch
+    map<string, function<string()>> pending; // Newest snapshot per path
+    bool scheduled = false;                  // pending has snapshots to write by dueAt
+    bool urgent = false;                     // Write without waiting for dueAt
+    bool writing = false;                    // A batch is being written
+    bool stopping = false;
+    Clock::time_point firstPending, dueAt;
+    vector<string> errors; // Failed writes not yet reported
+    thread worker;
+
+    // Writes a batch with the lock released, then puts failed snapshots back
+    // unless a newer one arrived meanwhile. Returns false if any failed.
+    bool writeBatch(unique_lock<mutex> &lock, map<string, function<string()>> batch)
+    {
+        writing = true;
+        lock.unlock();
+
+        vector<pair<string, FileSnapshot>> failed;
+        for (auto &[path, render] : batch)
+        {
+            string error;
+            FileSnapshot snapshot{path, move(render)};
+            if (!writeSnapshot(snapshot, true, error))
+            {
+                failed.emplace_back(error, move(snapshot));
+            }
+        }
+
+        lock.lock();
+        writing = false;
+        for (auto &[error, snapshot] : failed)
+        {
+            errors.push_back(error);
+            pending.emplace(snapshot.path, move(snapshot.render));
+        }
+        idle.notify_all();
+        return failed.empty();
+    }
+
+    void run()
+    {
+        unique_lock<mutex> lock(stateMutex);
+        while (!stopping)
+        {
+            if (!scheduled)
+            {
+                wake.wait(lock);
+                continue;
+            }
+            if (writing)
+            {
+                idle.wait(lock); // flush() is writing on its own thread
+                continue;
+            }
+            if (!urgent && Clock::now() < dueAt)
+            {
+                wake.wait_until(lock, dueAt);
+                continue;
+            }
+
+            scheduled = urgent = false;
+            writeBatch(lock, exchange(pending, {}));
+        }
+    }
+
+public:
+    BackgroundSaver(FoodManager &foodManager, UserManager &userManager,
+                    chrono::milliseconds debounce = DEFAULT_DEBOUNCE)
+        : foodManager(foodManager), userManager(userManager), debounce(debounce),
+          worker([this]
+                 { run(); }) {}
+
+    ~BackgroundSaver()
+    {
+        flush();
+        {
+            lock_guard<mutex> lock(stateMutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+
+    BackgroundSaver(const BackgroundSaver &) = delete;
+    BackgroundSaver &operator=(const BackgroundSaver &) = delete;
+
+    // Captures whatever changed since the last call and schedules it to be
+    // written. Must be called on the thread that changes the managers; with
+    // now, the write starts without waiting for the debounce interval.
+    void collect(bool now = false)
+    {
+        vector<FileSnapshot> snapshots;
+        if (foodManager.isModified())
+        {
+            snapshots = foodManager.captureSave();
+        }
+        for (auto &snapshot : userManager.captureModified())
+        {
+            snapshots.push_back(move(snapshot));
+        }
+
+        {
+            lock_guard<mutex> lock(stateMutex);
+            for (auto &snapshot : snapshots)
+            {
+                pending[snapshot.path] = move(snapshot.render);
+            }
+            if (pending.empty() || (snapshots.empty() && !now))
+            {
+                return; // Failed writes wait for the next change or flush
+            }
+
+            Clock::time_point time = Clock::now();
+            if (!scheduled)
+            {
+                scheduled = true;
+                firstPending = time;
+            }
+            dueAt = min(time + debounce, firstPending + MAX_DELAY);
+            urgent = urgent || now;
+        }
+        wake.notify_one();
+    }
+
+    // Writes everything collected so far on the calling thread, after any
+    // batch the worker is writing. Returns false if a write failed.
+    bool flush()
+    {
+        unique_lock<mutex> lock(stateMutex);
+        idle.wait(lock, [this]
+                  { return !writing; });
+        scheduled = urgent = false;
+        if (pending.empty())
+        {
+            return true;
+        }
+        return writeBatch(lock, exchange(pending, {}));
+    }
+
+    // Messages for the writes that failed since the last call
+    vector<string> takeErrors()
+    {
+        lock_guard<mutex> lock(stateMutex);
+        return exchange(errors, {});
+    }
+};
+
+#endif
@@ -0,0 +1,402 @@
+#ifndef SCHEDULER_CPP
+#define SCHEDULER_CPP
+
+#include "rcu.cpp"
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <algorithm>
+#include <cstdlib>
+#include <pthread.h>
+#include <sched.h>
+using namespace std;
+
+// One pool of worker threads shared by every parallel operation, so that
+// features do not each start threads of their own. Each worker has a deque:
+// it pushes and pops its own tasks at the back and, when it runs out, steals
+// the oldest task from the front of another worker's deque. Threads that
+// are not workers hand tasks in through a shared queue, and a thread waiting
+// for its tasks runs queued tasks meanwhile instead of blocking.
+//
+// With no workers (one CPU, or configured so) tasks run inline when
+// spawned, so callers need no separate serial path.
+class TaskScheduler
+{
+public:
+    // Tasks spawned together; wait() returns when all of them have finished
+    // and rethrows the first exception one of them threw
+    class TaskGroup
+    {
+    private:
+        TaskScheduler &scheduler;
+        atomic<size_t> pending{0};
+        mutex errorMutex;
+        exception_ptr error;
+
+        void fail()
+        {
+            lock_guard<mutex> lock(errorMutex);
+            if (!error)
+            {
+                error = current_exception();
+            }
+        }
+
+    public:
+        explicit TaskGroup(TaskScheduler &scheduler = TaskScheduler::instance()) : scheduler(scheduler) {}
+
+        ~TaskGroup()
+        {
+            // Tasks refer to the group; never leave them running
+            while (pending.load(memory_order_acquire) > 0)
+            {
+                if (!scheduler.runOne())
+                {
+                    this_thread::yield();
+                }
+            }
+        }
+
+        TaskGroup(const TaskGroup &) = delete;
+        TaskGroup &operator=(const TaskGroup &) = delete;
+
+        template <typename Function>
+        void spawn(Function function)
+        {
+            if (scheduler.workers.empty())
+            {
+                try
+                {
+                    function();
+                }
+                catch (...)
+                {
+                    fail();
+                }
+                return;
+            }
+
+            pending.fetch_add(1, memory_order_relaxed);
+            scheduler.push([this, function = move(function)]() mutable
+                           {
+                try
+                {
+                    function();
+                }
+                catch (...)
+                {
+                    fail();
+                }
+                pending.fetch_sub(1, memory_order_release); });
+        }
+
+        void wait()
+        {
+            while (pending.load(memory_order_acquire) > 0)
+            {
+                if (!scheduler.runOne())
+                {
+                    this_thread::yield();
+                }
+            }
+            lock_guard<mutex> lock(errorMutex);
+            if (error)
+            {
+                rethrow_exception(exchange(error, nullptr));
+            }
+        }
+    };
+
+private:
+    using Task = function<void()>;
+
+    struct alignas(64) Worker
+    {
+        mutex lock;
+        deque<Task> tasks;
+        thread runner;
+    };
+
+    static constexpr int SPINS_BEFORE_SLEEP = 64;
+
+    vector<unique_ptr<Worker>> workers;
+    mutex injectedMutex;
+    deque<Task> injected;      // Tasks from threads that are not workers
+    atomic<size_t> queued{0};  // Tasks in all queues
+    atomic<size_t> sleeping{0};
+    atomic<bool> stopping{false};
+    mutex sleepMutex;
+    condition_variable wakeup;
+
+    // Requested configuration, read when the scheduler is first used
+    static size_t &requestedWorkers()
+    {
+        static size_t count = SIZE_MAX; // SIZE_MAX: from YADA_WORKERS or the CPU count
+        return count;
+    }
+
+    static int &requestedPinning()
+    {
+        static int pin = -1; // -1: from YADA_PIN_WORKERS
+        return pin;
+    }
+
+    static int &currentWorker()
+    {
+        static thread_local int index = -1; // -1 on threads that are not workers
+        return index;
+    }
+
+    void push(Task task)
+    {
+        int index = currentWorker();
+        if (index >= 0)
+        {
+            lock_guard<mutex> lock(workers[index]->lock);
+            workers[index]->tasks.push_back(move(task));
+        }
+        else
+        {
+            lock_guard<mutex> lock(injectedMutex);
+            injected.push_back(move(task));
+        }
+        queued.fetch_add(1);
+        if (sleeping.load() > 0)
+        {
+            lock_guard<mutex> lock(sleepMutex);
+            wakeup.notify_one();
+        }
+    }
+
+    bool take(mutex &lock, deque<Task> &tasks, bool newest, Task &task)
+    {
+        lock_guard<mutex> guard(lock);
+        if (tasks.empty())
+        {
+            return false;
+        }
+        if (newest)
+        {
+            task = move(tasks.back());
+            tasks.pop_back();
+        }
+        else
+        {
+            task = move(tasks.front());
+            tasks.pop_front();
+        }
+        queued.fetch_sub(1);
+        return true;
+    }
+
+    // Own newest task first, then tasks handed in, then the oldest task of
+    // another worker. Returns false if there was nothing to run.
+    bool runOne()
+    {
+        if (queued.load() == 0)
+        {
+            return false;
+        }
+
+        Task task;
+        int index = currentWorker();
+        bool found = index >= 0 && take(workers[index]->lock, workers[index]->tasks, true, task);
+        found = found || take(injectedMutex, injected, false, task);
+        size_t start = index >= 0 ? index + 1 : 0;
+        for (size_t i = 0; !found && i < workers.size(); ++i)
+        {
+            Worker &victim = *workers[(start + i) % workers.size()];
+            found = take(victim.lock, victim.tasks, false, task);
+        }
+        if (found)
+        {
+            task();
+        }
+        return found;
+    }
+
+    void workerLoop(int index)
+    {
+        currentWorker() = index;
+        int idle = 0;
+        while (!stopping.load())
+        {
+            if (runOne())
+            {
+                idle = 0;
+                continue;
+            }
+            if (++idle < SPINS_BEFORE_SLEEP)
+            {
+                this_thread::yield();
+                continue;
+            }
+
+            unique_lock<mutex> lock(sleepMutex);
+            sleeping.fetch_add(1);
+            wakeup.wait(lock, [this]
+                        { return queued.load() > 0 || stopping.load(); });
+            sleeping.fetch_sub(1);
+            idle = 0;
+        }
+    }
+
+    // Binds worker i to the i+1-th CPU the process may run on, leaving the
+    // first one to the thread that spawns the work
+    static void pin(thread &worker, size_t index)
+    {
+        cpu_set_t allowed;
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        {
+            return;
+        }
+        vector<int> cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &allowed))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+        if (cpus.empty())
+        {
+            return;
+        }
+        cpu_set_t target;
+        CPU_ZERO(&target);
+        CPU_SET(cpus[(index + 1) % cpus.size()], &target);
+        pthread_setaffinity_np(worker.native_handle(), sizeof(target), &target);
+    }
+
+    TaskScheduler()
+    {
+        size_t count = requestedWorkers();
+        if (count == SIZE_MAX)
+        {
+            const char *value = getenv("YADA_WORKERS");
+            // The thread waiting for the work runs tasks too
+            count = value ? strtoul(value, nullptr, 10) : max(1u, thread::hardware_concurrency()) - 1;
+        }
+        // Every worker may read the catalog and keeps its RCU reader slot
+        // until it exits; leave one slot for the main thread
+        count = min(count, RcuDomain::MAX_READERS - 1);
+        bool pinned = requestedPinning() == 1;
+        if (requestedPinning() < 0)
+        {
+            const char *value = getenv("YADA_PIN_WORKERS");
+            pinned = value && string(value) == "1";
+        }
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            workers.push_back(make_unique<Worker>());
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            workers[i]->runner = thread([this, i]
+                                        { workerLoop(static_cast<int>(i)); });
+            if (pinned)
+            {
+                pin(workers[i]->runner, i);
+            }
+        }
+    }
+
+public:
+    ~TaskScheduler()
+    {
+        {
+            lock_guard<mutex> lock(sleepMutex);
+            stopping.store(true);
+        }
+        wakeup.notify_all();
+        for (auto &worker : workers)
+        {
+            worker->runner.join();
+        }
+    }
+
+    static TaskScheduler &instance()
+    {
+        static TaskScheduler scheduler;
+        return scheduler;
+    }
+
+    // Worker count (0 runs everything on the calling thread; at most
+    // RcuDomain::MAX_READERS - 1) and whether workers are pinned to CPUs.
+    // They override YADA_WORKERS and YADA_PIN_WORKERS, and only take effect
+    // before the first use.
+    static void setWorkerCount(size_t count) { requestedWorkers() = count; }
+    static void setPinning(bool pinWorkers) { requestedPinning() = pinWorkers ? 1 : 0; }
+
+    size_t getWorkerCount() const { return workers.size(); }
+
+    // Runs function on a worker without waiting for it; it must not throw.
+    // With no workers it runs before post returns.
+    void post(function<void()> function)
+    {
+        if (workers.empty())
+        {
+            function();
+            return;
+        }
+        push(move(function));
+    }
+
+    // Calls body(first, last) for the blocks [begin + k * grain, ...) of at
+    // most grain indices, in parallel, and returns when all are done. Blocks
+    // are split off in halves, so idle workers steal large ranges first.
+    template <typename Body>
+    void parallelFor(size_t begin, size_t end, size_t grain, const Body &body)
+    {
+        if (end <= begin)
+        {
+            return;
+        }
+        grain = max<size_t>(grain, 1);
+        size_t blocks = (end - begin + grain - 1) / grain;
+        auto runBlock = [&](size_t block)
+        {
+            body(begin + block * grain, min(end, begin + (block + 1) * grain));
+        };
+        if (blocks == 1 || workers.empty())
+        {
+            for (size_t block = 0; block < blocks; ++block)
+            {
+                runBlock(block);
+            }
+            return;
+        }
+
+        TaskGroup group(*this);
+        function<void(size_t, size_t)> split = [&](size_t first, size_t last)
+        {
+            while (last - first > 1)
+            {
+                size_t middle = first + (last - first) / 2;
+                group.spawn([&split, middle, last]
+                            { split(middle, last); });
+                last = middle;
+            }
+            runBlock(first);
+        };
+        split(0, blocks);
+        group.wait();
+    }
+
+    // Number of blocks parallelFor uses for a range, for callers that keep
+    // one result per block: block k starts at begin + k * grain
+    static size_t blockCount(size_t begin, size_t end, size_t grain)
+    {
+        grain = max<size_t>(grain, 1);
+        return end <= begin ? 0 : (end - begin + grain - 1) / grain;
+    }
+};
+
+#endif
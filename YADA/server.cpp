@@ -0,0 +1,1029 @@
+#ifndef SERVER_CPP
+#define SERVER_CPP
+
+#include "food.cpp"
+#include "log.cpp"
+#include "profile.cpp"
+#include "users.cpp"
+#include <string>
+#include <vector>
+#include <map>
+#include <sstream>
+#include <csignal>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+using namespace std;
+
+// One parsed HTTP/1.1 request
+struct HttpRequest
+{
+    string method;
+    string path;               // Decoded, without the query string
+    map<string, string> query; // Decoded query parameters
+    string body;
+    bool keepAlive = true;
+};
+
+// A JSON response; status codes other than 2xx carry {"error": ...}
+struct HttpResponse
+{
+    int status = 200;
+    json body;
+
+    static HttpResponse error(int status, const string &message)
+    {
+        HttpResponse response;
+        response.status = status;
+        response.body = {{"error", message}};
+        return response;
+    }
+};
+
+// Serves a request/response protocol over stream sockets on one thread.
+// Connections are non-blocking and multiplexed with epoll; each one keeps
+// a read buffer that may hold several pipelined requests and a write buffer
+// that receives their responses in order. Requests are handled to completion
+// between polls, so the managers are never used concurrently. Subclasses
+// parse and answer the requests.
+class StreamServer
+{
+protected:
+    static constexpr size_t MAX_PENDING_OUTPUT = 1024 * 1024; // Stop reading past this until the client catches up
+
+    struct Connection
+    {
+        int fd;
+        string input;
+        string output;
+        size_t written = 0;       // Bytes of output already sent
+        bool peerClosed = false;  // No more input; answer what is buffered, then close
+        bool closeAfterWrite = false;
+        bool wantsWrite = false;  // EPOLLOUT registered
+        bool readPaused = false;  // EPOLLIN dropped for back-pressure
+    };
+
+    FoodManager &foodManager;
+    UserManager &userManager;
+    string defaultUser;
+
+    // Answers the complete requests in the buffer, in order, and sets
+    // closeAfterWrite when the connection is done. Returns true if it
+    // stopped early because too much output is pending.
+    virtual bool handleRequests(Connection &connection) = 0;
+
+    static bool hasOutputRoom(const Connection &connection)
+    {
+        return connection.output.size() - connection.written <= MAX_PENDING_OUTPUT;
+    }
+
+private:
+    static constexpr int MAX_EVENTS = 64;
+
+    int listenFd = -1;
+    int epollFd = -1;
+    string unixPath; // Socket file to remove on shutdown, empty for TCP
+    map<int, Connection> connections;
+
+    static volatile sig_atomic_t stopRequested;
+
+    static void onSignal(int) { stopRequested = 1; }
+
+    static bool setNonBlocking(int fd)
+    {
+        int flags = fcntl(fd, F_GETFL, 0);
+        return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+    }
+
+    bool watchListener(string &error)
+    {
+        epollFd = epoll_create1(0);
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = listenFd;
+        if (epollFd < 0 || epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event) < 0)
+        {
+            error = string("epoll: ") + strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    void updateInterest(Connection &connection)
+    {
+        bool wantWrite = connection.written < connection.output.size();
+        bool pauseRead = connection.peerClosed || connection.closeAfterWrite ||
+                         connection.output.size() - connection.written > MAX_PENDING_OUTPUT;
+        if (wantWrite == connection.wantsWrite && pauseRead == connection.readPaused)
+        {
+            return;
+        }
+
+        epoll_event event{};
+        event.events = (pauseRead ? 0 : uint32_t(EPOLLIN)) | (wantWrite ? uint32_t(EPOLLOUT) : 0);
+        event.data.fd = connection.fd;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, connection.fd, &event);
+        connection.wantsWrite = wantWrite;
+        connection.readPaused = pauseRead;
+    }
+
+    void closeConnection(int fd)
+    {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        connections.erase(fd);
+    }
+
+    void acceptConnections()
+    {
+        while (true)
+        {
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd < 0)
+            {
+                return; // EAGAIN once the backlog is drained; other errors are per-connection
+            }
+            setNonBlocking(fd);
+            if (unixPath.empty())
+            {
+                int on = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            }
+
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+            if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0)
+            {
+                close(fd);
+                continue;
+            }
+            connections[fd].fd = fd;
+        }
+    }
+
+    // Drains the socket into the input buffer
+    void readFrom(Connection &connection)
+    {
+        char buffer[16 * 1024];
+        while (true)
+        {
+            ssize_t count = recv(connection.fd, buffer, sizeof(buffer), 0);
+            if (count > 0)
+            {
+                connection.input.append(buffer, count);
+                continue;
+            }
+            if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                return;
+            }
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            // Peer closed (or failed): answer what is already buffered, then close
+            connection.peerClosed = true;
+            return;
+        }
+    }
+
+    // Returns false if the connection was closed
+    bool writeTo(Connection &connection)
+    {
+        while (connection.written < connection.output.size())
+        {
+            ssize_t count = send(connection.fd, connection.output.data() + connection.written,
+                                 connection.output.size() - connection.written, MSG_NOSIGNAL);
+            if (count < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    break;
+                }
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                closeConnection(connection.fd);
+                return false;
+            }
+            connection.written += count;
+        }
+
+        if (connection.written == connection.output.size())
+        {
+            connection.output.clear();
+            connection.written = 0;
+            if (connection.closeAfterWrite)
+            {
+                closeConnection(connection.fd);
+                return false;
+            }
+        }
+        else if (connection.written > MAX_PENDING_OUTPUT)
+        {
+            connection.output.erase(0, connection.written);
+            connection.written = 0;
+        }
+        return true;
+    }
+
+    void handleEvent(int fd, uint32_t events)
+    {
+        auto it = connections.find(fd);
+        if (it == connections.end())
+        {
+            return;
+        }
+        Connection &connection = it->second;
+
+        if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        {
+            readFrom(connection);
+        }
+        // Keep going while the client drains what we write, since requests
+        // held back by back-pressure will not trigger another event
+        bool more;
+        do
+        {
+            more = handleRequests(connection);
+            if (!writeTo(connection))
+            {
+                return;
+            }
+        } while (more && connection.output.empty());
+        updateInterest(connection);
+    }
+
+public:
+    StreamServer(FoodManager &foodManager, UserManager &userManager, const string &defaultUser)
+        : foodManager(foodManager), userManager(userManager), defaultUser(defaultUser) {}
+
+    virtual ~StreamServer()
+    {
+        for (const auto &[fd, _] : connections)
+        {
+            close(fd);
+        }
+        if (listenFd >= 0)
+        {
+            close(listenFd);
+        }
+        if (!unixPath.empty())
+        {
+            unlink(unixPath.c_str());
+        }
+        if (epollFd >= 0)
+        {
+            close(epollFd);
+        }
+    }
+
+    // Binds to address:port; port 0 picks a free one (see getPort)
+    bool listen(const string &address, int port, string &error)
+    {
+        sockaddr_in socketAddress{};
+        socketAddress.sin_family = AF_INET;
+        socketAddress.sin_port = htons(port);
+        if (inet_pton(AF_INET, address.c_str(), &socketAddress.sin_addr) != 1)
+        {
+            error = "Invalid address " + address;
+            return false;
+        }
+
+        listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (listenFd < 0 ||
+            bind(listenFd, reinterpret_cast<sockaddr *>(&socketAddress), sizeof(socketAddress)) < 0 ||
+            ::listen(listenFd, SOMAXCONN) < 0 || !setNonBlocking(listenFd))
+        {
+            error = string("Cannot listen on ") + address + ":" + to_string(port) + ": " + strerror(errno);
+            return false;
+        }
+        return watchListener(error);
+    }
+
+    // Binds to a Unix-domain socket at path. A socket file left behind by a
+    // server that is no longer running is replaced; a live one is not.
+    bool listenUnix(const string &path, string &error)
+    {
+        sockaddr_un socketAddress{};
+        if (path.empty() || path.size() >= sizeof(socketAddress.sun_path))
+        {
+            error = "Invalid socket path " + path;
+            return false;
+        }
+        socketAddress.sun_family = AF_UNIX;
+        memcpy(socketAddress.sun_path, path.c_str(), path.size());
+        auto address = reinterpret_cast<sockaddr *>(&socketAddress);
+
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (probe >= 0 && connect(probe, address, sizeof(socketAddress)) < 0 && errno == ECONNREFUSED)
+        {
+            unlink(path.c_str());
+        }
+        if (probe >= 0)
+        {
+            close(probe);
+        }
+
+        listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd < 0 || bind(listenFd, address, sizeof(socketAddress)) < 0 ||
+            ::listen(listenFd, SOMAXCONN) < 0 || !setNonBlocking(listenFd))
+        {
+            error = "Cannot listen on " + path + ": " + strerror(errno);
+            return false;
+        }
+        unixPath = path;
+        return watchListener(error);
+    }
+
+    int getPort() const
+    {
+        sockaddr_in socketAddress{};
+        socklen_t length = sizeof(socketAddress);
+        getsockname(listenFd, reinterpret_cast<sockaddr *>(&socketAddress), &length);
+        return ntohs(socketAddress.sin_port);
+    }
+
+    // Serves until SIGINT or SIGTERM, then saves modified data
+    void run()
+    {
+        stopRequested = 0;
+        struct sigaction action{};
+        action.sa_handler = onSignal;
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+
+        epoll_event events[MAX_EVENTS];
+        while (!stopRequested)
+        {
+            int count = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                cerr << "epoll_wait: " << strerror(errno) << "\n";
+                break;
+            }
+            foodManager.refreshShared();
+            for (int i = 0; i < count; ++i)
+            {
+                if (events[i].data.fd == listenFd)
+                {
+                    acceptConnections();
+                }
+                else
+                {
+                    handleEvent(events[i].data.fd, events[i].events);
+                }
+            }
+        }
+
+        saveAll();
+    }
+
+    // Saves the catalog and every loaded user that has changes
+    bool saveAll()
+    {
+        bool success = !foodManager.isModified() || foodManager.saveDatabase();
+        return userManager.saveModified() && success;
+    }
+};
+
+volatile sig_atomic_t StreamServer::stopRequested = 0;
+
+// Serves the food catalog, logs and profiles as HTTP/JSON.
+//
+// Endpoints (user selected with ?user=NAME, the default user otherwise):
+//   GET    /foods?q=k1+k2[&match=any]  search by keywords, all foods without q
+//   GET    /foods/ID                   food details and nutrients per serving
+//   GET    /log/DATE                   entries, totals and target for a day
+//   POST   /log/DATE                   {"foodId": ..., "quantity": "1.5" | "150g"}
+//   DELETE /log/DATE/ID                remove a food's entry from a day
+//   POST   /log/undo, /log/redo
+//   GET    /summary?from=DATE&to=DATE  totals and averages over a range
+//   GET    /profile[?date=DATE]        profile and the target in effect that day
+//   POST   /save                       write modified data to disk
+class HttpServer : public StreamServer
+{
+private:
+    static constexpr size_t MAX_HEADER_BYTES = 16 * 1024;
+    static constexpr size_t MAX_BODY_BYTES = 1024 * 1024;
+
+    // ---- HTTP parsing -------------------------------------------------
+
+    static string urlDecode(const string &text)
+    {
+        string result;
+        result.reserve(text.size());
+        for (size_t i = 0; i < text.size(); ++i)
+        {
+            if (text[i] == '+')
+            {
+                result += ' ';
+            }
+            else if (text[i] == '%' && i + 2 < text.size() &&
+                     isxdigit(static_cast<unsigned char>(text[i + 1])) &&
+                     isxdigit(static_cast<unsigned char>(text[i + 2])))
+            {
+                result += static_cast<char>(stoi(text.substr(i + 1, 2), nullptr, 16));
+                i += 2;
+            }
+            else
+            {
+                result += text[i];
+            }
+        }
+        return result;
+    }
+
+    static string lowercase(string text)
+    {
+        for (char &c : text)
+        {
+            c = tolower(static_cast<unsigned char>(c));
+        }
+        return text;
+    }
+
+    static string trim(const string &text)
+    {
+        size_t first = text.find_first_not_of(" \t");
+        if (first == string::npos)
+        {
+            return "";
+        }
+        return text.substr(first, text.find_last_not_of(" \t") - first + 1);
+    }
+
+    enum class ParseResult
+    {
+        Complete,
+        Incomplete,
+        Invalid
+    };
+
+    // Takes one request off the front of the buffer if it is complete. On
+    // Invalid, status and error describe the reply to send before closing.
+    static ParseResult parseRequest(string &buffer, HttpRequest &request, int &status, string &error)
+    {
+        size_t headerEnd = buffer.find("\r\n\r\n");
+        if (headerEnd == string::npos)
+        {
+            if (buffer.size() > MAX_HEADER_BYTES)
+            {
+                status = 431;
+                error = "Request headers too large";
+                return ParseResult::Invalid;
+            }
+            return ParseResult::Incomplete;
+        }
+
+        istringstream head(buffer.substr(0, headerEnd));
+        string requestLine;
+        getline(head, requestLine);
+        if (!requestLine.empty() && requestLine.back() == '\r')
+        {
+            requestLine.pop_back();
+        }
+
+        string target, version;
+        istringstream line(requestLine);
+        if (!(line >> request.method >> target >> version) || version.compare(0, 5, "HTTP/") != 0)
+        {
+            status = 400;
+            error = "Malformed request line";
+            return ParseResult::Invalid;
+        }
+        request.keepAlive = version != "HTTP/1.0";
+
+        size_t contentLength = 0;
+        string header;
+        while (getline(head, header))
+        {
+            if (!header.empty() && header.back() == '\r')
+            {
+                header.pop_back();
+            }
+            size_t colon = header.find(':');
+            if (colon == string::npos)
+            {
+                continue;
+            }
+            string name = lowercase(trim(header.substr(0, colon)));
+            string value = trim(header.substr(colon + 1));
+            if (name == "content-length")
+            {
+                char *end;
+                unsigned long long length = strtoull(value.c_str(), &end, 10);
+                if (value.empty() || *end != '\0' || length > MAX_BODY_BYTES)
+                {
+                    status = length > MAX_BODY_BYTES ? 413 : 400;
+                    error = length > MAX_BODY_BYTES ? "Request body too large" : "Invalid Content-Length";
+                    return ParseResult::Invalid;
+                }
+                contentLength = length;
+            }
+            else if (name == "transfer-encoding")
+            {
+                status = 501;
+                error = "Transfer-Encoding is not supported";
+                return ParseResult::Invalid;
+            }
+            else if (name == "connection")
+            {
+                string option = lowercase(value);
+                if (option == "close")
+                {
+                    request.keepAlive = false;
+                }
+                else if (option == "keep-alive")
+                {
+                    request.keepAlive = true;
+                }
+            }
+        }
+
+        size_t bodyStart = headerEnd + 4;
+        if (buffer.size() - bodyStart < contentLength)
+        {
+            return ParseResult::Incomplete;
+        }
+        request.body = buffer.substr(bodyStart, contentLength);
+        buffer.erase(0, bodyStart + contentLength);
+
+        size_t question = target.find('?');
+        request.path = urlDecode(target.substr(0, question));
+        if (question != string::npos)
+        {
+            istringstream pairs(target.substr(question + 1));
+            string pair;
+            while (getline(pairs, pair, '&'))
+            {
+                size_t equals = pair.find('=');
+                string key = urlDecode(pair.substr(0, equals));
+                request.query[key] = equals == string::npos ? "" : urlDecode(pair.substr(equals + 1));
+            }
+        }
+        return ParseResult::Complete;
+    }
+
+    static const char *reasonPhrase(int status)
+    {
+        switch (status)
+        {
+        case 200:
+            return "OK";
+        case 201:
+            return "Created";
+        case 400:
+            return "Bad Request";
+        case 404:
+            return "Not Found";
+        case 405:
+            return "Method Not Allowed";
+        case 413:
+            return "Payload Too Large";
+        case 431:
+            return "Request Header Fields Too Large";
+        case 501:
+            return "Not Implemented";
+        default:
+            return "Internal Server Error";
+        }
+    }
+
+    static void appendResponse(string &output, const HttpResponse &response, bool keepAlive)
+    {
+        string body = response.body.dump();
+        body += '\n';
+        output += "HTTP/1.1 " + to_string(response.status) + " " + reasonPhrase(response.status) + "\r\n";
+        output += "Content-Type: application/json\r\n";
+        output += "Content-Length: " + to_string(body.size()) + "\r\n";
+        output += keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+        output += body;
+    }
+
+    // ---- Endpoints ----------------------------------------------------
+
+    static vector<string> splitPath(const string &path)
+    {
+        vector<string> segments;
+        istringstream stream(path);
+        string segment;
+        while (getline(stream, segment, '/'))
+        {
+            if (!segment.empty())
+            {
+                segments.push_back(segment);
+            }
+        }
+        return segments;
+    }
+
+    static json nutrientsJson(const Nutrients &nutrients)
+    {
+        return {{"calories", nutrients.calories.toDouble()},
+                {"proteins", nutrients.proteins.toDouble()},
+                {"carbs", nutrients.carbs.toDouble()},
+                {"fats", nutrients.fats.toDouble()}};
+    }
+
+    static json foodSummary(const Food &food)
+    {
+        return {{"id", food.getId()},
+                {"type", food.getType()},
+                {"keywords", food.getKeywords()},
+                {"calories", food.getCaloriesPerServing()}};
+    }
+
+    HttpResponse searchFoods(const HttpRequest &request)
+    {
+        vector<shared_ptr<Food>> foods;
+        auto q = request.query.find("q");
+        if (q == request.query.end())
+        {
+            foods = foodManager.getAllFoods();
+        }
+        else
+        {
+            vector<string> keywords;
+            istringstream stream(q->second);
+            string keyword;
+            while (stream >> keyword)
+            {
+                keywords.push_back(keyword);
+            }
+            auto match = request.query.find("match");
+            bool matchAll = match == request.query.end() || match->second != "any";
+            foods = foodManager.searchFoods(keywords, matchAll);
+        }
+
+        json results = json::array();
+        for (const auto &food : foods)
+        {
+            results.push_back(foodSummary(*food));
+        }
+        HttpResponse response;
+        response.body = {{"foods", results}};
+        return response;
+    }
+
+    HttpResponse getFood(const string &id)
+    {
+        auto food = foodManager.getFoodById(id);
+        if (!food)
+        {
+            return HttpResponse::error(404, "Food '" + id + "' not found");
+        }
+        HttpResponse response;
+        response.body = food->toJson();
+        response.body["nutrientsPerServing"] = nutrientsJson(food->getNutrientsPerServing());
+        return response;
+    }
+
+    json dayJson(UserSession &session, int day)
+    {
+        json entries = json::array();
+        Nutrients totals;
+        session.logManager.forEachDayInRange(day, day, [&](int, const DailyLog &log)
+                                             {
+            for (const auto &entry : log.getEntries())
+            {
+                Nutrients nutrients = entry.getTotalNutrients(foodManager);
+                entries.push_back({{"foodId", entry.getFoodId()},
+                                   {"servings", entry.getServings().toJson()},
+                                   {"calories", nutrients.calories.toDouble()}});
+                totals += nutrients;
+            } });
+
+        double target = session.profileManager.getTargetCaloriesOn(day);
+        json result = {{"date", Date::format(day)},
+                       {"entries", entries},
+                       {"totals", nutrientsJson(totals)},
+                       {"targetCalories", target}};
+        if (target > 0)
+        {
+            result["remainingCalories"] = target - totals.calories.toDouble();
+        }
+        return result;
+    }
+
+    HttpResponse addToLog(UserSession &session, int day, const HttpRequest &request)
+    {
+        json body = json::parse(request.body, nullptr, false);
+        if (body.is_discarded() || !body.is_object() || !body.contains("foodId") || !body["foodId"].is_string())
+        {
+            return HttpResponse::error(400, "Expected {\"foodId\": ..., \"quantity\": ...}");
+        }
+
+        string foodId = body["foodId"].get<string>();
+        if (!foodManager.getFoodById(foodId))
+        {
+            return HttpResponse::error(404, "Food '" + foodId + "' not found");
+        }
+
+        // Servings as a number, or the same text the CLI accepts ("1.5", "150g")
+        string quantity = "1";
+        if (body.contains("quantity"))
+        {
+            const json &value = body["quantity"];
+            if (value.is_string())
+            {
+                quantity = value.get<string>();
+            }
+            else if (value.is_number())
+            {
+                quantity = Fixed::fromDouble(value.get<double>()).toString();
+            }
+            else
+            {
+                return HttpResponse::error(400, "quantity must be a number or a string");
+            }
+        }
+
+        Servings servings;
+        string error;
+        if (!foodManager.parseQuantity(foodId, quantity, servings, error))
+        {
+            return HttpResponse::error(400, error);
+        }
+
+        auto transaction = session.logManager.beginTransaction();
+        transaction.addFood(foodId, servings, day);
+        if (!transaction.commit(error))
+        {
+            return HttpResponse::error(400, error);
+        }
+
+        HttpResponse response;
+        response.status = 201;
+        response.body = dayJson(session, day);
+        return response;
+    }
+
+    HttpResponse removeFromLog(UserSession &session, int day, const string &foodId)
+    {
+        auto transaction = session.logManager.beginTransaction();
+        transaction.removeFood(foodId, day);
+        string error;
+        if (!transaction.commit(error))
+        {
+            return HttpResponse::error(404, error);
+        }
+
+        HttpResponse response;
+        response.body = dayJson(session, day);
+        return response;
+    }
+
+    HttpResponse summarize(UserSession &session, const HttpRequest &request)
+    {
+        auto from = request.query.find("from");
+        auto to = request.query.find("to");
+        int fromDay, toDay;
+        if (from == request.query.end() || to == request.query.end() ||
+            !Date::parse(from->second, fromDay) || !Date::parse(to->second, toDay) || fromDay > toDay)
+        {
+            return HttpResponse::error(400, "Expected from=YYYY-MM-DD&to=YYYY-MM-DD with from <= to");
+        }
+
+        RangeTotals range = session.logManager.summarizeRange(fromDay, toDay);
+        int calendarDays = toDay - fromDay + 1;
+        json result = {{"from", Date::format(fromDay)},
+                       {"to", Date::format(toDay)},
+                       {"calendarDays", calendarDays},
+                       {"loggedDays", range.loggedDays},
+                       {"totals", nutrientsJson(range.totals)}};
+
+        if (range.loggedDays > 0)
+        {
+            Fixed perLoggedDay = Fixed::fromInt(range.loggedDays);
+            Nutrients average = {range.totals.calories / perLoggedDay, range.totals.proteins / perLoggedDay,
+                                 range.totals.carbs / perLoggedDay, range.totals.fats / perLoggedDay};
+            result["averagePerLoggedDay"] = nutrientsJson(average);
+
+            // Same comparison as the CLI's range report
+            double targetTotal = 0;
+            int daysWithTarget = 0, daysOnTarget = 0;
+            session.logManager.forEachDayInRange(fromDay, toDay, [&](int day, const DailyLog &log)
+                                                 {
+                if (log.getEntries().empty())
+                {
+                    return;
+                }
+                double target = session.profileManager.getTargetCaloriesOn(day);
+                if (target <= 0)
+                {
+                    return;
+                }
+                double calories = log.getTotalCalories(foodManager);
+                targetTotal += target;
+                daysWithTarget++;
+                if (calories >= target * 0.9 && calories <= target * 1.1)
+                {
+                    daysOnTarget++;
+                } });
+            if (daysWithTarget > 0)
+            {
+                result["targetCalories"] = targetTotal;
+                result["daysWithTarget"] = daysWithTarget;
+                result["daysOnTarget"] = daysOnTarget;
+            }
+        }
+
+        HttpResponse response;
+        response.body = result;
+        return response;
+    }
+
+    HttpResponse getProfile(UserSession &session, const HttpRequest &request)
+    {
+        int day = Date::todayDayNumber();
+        auto date = request.query.find("date");
+        if (date != request.query.end() && !Date::parse(date->second, day))
+        {
+            return HttpResponse::error(400, "Invalid date '" + date->second + "'");
+        }
+
+        HttpResponse response;
+        response.body = session.profileManager.getProfile().toJson();
+        response.body["date"] = Date::format(day);
+        response.body["targetCalories"] = session.profileManager.getTargetCaloriesOn(day);
+        return response;
+    }
+
+    HttpResponse route(const HttpRequest &request)
+    {
+        vector<string> segments = splitPath(request.path);
+        const string &method = request.method;
+        if (segments.empty())
+        {
+            return HttpResponse::error(404, "Not found");
+        }
+
+        if (segments[0] == "foods")
+        {
+            if (method != "GET")
+            {
+                return HttpResponse::error(405, "Use GET");
+            }
+            if (segments.size() == 1)
+            {
+                return searchFoods(request);
+            }
+            if (segments.size() == 2)
+            {
+                return getFood(segments[1]);
+            }
+            return HttpResponse::error(404, "Not found");
+        }
+
+        if (segments[0] == "save" && segments.size() == 1)
+        {
+            if (method != "POST")
+            {
+                return HttpResponse::error(405, "Use POST");
+            }
+            HttpResponse response;
+            response.body = {{"saved", saveAll()}};
+            return response;
+        }
+
+        // Everything else belongs to a user
+        string user = defaultUser;
+        auto userParam = request.query.find("user");
+        if (userParam != request.query.end())
+        {
+            user = userParam->second;
+        }
+        if (!UserManager::isValidName(user))
+        {
+            return HttpResponse::error(400, "Invalid user name '" + user + "'");
+        }
+        // Only a request that may change something creates the user
+        UserSession *found = method == "GET" ? userManager.findSession(user) : &userManager.getSession(user);
+        if (!found)
+        {
+            return HttpResponse::error(404, "Unknown user '" + user + "'");
+        }
+        UserSession &session = *found;
+
+        if (segments[0] == "log" && segments.size() == 2 && (segments[1] == "undo" || segments[1] == "redo"))
+        {
+            if (method != "POST")
+            {
+                return HttpResponse::error(405, "Use POST");
+            }
+            bool done = segments[1] == "undo" ? session.logManager.undo() : session.logManager.redo();
+            HttpResponse response;
+            response.body = {{segments[1] == "undo" ? "undone" : "redone", done}};
+            return response;
+        }
+
+        if (segments[0] == "log" && (segments.size() == 2 || segments.size() == 3))
+        {
+            int day;
+            if (!Date::parse(segments[1], day))
+            {
+                return HttpResponse::error(400, "Invalid date '" + segments[1] + "'");
+            }
+            if (segments.size() == 3)
+            {
+                if (method != "DELETE")
+                {
+                    return HttpResponse::error(405, "Use DELETE");
+                }
+                return removeFromLog(session, day, segments[2]);
+            }
+            if (method == "GET")
+            {
+                HttpResponse response;
+                response.body = dayJson(session, day);
+                return response;
+            }
+            if (method == "POST")
+            {
+                return addToLog(session, day, request);
+            }
+            return HttpResponse::error(405, "Use GET or POST");
+        }
+
+        if (segments[0] == "summary" && segments.size() == 1)
+        {
+            if (method != "GET")
+            {
+                return HttpResponse::error(405, "Use GET");
+            }
+            return summarize(session, request);
+        }
+
+        if (segments[0] == "profile" && segments.size() == 1)
+        {
+            if (method != "GET")
+            {
+                return HttpResponse::error(405, "Use GET");
+            }
+            return getProfile(session, request);
+        }
+
+        return HttpResponse::error(404, "Not found");
+    }
+
+    bool handleRequests(Connection &connection) override
+    {
+        while (!connection.closeAfterWrite && hasOutputRoom(connection))
+        {
+            HttpRequest request;
+            int status = 400;
+            string error;
+            ParseResult result = parseRequest(connection.input, request, status, error);
+            if (result == ParseResult::Incomplete)
+            {
+                connection.closeAfterWrite = connection.peerClosed;
+                return false;
+            }
+            if (result == ParseResult::Invalid)
+            {
+                appendResponse(connection.output, HttpResponse::error(status, error), false);
+                connection.closeAfterWrite = true;
+                connection.input.clear();
+                return false;
+            }
+
+            HttpResponse response;
+            try
+            {
+                response = route(request);
+            }
+            catch (exception &e)
+            {
+                response = HttpResponse::error(500, e.what());
+            }
+            appendResponse(connection.output, response, request.keepAlive);
+            if (!request.keepAlive)
+            {
+                connection.closeAfterWrite = true;
+            }
+        }
+        return !connection.closeAfterWrite;
+    }
+
+public:
+    HttpServer(FoodManager &foodManager, UserManager &userManager, const string &defaultUser)
+        : StreamServer(foodManager, userManager, defaultUser) {}
+};
+
+#endif
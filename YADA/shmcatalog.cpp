@@ -0,0 +1,590 @@
+#ifndef SHMCATALOG_CPP
+#define SHMCATALOG_CPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+using namespace std;
+
+// A food catalog published in POSIX shared memory, so that many processes
+// on one host map a single copy instead of each parsing its own. One
+// process publishes (see FoodManager::publishShared); others attach
+// read-only (FoodManager::attachShared).
+//
+// Each published version is a segment of its own, "/yada-<name>.<generation>",
+// never changed once published. The control object "/yada-<name>" holds the
+// current generation: publishing writes a new segment, then swaps the
+// generation atomically and unlinks the previous segment. Processes that
+// mapped it keep their mapping until they move on.
+//
+// Segment layout (host byte order, as the columnar export): a
+// SharedCatalogHeader, then the sections at the offsets it lists, each
+// 8-byte aligned. Foods are ordered by ID. Amounts are int64 thousandths.
+//
+//   FoodIds, Descriptions     SharedText[foodCount]
+//   FoodTypes                 uint8[foodCount], 0 basic, 1 composite
+//   Calories ... ServingGrams int64[foodCount], per serving
+//   KeywordFirst              uint32[foodCount + 1], ranges of KeywordRefs
+//   KeywordRefs               SharedText[], each food's keywords in order
+//   RecipeOf                  uint32[foodCount], recipe of a composite
+//   ComponentFirst            uint32[recipeCount + 1], ranges of the components
+//   ComponentIds              SharedText[], component food IDs, sorted per recipe
+//   ComponentServings         int64[]
+//   KeywordTexts              SharedText[keywordCount], distinct keywords, sorted
+//   PostingFirst              uint32[keywordCount + 1], ranges of Postings
+//   Postings                  uint32[], food numbers having the keyword, ascending
+//   Heap                      the bytes of all texts
+
+constexpr char SHARED_CATALOG_MAGIC[8] = {'Y', 'A', 'D', 'A', 'S', 'H', 'M', '1'};
+constexpr uint32_t SHARED_CATALOG_FORMAT = 1;
+
+enum class SharedSection : uint32_t
+{
+    FoodIds,
+    Descriptions,
+    FoodTypes,
+    Calories,
+    Proteins,
+    Carbs,
+    Fats,
+    ServingGrams,
+    KeywordFirst,
+    KeywordRefs,
+    RecipeOf,
+    ComponentFirst,
+    ComponentIds,
+    ComponentServings,
+    KeywordTexts,
+    PostingFirst,
+    Postings,
+    Heap,
+    SectionCount
+};
+
+struct SharedText
+{
+    uint32_t offset; // Into the heap
+    uint32_t length;
+};
+
+struct SharedCatalogHeader
+{
+    char magic[8];
+    uint32_t format;
+    uint32_t headerBytes;
+    uint64_t generation;
+    uint64_t totalBytes;
+    uint64_t foodCount;
+    uint64_t recipeCount;
+    uint64_t keywordCount;
+    uint64_t sectionOffset[size_t(SharedSection::SectionCount)];
+    uint64_t sectionBytes[size_t(SharedSection::SectionCount)];
+};
+
+struct SharedCatalogControl
+{
+    char magic[8];
+    atomic<uint64_t> generation; // 0 before the first publish
+};
+
+static_assert(atomic<uint64_t>::is_always_lock_free, "the generation is shared between processes");
+
+// One food as given to SharedCatalogBuilder
+struct SharedFoodRecord
+{
+    string id;
+    bool composite = false;
+    int64_t calories = 0;
+    int64_t proteins = 0;
+    int64_t carbs = 0;
+    int64_t fats = 0;
+    int64_t servingGrams = 0;
+    string description; // Basic foods only
+    vector<string> keywords;
+    uint32_t recipe = 0; // Composites: number returned by addRecipe
+};
+
+// Assembles a segment image. Foods must be added in ascending ID order;
+// recipes shared by several composites are added once.
+class SharedCatalogBuilder
+{
+private:
+    vector<SharedText> ids, descriptions, keywordRefs, componentIds;
+    vector<uint8_t> types;
+    vector<int64_t> calories, proteins, carbs, fats, servingGrams, componentServings;
+    vector<uint32_t> keywordFirst{0}, recipeOf, componentFirst{0};
+    map<string, vector<uint32_t>> postings;
+    string heap;
+    unordered_map<string, SharedText> texts; // Each distinct text is stored once
+
+    SharedText text(const string &value)
+    {
+        auto [entry, inserted] = texts.emplace(value, SharedText{static_cast<uint32_t>(heap.size()),
+                                                                 static_cast<uint32_t>(value.size())});
+        if (inserted)
+        {
+            heap += value;
+        }
+        return entry->second;
+    }
+
+    template <typename T>
+    static void appendSection(string &image, SharedCatalogHeader &header, SharedSection section, const vector<T> &values)
+    {
+        image.resize((image.size() + 7) / 8 * 8, '\0');
+        header.sectionOffset[size_t(section)] = image.size();
+        header.sectionBytes[size_t(section)] = values.size() * sizeof(T);
+        image.append(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(T));
+    }
+
+public:
+    uint32_t addRecipe(const vector<pair<string, int64_t>> &components)
+    {
+        for (const auto &[foodId, servings] : components)
+        {
+            componentIds.push_back(text(foodId));
+            componentServings.push_back(servings);
+        }
+        componentFirst.push_back(static_cast<uint32_t>(componentIds.size()));
+        return static_cast<uint32_t>(componentFirst.size() - 2);
+    }
+
+    void addFood(const SharedFoodRecord &food)
+    {
+        uint32_t number = static_cast<uint32_t>(ids.size());
+        ids.push_back(text(food.id));
+        descriptions.push_back(text(food.description));
+        types.push_back(food.composite ? 1 : 0);
+        calories.push_back(food.calories);
+        proteins.push_back(food.proteins);
+        carbs.push_back(food.carbs);
+        fats.push_back(food.fats);
+        servingGrams.push_back(food.servingGrams);
+        recipeOf.push_back(food.recipe);
+        for (const auto &keyword : food.keywords)
+        {
+            keywordRefs.push_back(text(keyword));
+            auto &foods = postings[keyword];
+            if (foods.empty() || foods.back() != number)
+            {
+                foods.push_back(number);
+            }
+        }
+        keywordFirst.push_back(static_cast<uint32_t>(keywordRefs.size()));
+    }
+
+    string build(uint64_t generation)
+    {
+        vector<SharedText> keywordTexts;
+        vector<uint32_t> postingFirst{0}, postingList;
+        for (const auto &[keyword, foods] : postings)
+        {
+            keywordTexts.push_back(text(keyword));
+            postingList.insert(postingList.end(), foods.begin(), foods.end());
+            postingFirst.push_back(static_cast<uint32_t>(postingList.size()));
+        }
+
+        SharedCatalogHeader header{};
+        memcpy(header.magic, SHARED_CATALOG_MAGIC, sizeof(header.magic));
+        header.format = SHARED_CATALOG_FORMAT;
+        header.headerBytes = sizeof(header);
+        header.generation = generation;
+        header.foodCount = ids.size();
+        header.recipeCount = componentFirst.size() - 1;
+        header.keywordCount = keywordTexts.size();
+
+        string image(sizeof(header), '\0');
+        appendSection(image, header, SharedSection::FoodIds, ids);
+        appendSection(image, header, SharedSection::Descriptions, descriptions);
+        appendSection(image, header, SharedSection::FoodTypes, types);
+        appendSection(image, header, SharedSection::Calories, calories);
+        appendSection(image, header, SharedSection::Proteins, proteins);
+        appendSection(image, header, SharedSection::Carbs, carbs);
+        appendSection(image, header, SharedSection::Fats, fats);
+        appendSection(image, header, SharedSection::ServingGrams, servingGrams);
+        appendSection(image, header, SharedSection::KeywordFirst, keywordFirst);
+        appendSection(image, header, SharedSection::KeywordRefs, keywordRefs);
+        appendSection(image, header, SharedSection::RecipeOf, recipeOf);
+        appendSection(image, header, SharedSection::ComponentFirst, componentFirst);
+        appendSection(image, header, SharedSection::ComponentIds, componentIds);
+        appendSection(image, header, SharedSection::ComponentServings, componentServings);
+        appendSection(image, header, SharedSection::KeywordTexts, keywordTexts);
+        appendSection(image, header, SharedSection::PostingFirst, postingFirst);
+        appendSection(image, header, SharedSection::Postings, postingList);
+        appendSection(image, header, SharedSection::Heap, vector<char>(heap.begin(), heap.end()));
+        header.totalBytes = image.size();
+        memcpy(&image[0], &header, sizeof(header));
+        return image;
+    }
+};
+
+// A read-only mapping of one published segment. Only the header and the
+// section table are checked when attaching: the segments are written by
+// YADA processes of the same host, which are trusted.
+class SharedCatalog
+{
+public:
+    static constexpr size_t npos = SIZE_MAX;
+
+private:
+    struct Mapping
+    {
+        void *data = MAP_FAILED;
+        size_t size = 0;
+
+        Mapping() = default;
+        Mapping(const Mapping &) = delete;
+        Mapping &operator=(const Mapping &) = delete;
+
+        ~Mapping()
+        {
+            if (data != MAP_FAILED)
+            {
+                munmap(data, size);
+            }
+        }
+
+        bool map(int fd, size_t bytes, int protection)
+        {
+            data = mmap(nullptr, bytes, protection, MAP_SHARED, fd, 0);
+            size = bytes;
+            return data != MAP_FAILED;
+        }
+    };
+
+    Mapping control;
+    Mapping segment;
+    const SharedCatalogHeader *header = nullptr;
+
+    static string controlName(const string &name) { return "/yada-" + name; }
+
+    static string segmentName(const string &name, uint64_t generation)
+    {
+        return "/yada-" + name + "." + to_string(generation);
+    }
+
+    static bool fail(const string &message, string &error)
+    {
+        error = message + (errno ? string(": ") + strerror(errno) : "");
+        return false;
+    }
+
+    // publish creates the control object before sizing it; mapping it in
+    // between would fault on the first read
+    static bool isControlReady(int controlFd)
+    {
+        struct stat info;
+        return fstat(controlFd, &info) == 0 && static_cast<size_t>(info.st_size) >= sizeof(SharedCatalogControl);
+    }
+
+    template <typename T>
+    const T *section(SharedSection which) const
+    {
+        return reinterpret_cast<const T *>(static_cast<const char *>(segment.data) + header->sectionOffset[size_t(which)]);
+    }
+
+    string_view text(const SharedText &value) const
+    {
+        return string_view(section<char>(SharedSection::Heap) + value.offset, value.length);
+    }
+
+    bool validate(uint64_t generation, string &error) const
+    {
+        errno = 0;
+        if (segment.size < sizeof(SharedCatalogHeader) ||
+            memcmp(header->magic, SHARED_CATALOG_MAGIC, sizeof(header->magic)) != 0 ||
+            header->format != SHARED_CATALOG_FORMAT || header->headerBytes != sizeof(SharedCatalogHeader))
+        {
+            return fail("Not a shared catalog of this version", error);
+        }
+        if (header->generation != generation || header->totalBytes != segment.size)
+        {
+            return fail("Shared catalog segment is inconsistent", error);
+        }
+
+        uint64_t foods = header->foodCount, recipes = header->recipeCount, keywords = header->keywordCount;
+        const uint64_t fixedBytes[size_t(SharedSection::SectionCount)] = {
+            foods * sizeof(SharedText), foods * sizeof(SharedText), foods, foods * 8, foods * 8, foods * 8, foods * 8,
+            foods * 8, (foods + 1) * 4, 0, foods * 4, (recipes + 1) * 4, 0, 0, keywords * sizeof(SharedText),
+            (keywords + 1) * 4, 0, 0};
+        for (size_t i = 0; i < size_t(SharedSection::SectionCount); ++i)
+        {
+            uint64_t offset = header->sectionOffset[i], bytes = header->sectionBytes[i];
+            if (offset % 8 != 0 || offset > segment.size || bytes > segment.size - offset ||
+                (fixedBytes[i] != 0 && bytes != fixedBytes[i]))
+            {
+                return fail("Shared catalog section " + to_string(i) + " is out of bounds", error);
+            }
+        }
+        return true;
+    }
+
+    // Range [first, last) of the postings of a keyword; empty if unknown
+    pair<const uint32_t *, const uint32_t *> postingsOf(const string &keyword) const
+    {
+        const SharedText *keywords = section<SharedText>(SharedSection::KeywordTexts);
+        const SharedText *end = keywords + header->keywordCount;
+        const SharedText *found = lower_bound(keywords, end, keyword, [&](const SharedText &entry, const string &key)
+                                              { return text(entry) < key; });
+        if (found == end || text(*found) != keyword)
+        {
+            return {nullptr, nullptr};
+        }
+        const uint32_t *first = section<uint32_t>(SharedSection::PostingFirst);
+        const uint32_t *postings = section<uint32_t>(SharedSection::Postings);
+        size_t index = found - keywords;
+        return {postings + first[index], postings + first[index + 1]};
+    }
+
+public:
+    // Maps the current segment of the named catalog. Names are made of
+    // letters, digits, '-' and '_'.
+    static shared_ptr<SharedCatalog> attach(const string &name, string &error)
+    {
+        int controlFd = shm_open(controlName(name).c_str(), O_RDONLY | O_CLOEXEC, 0);
+        if (controlFd < 0)
+        {
+            fail("Cannot open shared catalog " + name, error);
+            return nullptr;
+        }
+        if (!isControlReady(controlFd))
+        {
+            close(controlFd);
+            errno = 0;
+            fail("Shared catalog " + name + " has not been published", error);
+            return nullptr;
+        }
+        auto catalog = make_shared<SharedCatalog>();
+        bool mapped = catalog->control.map(controlFd, sizeof(SharedCatalogControl), PROT_READ);
+        close(controlFd);
+        if (!mapped)
+        {
+            fail("Cannot map shared catalog " + name, error);
+            return nullptr;
+        }
+        const auto *state = static_cast<const SharedCatalogControl *>(catalog->control.data);
+
+        // The segment of a generation is unlinked once the next one is
+        // published; read the generation again and retry if that happened
+        for (int attempt = 0; attempt < 8; ++attempt)
+        {
+            uint64_t generation = state->generation.load(memory_order_acquire);
+            if (generation == 0)
+            {
+                errno = 0;
+                fail("Shared catalog " + name + " has not been published", error);
+                return nullptr;
+            }
+            int fd = shm_open(segmentName(name, generation).c_str(), O_RDONLY | O_CLOEXEC, 0);
+            if (fd < 0 && errno == ENOENT)
+            {
+                continue;
+            }
+            struct stat info;
+            if (fd < 0 || fstat(fd, &info) != 0 || !catalog->segment.map(fd, info.st_size, PROT_READ))
+            {
+                fail("Cannot map shared catalog " + name, error);
+                if (fd >= 0)
+                {
+                    close(fd);
+                }
+                return nullptr;
+            }
+            close(fd);
+            catalog->header = static_cast<const SharedCatalogHeader *>(catalog->segment.data);
+            return catalog->validate(generation, error) ? catalog : nullptr;
+        }
+        errno = 0;
+        fail("Shared catalog " + name + " keeps changing", error);
+        return nullptr;
+    }
+
+    // Publishes a new generation of the named catalog and returns it.
+    // Publishers of the same name are serialized with a lock on the control
+    // object.
+    static uint64_t publish(const string &name, SharedCatalogBuilder &builder, string &error)
+    {
+        int controlFd = shm_open(controlName(name).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (controlFd < 0)
+        {
+            fail("Cannot create shared catalog " + name, error);
+            return 0;
+        }
+        Mapping control;
+        struct stat info;
+        if (flock(controlFd, LOCK_EX) != 0 || fstat(controlFd, &info) != 0 ||
+            (info.st_size == 0 && ftruncate(controlFd, sizeof(SharedCatalogControl)) != 0) ||
+            !control.map(controlFd, sizeof(SharedCatalogControl), PROT_READ | PROT_WRITE))
+        {
+            fail("Cannot open shared catalog " + name, error);
+            close(controlFd); // Releases the lock
+            return 0;
+        }
+        auto *state = static_cast<SharedCatalogControl *>(control.data);
+        memcpy(state->magic, SHARED_CATALOG_MAGIC, sizeof(state->magic));
+
+        uint64_t previous = state->generation.load(memory_order_relaxed);
+        uint64_t generation = previous + 1;
+        string image = builder.build(generation);
+        string segmentPath = segmentName(name, generation);
+        shm_unlink(segmentPath.c_str()); // Left over by a publisher that died
+        int fd = shm_open(segmentPath.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        Mapping segment;
+        if (fd < 0 || ftruncate(fd, image.size()) != 0 || !segment.map(fd, image.size(), PROT_READ | PROT_WRITE))
+        {
+            fail("Cannot create shared catalog segment " + segmentPath, error);
+            if (fd >= 0)
+            {
+                close(fd);
+                shm_unlink(segmentPath.c_str());
+            }
+            close(controlFd);
+            return 0;
+        }
+        close(fd);
+        memcpy(segment.data, image.data(), image.size());
+
+        state->generation.store(generation, memory_order_release);
+        if (previous != 0)
+        {
+            shm_unlink(segmentName(name, previous).c_str());
+        }
+        close(controlFd);
+        return generation;
+    }
+
+    // Unlinks the named catalog; processes attached to it keep their mapping
+    static bool remove(const string &name, string &error)
+    {
+        int controlFd = shm_open(controlName(name).c_str(), O_RDONLY | O_CLOEXEC, 0);
+        if (controlFd < 0)
+        {
+            return fail("Cannot open shared catalog " + name, error);
+        }
+        Mapping control;
+        if (isControlReady(controlFd) && control.map(controlFd, sizeof(SharedCatalogControl), PROT_READ))
+        {
+            uint64_t generation = static_cast<const SharedCatalogControl *>(control.data)->generation.load();
+            shm_unlink(segmentName(name, generation).c_str());
+        }
+        close(controlFd);
+        shm_unlink(controlName(name).c_str());
+        return true;
+    }
+
+    static bool isValidName(const string &name)
+    {
+        return !name.empty() && name.size() <= 64 &&
+               all_of(name.begin(), name.end(), [](char c)
+                      { return isalnum(static_cast<unsigned char>(c)) || c == '-' || c == '_'; });
+    }
+
+    uint64_t getGeneration() const { return header->generation; }
+
+    // True once a newer generation has been published
+    bool isStale() const
+    {
+        return static_cast<const SharedCatalogControl *>(control.data)->generation.load(memory_order_acquire) !=
+               header->generation;
+    }
+
+    size_t size() const { return header->foodCount; }
+    size_t getRecipeCount() const { return header->recipeCount; }
+
+    // Number of the food with the given ID, or npos
+    size_t find(string_view id) const
+    {
+        const SharedText *ids = section<SharedText>(SharedSection::FoodIds);
+        const SharedText *end = ids + header->foodCount;
+        const SharedText *found = lower_bound(ids, end, id, [&](const SharedText &entry, string_view key)
+                                              { return text(entry) < key; });
+        return found != end && text(*found) == id ? found - ids : npos;
+    }
+
+    string_view getId(size_t food) const { return text(section<SharedText>(SharedSection::FoodIds)[food]); }
+    string_view getDescription(size_t food) const { return text(section<SharedText>(SharedSection::Descriptions)[food]); }
+    bool isComposite(size_t food) const { return section<uint8_t>(SharedSection::FoodTypes)[food] != 0; }
+    int64_t getCalories(size_t food) const { return section<int64_t>(SharedSection::Calories)[food]; }
+    int64_t getProteins(size_t food) const { return section<int64_t>(SharedSection::Proteins)[food]; }
+    int64_t getCarbs(size_t food) const { return section<int64_t>(SharedSection::Carbs)[food]; }
+    int64_t getFats(size_t food) const { return section<int64_t>(SharedSection::Fats)[food]; }
+    int64_t getServingGrams(size_t food) const { return section<int64_t>(SharedSection::ServingGrams)[food]; }
+    uint32_t getRecipe(size_t food) const { return section<uint32_t>(SharedSection::RecipeOf)[food]; }
+
+    vector<string> getKeywords(size_t food) const
+    {
+        const uint32_t *first = section<uint32_t>(SharedSection::KeywordFirst);
+        const SharedText *refs = section<SharedText>(SharedSection::KeywordRefs);
+        vector<string> keywords;
+        for (uint32_t i = first[food]; i < first[food + 1]; ++i)
+        {
+            keywords.emplace_back(text(refs[i]));
+        }
+        return keywords;
+    }
+
+    // Component food IDs and servings in thousandths, sorted by ID
+    vector<pair<string, int64_t>> getComponents(uint32_t recipe) const
+    {
+        const uint32_t *first = section<uint32_t>(SharedSection::ComponentFirst);
+        vector<pair<string, int64_t>> components;
+        for (uint32_t i = first[recipe]; i < first[recipe + 1]; ++i)
+        {
+            components.emplace_back(string(text(section<SharedText>(SharedSection::ComponentIds)[i])),
+                                    section<int64_t>(SharedSection::ComponentServings)[i]);
+        }
+        return components;
+    }
+
+    // Numbers of the foods with all (or any) of the keywords, ascending, as
+    // FoodManager::matchesKeywords selects them
+    vector<size_t> search(const vector<string> &keywords, bool matchAll) const
+    {
+        vector<size_t> result;
+        if (keywords.empty())
+        {
+            if (matchAll)
+            {
+                for (size_t food = 0; food < size(); ++food)
+                {
+                    result.push_back(food);
+                }
+            }
+            return result;
+        }
+
+        auto [first, last] = postingsOf(keywords[0]);
+        result.assign(first, last);
+        for (size_t k = 1; k < keywords.size(); ++k)
+        {
+            auto [from, to] = postingsOf(keywords[k]);
+            vector<size_t> merged;
+            if (matchAll)
+            {
+                set_intersection(result.begin(), result.end(), from, to, back_inserter(merged));
+            }
+            else
+            {
+                set_union(result.begin(), result.end(), from, to, back_inserter(merged));
+            }
+            result.swap(merged);
+        }
+        return result;
+    }
+};
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef STORAGE_CPP
+#define STORAGE_CPP
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <exception>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+using namespace std;
+
+// The contents of one data file as they were when it was captured. Turning
+// them into text is left to render(), so that the JSON can be built and
+// written on another thread; whatever render() reads must not change after
+// the capture.
+struct FileSnapshot
+{
+    string path;
+    function<string()> render;
+};
+
+// Writes a file through a temporary next to it that is then renamed over
+// it, so an interrupted save leaves either the old or the new contents.
+// With sync, the data and the rename are on disk before this returns.
+inline bool writeFileAtomically(const string &path, const string &contents, bool sync, string &error)
+{
+    string temporary = path + ".tmp";
+    int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        error = path + ": " + strerror(errno);
+        return false;
+    }
+
+    size_t written = 0;
+    while (written < contents.size())
+    {
+        ssize_t n = write(fd, contents.data() + written, contents.size() - written);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            error = path + ": " + strerror(errno);
+            close(fd);
+            unlink(temporary.c_str());
+            return false;
+        }
+        written += n;
+    }
+
+    if ((sync && fsync(fd) != 0) || close(fd) != 0)
+    {
+        error = path + ": " + strerror(errno);
+        unlink(temporary.c_str());
+        return false;
+    }
+
+    if (rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        error = path + ": " + strerror(errno);
+        unlink(temporary.c_str());
+        return false;
+    }
+
+    if (sync)
+    {
+        // The rename is only durable once the directory is flushed too
+        size_t slash = path.rfind('/');
+        string directory = slash == string::npos ? "." : path.substr(0, slash + 1);
+        int dirFd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirFd >= 0)
+        {
+            fsync(dirFd);
+            close(dirFd);
+        }
+    }
+    return true;
+}
+
+// Renders and writes one snapshot; a render that throws counts as a failure
+inline bool writeSnapshot(const FileSnapshot &snapshot, bool sync, string &error)
+{
+    try
+    {
+        return writeFileAtomically(snapshot.path, snapshot.render(), sync, error);
+    }
+    catch (exception &e)
+    {
+        error = snapshot.path + ": " + e.what();
+        return false;
+    }
+}
+
+// Writes all snapshots, stopping at the first failure
+inline bool writeSnapshots(const vector<FileSnapshot> &snapshots, bool sync, string &error)
+{
+    for (const auto &snapshot : snapshots)
+    {
+        if (!writeSnapshot(snapshot, sync, error))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif
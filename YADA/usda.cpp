@@ -0,0 +1,356 @@
+#ifndef USDA_CPP
+#define USDA_CPP
+
+#include "httpclient.cpp"
+#include "json.hpp"
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <ctime>
+#include <chrono>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/stat.h>
+using namespace std;
+using json = nlohmann::json;
+
+// Searches of the USDA FoodData Central database. Responses are kept on
+// disk by normalized query for a time, so a repeated search is answered
+// without the network; a cached response that has expired is still used
+// when the service cannot be reached.
+class UsdaClient
+{
+public:
+    struct Options
+    {
+        string endpoint = "https://api.nal.usda.gov/fdc/v1";
+        string apiKey = "R9OFzkfROTGUedVA6omCI3g9dzoBQkgkkekOwiTj";
+        string cacheDirectory = "usda_cache";
+        long cacheSeconds = 7 * 24 * 3600; // 0 disables the cache
+        size_t maxConcurrent = 4;          // Requests in flight at once
+
+        // The defaults, overridden by YADA_USDA_ENDPOINT (for example a
+        // mock server on localhost), YADA_USDA_API_KEY and YADA_USDA_CACHE_TTL
+        static Options fromEnvironment()
+        {
+            Options options;
+            if (const char *value = getenv("YADA_USDA_ENDPOINT"))
+            {
+                options.endpoint = value;
+            }
+            if (const char *value = getenv("YADA_USDA_API_KEY"))
+            {
+                options.apiKey = value;
+            }
+            if (const char *value = getenv("YADA_USDA_CACHE_TTL"))
+            {
+                options.cacheSeconds = strtol(value, nullptr, 10);
+            }
+            while (!options.endpoint.empty() && options.endpoint.back() == '/')
+            {
+                options.endpoint.pop_back();
+            }
+            return options;
+        }
+    };
+
+    struct Result
+    {
+        string query;
+        bool ok = false;
+        bool cached = false; // Answered from the cache
+        bool stale = false;  // From an expired cache entry, the service failed
+        json response;       // The search response, when ok
+        string error;
+    };
+
+private:
+    Options options;
+    shared_ptr<HttpTransport> transport;
+
+    // Lowercase, with runs of white space made one space and none at the ends
+    static string normalize(const string &query)
+    {
+        string normalized;
+        bool space = false;
+        for (char c : query)
+        {
+            if (isspace(static_cast<unsigned char>(c)))
+            {
+                space = !normalized.empty();
+                continue;
+            }
+            if (space)
+            {
+                normalized += ' ';
+                space = false;
+            }
+            normalized += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        }
+        return normalized;
+    }
+
+    static string encodeComponent(const string &text)
+    {
+        static const char HEX[] = "0123456789ABCDEF";
+        string encoded;
+        for (unsigned char c : text)
+        {
+            if (isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~')
+            {
+                encoded += static_cast<char>(c);
+            }
+            else
+            {
+                encoded += '%';
+                encoded += HEX[c >> 4];
+                encoded += HEX[c & 15];
+            }
+        }
+        return encoded;
+    }
+
+    // FNV-1a of the normalized query; the query is stored in the file too,
+    // so a collision is a miss
+    string cachePath(const string &key) const
+    {
+        uint64_t hash = 1469598103934665603ull;
+        for (unsigned char c : key)
+        {
+            hash = (hash ^ c) * 1099511628211ull;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.json", static_cast<unsigned long long>(hash));
+        return options.cacheDirectory + "/" + name;
+    }
+
+    // A cache file is a line with the time it was fetched and the query,
+    // then the response body
+    bool readCache(const string &key, string &body, bool &fresh) const
+    {
+        if (options.cacheSeconds <= 0)
+        {
+            return false;
+        }
+        ifstream file(cachePath(key), ios::binary);
+        string header;
+        if (!file.is_open() || !getline(file, header))
+        {
+            return false;
+        }
+        size_t space = header.find(' ');
+        if (space == string::npos || header.compare(space + 1, string::npos, key) != 0)
+        {
+            return false;
+        }
+        time_t fetched = strtoll(header.c_str(), nullptr, 10);
+        fresh = time(nullptr) - fetched < options.cacheSeconds;
+
+        ostringstream contents;
+        contents << file.rdbuf();
+        body = contents.str();
+        return true;
+    }
+
+    void writeCache(const string &key, const string &body) const
+    {
+        if (options.cacheSeconds <= 0)
+        {
+            return;
+        }
+        error_code ignored;
+        filesystem::create_directories(options.cacheDirectory, ignored);
+
+        // Processes sharing the directory may store the same query at once,
+        // so each writes a temporary of its own before the rename
+        string path = cachePath(key);
+        string temporary = path + ".XXXXXX";
+        int fd = mkstemp(temporary.data());
+        if (fd < 0)
+        {
+            return;
+        }
+        string contents = to_string(time(nullptr)) + " " + key + "\n" + body;
+        size_t written = 0;
+        while (written < contents.size())
+        {
+            ssize_t count = write(fd, contents.data() + written, contents.size() - written);
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (count <= 0)
+            {
+                break;
+            }
+            written += count;
+        }
+        bool ok = written == contents.size() && fchmod(fd, 0644) == 0;
+        ok = close(fd) == 0 && ok;
+        if (!ok || rename(temporary.c_str(), path.c_str()) != 0)
+        {
+            unlink(temporary.c_str());
+        }
+    }
+
+    // Fetches result.query, whose cache entry is missing or expired
+    void fetch(const string &key, Result &result, const string &staleBody)
+    {
+        string url = options.endpoint + "/foods/search?query=" + encodeComponent(key) +
+                     "&api_key=" + encodeComponent(options.apiKey);
+        HttpClientResponse response;
+        string error;
+        if (transport->get(url, response, error))
+        {
+            if (response.status == 200)
+            {
+                try
+                {
+                    result.response = json::parse(response.body);
+                    result.ok = true;
+                    writeCache(key, response.body);
+                    return;
+                }
+                catch (const exception &e)
+                {
+                    error = "Invalid response: " + string(e.what());
+                }
+            }
+            else
+            {
+                error = "The USDA service answered with HTTP status " + to_string(response.status);
+            }
+        }
+
+        if (!staleBody.empty())
+        {
+            try
+            {
+                result.response = json::parse(staleBody);
+                result.ok = result.cached = result.stale = true;
+                return;
+            }
+            catch (const exception &)
+            {
+            }
+        }
+        result.error = error;
+    }
+
+public:
+    explicit UsdaClient(Options options = Options::fromEnvironment(),
+                        shared_ptr<HttpTransport> transport = makeHttpTransport())
+        : options(move(options)), transport(move(transport)) {}
+
+    Result search(const string &query)
+    {
+        return move(searchMany({query})[0]);
+    }
+
+    // Results in the order of queries. Queries that are the same once
+    // normalized are fetched once; the others are fetched concurrently, on
+    // threads of their own since they mostly wait for the network.
+    vector<Result> searchMany(const vector<string> &queries)
+    {
+        vector<Result> results(queries.size());
+        map<string, size_t> firstByKey;
+        vector<size_t> duplicates;
+        struct Pending
+        {
+            size_t index;
+            string key;
+            string staleBody;
+        };
+        vector<Pending> pending;
+
+        for (size_t i = 0; i < queries.size(); ++i)
+        {
+            Result &result = results[i];
+            result.query = queries[i];
+            string key = normalize(queries[i]);
+            if (key.empty())
+            {
+                result.error = "Search query cannot be empty";
+                continue;
+            }
+            if (!firstByKey.emplace(key, i).second)
+            {
+                duplicates.push_back(i);
+                continue;
+            }
+
+            string body;
+            bool fresh = false;
+            if (readCache(key, body, fresh) && fresh)
+            {
+                try
+                {
+                    result.response = json::parse(body);
+                    result.ok = result.cached = true;
+                    continue;
+                }
+                catch (const exception &)
+                {
+                    body.clear(); // Damaged; fetched again
+                }
+            }
+            pending.push_back({i, move(key), move(body)});
+        }
+
+        atomic<size_t> next{0};
+        auto work = [&]
+        {
+            for (size_t i; (i = next.fetch_add(1)) < pending.size();)
+            {
+                fetch(pending[i].key, results[pending[i].index], pending[i].staleBody);
+            }
+        };
+        vector<thread> threads;
+        for (size_t i = 1; i < min(pending.size(), max<size_t>(options.maxConcurrent, 1)); ++i)
+        {
+            threads.emplace_back(work);
+        }
+        work();
+        for (auto &worker : threads)
+        {
+            worker.join();
+        }
+
+        for (size_t i : duplicates)
+        {
+            string query = results[i].query;
+            results[i] = results[firstByKey[normalize(query)]];
+            results[i].query = move(query);
+        }
+        return results;
+    }
+
+    // Deletes cache entries that expired more than a cache lifetime ago;
+    // the ones in between are kept for when the service cannot be reached
+    void pruneCache() const
+    {
+        if (options.cacheSeconds <= 0)
+        {
+            return;
+        }
+        error_code error;
+        auto now = filesystem::file_time_type::clock::now();
+        for (const auto &entry : filesystem::directory_iterator(options.cacheDirectory, error))
+        {
+            auto modified = entry.last_write_time(error);
+            if (!error && now - modified > chrono::seconds(2 * options.cacheSeconds))
+            {
+                filesystem::remove(entry.path(), error);
+            }
+        }
+    }
+};
+
+#endif
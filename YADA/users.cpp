@@ -0,0 +1,220 @@
+#ifndef USERS_CPP
+#define USERS_CPP
+
+#include "food.cpp"
+#include "log.cpp"
+#include "profile.cpp"
+#include <filesystem>
+using namespace std;
+
+// Per-user state: logs with their undo history, and the profile. The food
+// catalog is not part of it; every session refers to the shared one.
+class UserSession
+{
+private:
+    string name;
+
+public:
+    LogManager logManager;
+    ProfileManager profileManager;
+
+    UserSession(const string &name, const FoodManager &foodManager,
+                const string &logFile, const string &profileFile)
+        : name(name), logManager(foodManager, logFile), profileManager(profileFile) {}
+
+    string getName() const { return name; }
+
+    bool isModified() const
+    {
+        return logManager.isModified() || profileManager.isModified();
+    }
+};
+
+// Hosts any number of users in one process over a single FoodManager.
+// Sessions are created and loaded on first use.
+class UserManager
+{
+private:
+    const FoodManager &foodManager;
+    map<string, unique_ptr<UserSession>> sessions;
+    size_t historyDepth = 100;
+    bool persistHistory = false;
+
+public:
+    static constexpr const char *DEFAULT_USER = "default";
+
+    UserManager(const FoodManager &foodManager) : foodManager(foodManager) {}
+
+    static bool isValidName(const string &name)
+    {
+        if (name.empty() || name.size() > 64)
+        {
+            return false;
+        }
+        for (char c : name)
+        {
+            if (!isalnum(static_cast<unsigned char>(c)) && c != '_' && c != '-')
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // The default user keeps the original single-user file names
+    static string directoryFor(const string &name)
+    {
+        return name == DEFAULT_USER ? "" : "users/" + name + "/";
+    }
+
+    // Applies to sessions created from now on
+    void setHistoryOptions(size_t depth, bool persist)
+    {
+        historyDepth = depth;
+        persistHistory = persist;
+    }
+
+    bool hasSession(const string &name) const
+    {
+        return sessions.count(name) > 0;
+    }
+
+    // Whether the user has a session or a directory; the default user
+    // always exists
+    bool userExists(const string &name) const
+    {
+        if (name == DEFAULT_USER || hasSession(name))
+        {
+            return true;
+        }
+        error_code ignored;
+        return filesystem::is_directory(directoryFor(name), ignored);
+    }
+
+    // The session of an existing user, loading it if needed, or nullptr.
+    // Unlike getSession, never creates a user.
+    UserSession *findSession(const string &name)
+    {
+        return userExists(name) ? &getSession(name) : nullptr;
+    }
+
+    // Returns the user's session, creating and loading it if needed. The
+    // flags report whether the log and profile files existed.
+    UserSession &getSession(const string &name, bool *logLoaded = nullptr, bool *profileLoaded = nullptr)
+    {
+        auto it = sessions.find(name);
+        if (it != sessions.end())
+        {
+            return *it->second;
+        }
+
+        auto session = createSession(name);
+        bool logFound = session->logManager.loadLog();
+        bool profileFound = session->profileManager.loadProfile();
+        if (logLoaded)
+        {
+            *logLoaded = logFound;
+        }
+        if (profileLoaded)
+        {
+            *profileLoaded = profileFound;
+        }
+
+        return addSession(move(session));
+    }
+
+    // A session for the user that is set up but not loaded yet, for callers
+    // that load the files themselves; addSession then makes it available
+    unique_ptr<UserSession> createSession(const string &name) const
+    {
+        string directory = directoryFor(name);
+        if (!directory.empty())
+        {
+            error_code ignored;
+            filesystem::create_directories(directory, ignored);
+        }
+
+        auto session = make_unique<UserSession>(name, foodManager,
+                                                directory + "daily_logs.json",
+                                                directory + "user_profile.json");
+        session->logManager.configureHistory(historyDepth, persistHistory);
+        return session;
+    }
+
+    UserSession &addSession(unique_ptr<UserSession> session)
+    {
+        auto &result = *session;
+        string name = result.getName();
+        sessions[name] = move(session);
+        return result;
+    }
+
+    vector<string> getLoadedUsers() const
+    {
+        vector<string> names;
+        for (const auto &[name, _] : sessions)
+        {
+            names.push_back(name);
+        }
+        return names;
+    }
+
+    // Saves the log and profile of every loaded user that has changes.
+    // Returns false if any of them could not be written.
+    bool saveModified()
+    {
+        bool success = true;
+        for (const auto &[_, session] : sessions)
+        {
+            if (session->logManager.isModified() && !session->logManager.saveLog())
+            {
+                success = false;
+            }
+            if (session->profileManager.isModified() && !session->profileManager.saveProfile())
+            {
+                success = false;
+            }
+        }
+        return success;
+    }
+
+    // Snapshots of the logs and profiles that have changes, which are no
+    // longer marked modified; see LogManager::captureSave
+    vector<FileSnapshot> captureModified()
+    {
+        vector<FileSnapshot> snapshots;
+        auto append = [&](vector<FileSnapshot> captured)
+        {
+            for (auto &snapshot : captured)
+            {
+                snapshots.push_back(move(snapshot));
+            }
+        };
+        for (const auto &[_, session] : sessions)
+        {
+            if (session->logManager.isModified())
+            {
+                append(session->logManager.captureSave());
+            }
+            if (session->profileManager.isModified())
+            {
+                append(session->profileManager.captureSave());
+            }
+        }
+        return snapshots;
+    }
+
+    bool isModified() const
+    {
+        for (const auto &[_, session] : sessions)
+        {
+            if (session->isModified())
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+#endif